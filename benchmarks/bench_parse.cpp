@@ -0,0 +1,172 @@
+#include "../path_filter.h"
+#include "../scoped_tempdir.h"
+#include "../vp_parser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+
+// Parse-throughput benchmark: builds synthetic packages of various sizes and
+// reports how many index entries per second vp_index::parse gets through, and
+// how quickly include/exclude patterns can be evaluated over the result.
+
+// VP file format structures (copied from vp_parser.cpp for benchmarking)
+struct vp_header {
+	char header[4];
+	int version;
+	int diroffset;
+	int direntries;
+};
+
+struct vp_direntry {
+	int offset;
+	int size;
+	char name[32];
+	int timestamp;
+};
+
+static const int files_per_dir = 1000;
+
+// Write a package with the requested number of index entries. All the file
+// entries share a single byte of payload; only the index matters here.
+static int write_synthetic_package(const std::filesystem::path& path, int target_entries)
+{
+	std::ofstream vp(path, std::ios::binary);
+
+	vp_header hdr;
+	memcpy(hdr.header, "VPVP", 4);
+	hdr.version = 2;
+	hdr.diroffset = sizeof(vp_header) + 1;
+	hdr.direntries = 0;
+	vp.write((char*)&hdr, sizeof(hdr));
+	vp.put('x');
+
+	auto write_entry = [&vp, &hdr](const char* name, int offset, int size) {
+		vp_direntry entry;
+		memset(&entry, 0, sizeof(entry));
+		snprintf(entry.name, sizeof(entry.name), "%s", name);
+		entry.offset = offset;
+		entry.size = size;
+		vp.write((char*)&entry, sizeof(entry));
+		++hdr.direntries;
+	};
+
+	write_entry("data", 0, 0);
+	int dir = 0;
+	// Each subdirectory costs two entries on top of its files, and the final
+	// updir for "data" needs one more
+	while (target_entries - hdr.direntries >= 3) {
+		int files = std::min(files_per_dir, target_entries - hdr.direntries - 3);
+		char name[32];
+		snprintf(name, sizeof(name), "dir%05d", dir++);
+		write_entry(name, 0, 0);
+		for (int f = 0; f < files; ++f) {
+			snprintf(name, sizeof(name), "file%05d.tbl", f);
+			write_entry(name, sizeof(vp_header), 1);
+		}
+		write_entry("..", 0, 0);
+	}
+	write_entry("..", 0, 0);
+
+	vp.seekp(0);
+	vp.write((char*)&hdr, sizeof(hdr));
+	return hdr.direntries;
+}
+
+// Best-of-N wall time in seconds
+static double time_best(int runs, const std::function<void()>& f)
+{
+	double best = 0;
+	for (int i = 0; i < runs; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (i == 0 || elapsed.count() < best) {
+			best = elapsed.count();
+		}
+	}
+	return best;
+}
+
+static void report(const char* label, int entries, double seconds)
+{
+	printf("  %-28s %10.2f ms  %14.0f entries/sec\n", label, seconds * 1000, entries / seconds);
+}
+
+int main()
+{
+	scoped_tempdir tmpd("vptool-bench-");
+	if (!tmpd) {
+		std::cerr << "Could not create a temporary directory\n";
+		return 1;
+	}
+
+	const int runs = 3;
+	for (int target : { 10000, 100000, 1000000 }) {
+		std::filesystem::path path = tmpd / ("bench_" + std::to_string(target) + ".vp");
+		int entries = write_synthetic_package(path, target);
+		printf("%d entries (%ju bytes)\n", entries, (uintmax_t)std::filesystem::file_size(path));
+
+		// Reference point: the old parser's I/O pattern, one read() per entry
+		double per_entry = time_best(runs, [&path]() {
+			std::ifstream in(path, std::ios::binary);
+			vp_header hdr;
+			in.read((char*)&hdr, sizeof(hdr));
+			in.seekg(hdr.diroffset);
+			for (int i = 0; i < hdr.direntries; ++i) {
+				vp_direntry entry;
+				in.read((char*)&entry, sizeof(entry));
+			}
+		});
+		report("per-entry reads (I/O only)", entries, per_entry);
+
+		for (auto [label, mode] : { std::pair { "parse (read-write)", VP_READ_WRITE },
+				 std::pair { "parse (read-only mapped)", VP_READ_ONLY } }) {
+			double seconds = time_best(runs, [&path, mode = mode]() {
+				vp_index idx;
+				if (!idx.parse(path.string(), mode)) {
+					std::cerr << "Failed to parse " << path << std::endl;
+				}
+			});
+			report(label, entries, seconds);
+		}
+
+		// Warm the sidecar cache once, then time opening with it
+		std::string cache = path.string() + ".idx";
+		{
+			vp_index idx;
+			idx.parse(path.string(), VP_READ_ONLY, cache);
+		}
+		double cached = time_best(runs, [&path, &cache]() {
+			vp_index idx;
+			if (!idx.parse(path.string(), VP_READ_ONLY, cache)) {
+				std::cerr << "Failed to parse " << path << std::endl;
+			}
+		});
+		report("parse (cached index)", entries, cached);
+
+		vp_index idx;
+		idx.parse(path.string(), VP_READ_ONLY, cache);
+		for (auto [label, pattern] : { std::pair { "select by name", "*.TBL" },
+				 std::pair { "select by path", "**/dir0000[0-4]/file0000?.tbl" } }) {
+			path_filter filter;
+			filter.include(pattern);
+			size_t selected = 0;
+			double seconds = time_best(runs, [&idx, &filter, &selected]() {
+				selected = idx.select(filter).size();
+			});
+			report(label, entries, seconds);
+			if (selected == 0) {
+				std::cerr << "Pattern " << pattern << " selected nothing\n";
+			}
+		}
+	}
+
+	return 0;
+}
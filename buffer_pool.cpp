@@ -0,0 +1,35 @@
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool(size_t count, size_t size)
+	: m_size(size)
+	, m_count(count ? count : 1)
+{
+	m_storage = new char[m_count * m_size];
+	m_free.reserve(m_count);
+	for (size_t i = 0; i < m_count; ++i) {
+		m_free.push_back(m_storage + i * m_size);
+	}
+}
+
+buffer_pool::~buffer_pool()
+{
+	delete[] m_storage;
+}
+
+char* buffer_pool::acquire()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_available.wait(guard, [this]() { return !m_free.empty(); });
+	char* buf = m_free.back();
+	m_free.pop_back();
+	return buf;
+}
+
+void buffer_pool::release(char* buf)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_free.push_back(buf);
+	}
+	m_available.notify_one();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * A fixed set of equally sized buffers, allocated once and handed out over
+ * and over. acquire() blocks while every buffer is in use, so a pipeline
+ * built on a pool can never hold more than count * size bytes of data,
+ * however large the files going through it are.
+ */
+class buffer_pool {
+public:
+	buffer_pool(size_t count, size_t size);
+	~buffer_pool();
+
+	buffer_pool(const buffer_pool&) = delete;
+	buffer_pool& operator=(const buffer_pool&) = delete;
+
+	/// Take a buffer, waiting for one to be released if need be
+	char* acquire();
+
+	/// Hand a buffer from acquire() back to the pool
+	void release(char* buf);
+
+	size_t buffer_size() const { return m_size; }
+	size_t count() const { return m_count; }
+
+private:
+	char* m_storage;
+	size_t m_size;
+	size_t m_count;
+
+	std::mutex m_lock;
+	std::condition_variable m_available;
+	std::vector<char*> m_free;
+};
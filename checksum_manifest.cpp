@@ -0,0 +1,39 @@
+#include "checksum_manifest.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+
+void write_checksum_manifest(std::ostream& out, const std::vector<vp_checksum>& sums)
+{
+	char prefix[32];
+	for (const vp_checksum& sum : sums) {
+		snprintf(prefix, sizeof(prefix), "%08" PRIx32 " %" PRIu64 " ", sum.crc, sum.size);
+		out << prefix << sum.path << '\n';
+	}
+}
+
+bool read_checksum_manifest(std::istream& in, std::vector<vp_checksum>& sums)
+{
+	std::string line;
+	for (int line_no = 1; std::getline(in, line); ++line_no) {
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == std::string::npos || line[start] == '#') {
+			continue;
+		}
+		if (line.back() == '\r') {
+			line.pop_back();
+		}
+
+		vp_checksum sum;
+		int path_start = -1;
+		if (sscanf(line.c_str() + start, "%8" SCNx32 " %" SCNu64 " %n", &sum.crc, &sum.size, &path_start) != 2
+			|| path_start < 0 || start + path_start >= line.size()) {
+			std::cerr << "Manifest line " << line_no << ": expected a checksum, a size and a path\n";
+			return false;
+		}
+		sum.path = line.substr(start + path_start);
+		sums.push_back(std::move(sum));
+	}
+	return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * The checksum of one file in a package, from a checksum manifest.
+ */
+struct vp_checksum {
+	std::string path; // Internal path, e.g. "data/tables/ai.tbl"
+	uint64_t size = 0;
+	uint32_t crc = 0; // CRC-32C of the file's data
+};
+
+/**
+ * Writes a checksum manifest: one file per line, in the form
+ *
+ *     <crc> <size> <path>
+ *
+ * where crc is eight hex digits and the path runs to the end of the line, so
+ * it may contain spaces.
+ */
+void write_checksum_manifest(std::ostream& out, const std::vector<vp_checksum>& sums);
+
+/**
+ * Reads a manifest written by write_checksum_manifest(). Blank lines and lines
+ * starting with '#' are ignored. Returns false, saying which line is wrong on
+ * stderr, if any line can't be understood. Checksums are appended to sums in
+ * the order they appear.
+ */
+bool read_checksum_manifest(std::istream& in, std::vector<vp_checksum>& sums);
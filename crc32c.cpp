@@ -0,0 +1,148 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+// Reversed Castagnoli polynomial
+static const uint32_t poly = 0x82F63B78;
+
+// Eight 256-entry tables for the portable version: table[0] is the classic
+// byte-at-a-time table, table[k] advances a byte k more bytes
+struct crc_tables {
+	uint32_t t[8][256];
+
+	crc_tables()
+	{
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) {
+				c = (c & 1) ? (c >> 1) ^ poly : c >> 1;
+			}
+			t[0][i] = c;
+		}
+		for (uint32_t i = 0; i < 256; ++i) {
+			for (int k = 1; k < 8; ++k) {
+				t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+			}
+		}
+	}
+};
+
+static uint32_t crc32c_portable(uint32_t crc, const unsigned char* p, size_t size)
+{
+	static const crc_tables tables;
+	const auto& t = tables.t;
+
+	while (size >= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		v ^= crc;
+		crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff]
+			^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+		p += 8;
+		size -= 8;
+	}
+	while (size-- > 0) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	}
+	return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t size)
+{
+#ifdef __x86_64__
+	uint64_t c = crc;
+	while (size >= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+		p += 8;
+		size -= 8;
+	}
+	crc = c;
+#endif
+	while (size >= 4) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		size -= 4;
+	}
+	while (size-- > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size)
+{
+#ifdef CRC32C_HAVE_SSE42
+	static const bool have_sse42 = __builtin_cpu_supports("sse4.2");
+	if (have_sse42) {
+		return ~crc32c_sse42(~crc, (const unsigned char*)data, size);
+	}
+#endif
+	return ~crc32c_portable(~crc, (const unsigned char*)data, size);
+}
+
+// Combining works with polynomials over GF(2): appending n zero bytes to
+// some data multiplies its CRC by x^(8n) modulo the CRC polynomial. This is
+// the same approach zlib takes for crc32_combine().
+
+// a * b modulo the polynomial, in the reflected bit order
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ poly : b >> 1;
+	}
+	return p;
+}
+
+// x^(2^k) modulo the polynomial, for k = 0..31
+struct power_table {
+	uint32_t t[32];
+
+	power_table()
+	{
+		uint32_t p = 1u << 30; // x^1
+		t[0] = p;
+		for (int k = 1; k < 32; ++k) {
+			t[k] = p = multmodp(p, p);
+		}
+	}
+};
+
+// x^(n * 2^k) modulo the polynomial
+static uint32_t x2nmodp(uint64_t n, unsigned k)
+{
+	static const power_table powers;
+	uint32_t p = 1u << 31; // x^0
+	while (n) {
+		if (n & 1) {
+			p = multmodp(powers.t[k & 31], p);
+		}
+		n >>= 1;
+		++k;
+	}
+	return p;
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t size2)
+{
+	return multmodp(x2nmodp(size2, 3), crc1) ^ crc2;
+}
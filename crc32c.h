@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC-32C (Castagnoli), the checksum used by iSCSI, ext4 and friends.
+ *
+ * On x86 CPUs with SSE 4.2 this uses the crc32 instruction, picked at run
+ * time, and otherwise falls back to table lookups eight bytes at a time.
+ * Checksums are conditioned the usual way (pre- and post-inverted), so
+ * crc32c(0, "123456789", 9) is 0xE3069283.
+ */
+
+/// Extend crc, the checksum of some earlier data (or 0 to start), over size
+/// more bytes
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+/// Checksum of two pieces of data back to back, given the checksum of each
+/// and the size of the second. This lets the pieces of a big input be
+/// checksummed on different threads.
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
@@ -0,0 +1,133 @@
+#include "delta.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Added to every byte, as rsync does, so runs of zeros don't all sum to zero
+static const uint32_t char_offset = 31;
+
+static const uint32_t none = UINT32_MAX;
+
+size_t delta_block_size(size_t old_size)
+{
+	// About the square root of the size, which balances the number of
+	// blocks against how much a single changed byte costs
+	size_t block = (size_t)std::sqrt((double)old_size) & ~(size_t)7;
+	return std::clamp<size_t>(block, 512, 64 * 1024);
+}
+
+// The two halves of the rolling checksum of a window
+static void window_sums(const unsigned char* p, size_t size, uint32_t& a, uint32_t& b)
+{
+	a = b = 0;
+	for (size_t i = 0; i < size; ++i) {
+		a += p[i] + char_offset;
+		b += a;
+	}
+}
+
+static inline uint32_t weak_hash(uint32_t a, uint32_t b)
+{
+	return (a & 0xffff) | (b << 16);
+}
+
+// How many bytes a and b have in common from the start, up to max
+static size_t common_prefix(const char* a, const char* b, size_t max)
+{
+	size_t n = 0;
+	const size_t step = 4096;
+	while (n + step <= max && memcmp(a + n, b + n, step) == 0) {
+		n += step;
+	}
+	while (n < max && a[n] == b[n]) {
+		++n;
+	}
+	return n;
+}
+
+void make_delta(const char* old_data, size_t old_size, const char* new_data, size_t new_size,
+	const std::function<void(const delta_op&)>& emit)
+{
+	size_t literal = 0; // Start of the new data not yet emitted
+	auto flush_literal = [&](size_t end) {
+		if (end > literal) {
+			emit({ false, literal, end - literal });
+		}
+	};
+
+	size_t block = delta_block_size(old_size);
+	if (old_size < block || new_size < block) {
+		flush_literal(new_size);
+		return;
+	}
+
+	// Index the old data's blocks by checksum. Blocks with the same checksum
+	// are chained, earliest first.
+	uint32_t num_blocks = old_size / block;
+	std::unordered_map<uint32_t, uint32_t> heads;
+	heads.reserve(num_blocks);
+	std::vector<uint32_t> next(num_blocks, none);
+	for (uint32_t i = num_blocks; i-- > 0;) {
+		uint32_t a, b;
+		window_sums((const unsigned char*)old_data + (size_t)i * block, block, a, b);
+		auto [it, inserted] = heads.try_emplace(weak_hash(a, b), i);
+		if (!inserted) {
+			next[i] = it->second;
+			it->second = i;
+		}
+	}
+
+	const unsigned char* data = (const unsigned char*)new_data;
+	size_t pos = 0;
+	uint32_t a = 0, b = 0;
+	bool fresh = true;
+	while (pos + block <= new_size) {
+		if (fresh) {
+			window_sums(data + pos, block, a, b);
+			fresh = false;
+		}
+
+		uint32_t match = none;
+		auto it = heads.find(weak_hash(a, b));
+		if (it != heads.end()) {
+			for (uint32_t i = it->second; i != none; i = next[i]) {
+				if (memcmp(old_data + (size_t)i * block, new_data + pos, block) == 0) {
+					match = i;
+					break;
+				}
+			}
+		}
+
+		if (match != none) {
+			// Stretch the match forwards, then back into the pending literal
+			size_t from = (size_t)match * block;
+			size_t len = block
+				+ common_prefix(old_data + from + block, new_data + pos + block,
+					std::min(old_size - from, new_size - pos) - block);
+			size_t back = 0;
+			while (back < pos - literal && back < from && old_data[from - back - 1] == new_data[pos - back - 1]) {
+				++back;
+			}
+			flush_literal(pos - back);
+			emit({ true, from - back, len + back });
+			pos += len;
+			literal = pos;
+			fresh = true;
+			continue;
+		}
+
+		// Slide the window along a byte
+		if (pos + block == new_size) {
+			break;
+		}
+		uint32_t out = data[pos] + char_offset;
+		uint32_t in = data[pos + block] + char_offset;
+		a += in - out;
+		b += a - (uint32_t)block * out;
+		++pos;
+	}
+	flush_literal(new_size);
+}
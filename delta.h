@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/**
+ * One piece of a delta: either a range of the old data to copy, or a range
+ * of the new data that has to be sent as it is.
+ */
+struct delta_op {
+	bool copy; // Copy from the old data, or take from the new data
+	uint64_t offset; // In the old data for a copy, the new data otherwise
+	uint64_t size;
+};
+
+/**
+ * Works out how to make new_data out of old_data, rsync-style: the old data
+ * is cut into blocks, each of which is indexed under a rolling checksum, and
+ * a window slides over the new data looking for them. A block whose checksum
+ * matches is confirmed byte for byte, then the match is stretched as far as
+ * the data agrees in both directions.
+ *
+ * emit is called with the pieces in order, and together they cover the new
+ * data exactly once. Neighbouring new-data pieces are merged, but copies are
+ * left as they were found.
+ */
+void make_delta(const char* old_data, size_t old_size, const char* new_data, size_t new_size,
+	const std::function<void(const delta_op&)>& emit);
+
+/// The block size make_delta() uses for old data of the given size
+size_t delta_block_size(size_t old_size);
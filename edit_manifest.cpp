@@ -0,0 +1,79 @@
+#include "edit_manifest.h"
+
+#include <cctype>
+#include <iostream>
+
+// Split a manifest line into fields. Returns false if a quote isn't closed.
+static bool split_fields(const std::string& line, std::vector<std::string>& fields)
+{
+	size_t i = 0;
+	while (i < line.size()) {
+		if (isspace((unsigned char)line[i])) {
+			++i;
+			continue;
+		}
+
+		std::string field;
+		if (line[i] == '"') {
+			for (++i; i < line.size() && line[i] != '"'; ++i) {
+				if (line[i] == '\\' && i + 1 < line.size()) {
+					++i;
+				}
+				field += line[i];
+			}
+			if (i == line.size()) {
+				return false;
+			}
+			++i;
+		} else {
+			while (i < line.size() && !isspace((unsigned char)line[i])) {
+				field += line[i++];
+			}
+		}
+		fields.push_back(field);
+	}
+	return true;
+}
+
+bool read_edit_manifest(std::istream& in, std::vector<vp_edit>& edits)
+{
+	std::string line;
+	for (int line_no = 1; std::getline(in, line); ++line_no) {
+		std::vector<std::string> fields;
+		if (!split_fields(line, fields)) {
+			std::cerr << "Manifest line " << line_no << ": unterminated quote\n";
+			return false;
+		}
+		if (fields.empty() || fields[0][0] == '#') {
+			continue;
+		}
+
+		vp_edit edit;
+		size_t expected = 3;
+		if (fields[0] == "replace") {
+			edit.kind = vp_edit::REPLACE;
+		} else if (fields[0] == "add") {
+			edit.kind = vp_edit::ADD;
+		} else if (fields[0] == "delete") {
+			edit.kind = vp_edit::DELETE;
+			expected = 2;
+		} else if (fields[0] == "rename") {
+			edit.kind = vp_edit::RENAME;
+		} else {
+			std::cerr << "Manifest line " << line_no << ": unknown edit " << fields[0] << "\n";
+			return false;
+		}
+
+		if (fields.size() != expected) {
+			std::cerr << "Manifest line " << line_no << ": " << fields[0] << " takes " << expected - 1
+					  << (expected == 2 ? " argument" : " arguments") << ", not " << fields.size() - 1 << "\n";
+			return false;
+		}
+		edit.path = fields[1];
+		if (expected == 3) {
+			edit.arg = fields[2];
+		}
+		edits.push_back(edit);
+	}
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+/**
+ * One change to make to a package, from an edit manifest.
+ */
+struct vp_edit {
+	enum kind_type {
+		REPLACE, // Give the file at path the contents of the file at arg
+		ADD, // Add a new file at path with the contents of the file at arg
+		DELETE, // Remove the file at path
+		RENAME, // Move the file at path to the internal path arg
+	};
+
+	kind_type kind;
+	std::string path;
+	std::string arg;
+};
+
+/**
+ * Reads an edit manifest: one edit per line, in the form
+ *
+ *     replace <path> <source file>
+ *     add     <path> <source file>
+ *     delete  <path>
+ *     rename  <path> <new path>
+ *
+ * where paths are internal package paths ("data/tables/ai.tbl") and source
+ * files are on disk. Fields are separated by whitespace; one containing
+ * spaces can be put in double quotes, with \" and \\ for a quote or a
+ * backslash. Blank lines and lines starting with '#' are ignored.
+ *
+ * Returns false, saying which line is wrong on stderr, if any line can't be
+ * understood. Edits are appended to edits in the order they appear.
+ */
+bool read_edit_manifest(std::istream& in, std::vector<vp_edit>& edits);
@@ -0,0 +1,169 @@
+#include "file_copy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Largest amount to ask the kernel for in one go; sendfile() won't move more
+// than about 2GB per call anyway
+static const size_t max_chunk = 1 << 30;
+
+// Size of the bounce buffer used when the kernel can't do the copy for us
+static const size_t buffer_size = 1 << 20;
+
+bool write_all(int fd, const void* buf, size_t size)
+{
+	const char* p = (const char*)buf;
+	while (size > 0) {
+		ssize_t written = ::write(fd, p, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool pwrite_all(int fd, const void* buf, size_t size, uint64_t offset)
+{
+	const char* p = (const char*)buf;
+	while (size > 0) {
+		ssize_t written = ::pwrite(fd, p, size, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += written;
+		size -= written;
+		offset += written;
+	}
+	return true;
+}
+
+bool copy_range(int in_fd, uint64_t in_offset, uint64_t size, int out_fd)
+{
+	off_t offset = in_offset;
+	uint64_t remaining = size;
+
+	// Either call can refuse a particular pair of files (different
+	// filesystems, pipes, old kernels...). When that happens just move on to
+	// the next method and carry on from wherever the last one got to; a
+	// genuine I/O error will show up again in the buffered copy.
+	while (remaining > 0) {
+		ssize_t n = copy_file_range(in_fd, &offset, out_fd, nullptr, std::min<uint64_t>(remaining, max_chunk), 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		remaining -= n;
+	}
+
+	while (remaining > 0) {
+		ssize_t n = sendfile(out_fd, in_fd, &offset, std::min<uint64_t>(remaining, max_chunk));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		remaining -= n;
+	}
+
+	if (remaining > 0) {
+		static thread_local std::vector<char> buf(buffer_size);
+		while (remaining > 0) {
+			ssize_t n = pread(in_fd, buf.data(), std::min<uint64_t>(remaining, buf.size()), offset);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0 || !write_all(out_fd, buf.data(), n)) {
+				return false;
+			}
+			offset += n;
+			remaining -= n;
+		}
+	}
+
+	return true;
+}
+
+// pread() until the buffer is full, the file ends or something goes wrong
+static ssize_t read_full(int fd, char* buf, size_t size, off_t offset)
+{
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = pread(fd, buf + done, size - done, offset + done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		done += n;
+	}
+	return done;
+}
+
+bool pread_all(int fd, void* buf, size_t size, uint64_t offset)
+{
+	return read_full(fd, (char*)buf, size, offset) == (ssize_t)size;
+}
+
+bool ranges_equal(int in_fd, uint64_t in_offset, uint64_t size, int other_fd)
+{
+	static thread_local std::vector<char> a(buffer_size);
+	static thread_local std::vector<char> b(buffer_size);
+
+	for (uint64_t done = 0; done < size;) {
+		size_t chunk = std::min<uint64_t>(size - done, buffer_size);
+		if (read_full(in_fd, a.data(), chunk, in_offset + done) != (ssize_t)chunk
+			|| read_full(other_fd, b.data(), chunk, done) != (ssize_t)chunk
+			|| memcmp(a.data(), b.data(), chunk) != 0) {
+			return false;
+		}
+		done += chunk;
+	}
+	return true;
+}
+
+bool set_mtime(int fd, int64_t timestamp)
+{
+	struct timespec times[2];
+	times[0].tv_sec = timestamp;
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
+	return futimens(fd, times) == 0;
+}
+
+bool rename_durably(const std::string& from, const std::string& to)
+{
+	if (::rename(from.c_str(), to.c_str()) != 0) {
+		return false;
+	}
+	size_t slash = to.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : to.substr(0, slash);
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = ::fsync(fd) == 0;
+	::close(fd);
+	return ok;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Write the whole buffer to fd, retrying on short writes and EINTR
+bool write_all(int fd, const void* buf, size_t size);
+
+/// Like write_all(), but at the given offset, leaving fd's position alone
+bool pwrite_all(int fd, const void* buf, size_t size, uint64_t offset);
+
+/// Read exactly size bytes at offset into buf, retrying on short reads and
+/// EINTR, leaving fd's position alone. Fails if the file ends first.
+bool pread_all(int fd, void* buf, size_t size, uint64_t offset);
+
+/// Copy size bytes starting at in_offset in in_fd to the current position of
+/// out_fd, without touching in_fd's file position. Where the kernel allows it
+/// the bytes never come up to userspace: copy_file_range() is tried first,
+/// then sendfile(), and only then a small bounce buffer.
+bool copy_range(int in_fd, uint64_t in_offset, uint64_t size, int out_fd);
+
+/// Whether the size bytes at in_offset in in_fd are the same as the first
+/// size bytes of other_fd. Neither descriptor's file position is used.
+bool ranges_equal(int in_fd, uint64_t in_offset, uint64_t size, int other_fd);
+
+/// Set the modification (and access) time of the open file to a Unix timestamp
+bool set_mtime(int fd, int64_t timestamp);
+
+/// Rename from over to, then sync the directory to is in so that the rename
+/// itself survives a crash. from's data should already have been synced.
+bool rename_durably(const std::string& from, const std::string& to);
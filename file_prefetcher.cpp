@@ -0,0 +1,170 @@
+#include "file_prefetcher.h"
+#include "buffer_pool.h"
+#include "lz41.h"
+#include "xxh64.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// How much of a large file to ask the kernel to start reading in up front.
+// The rest is left to its normal readahead once the copy gets going.
+static const off_t large_readahead = 8 << 20;
+
+file_prefetcher::file_prefetcher(const std::vector<std::filesystem::path>& paths, unsigned threads, buffer_pool& pool,
+	bool hash, bool compress)
+	: m_paths(paths)
+	, m_pool(pool)
+	, m_hash(hash)
+	, m_compress(compress)
+	, m_files(paths.size())
+	, m_ready(paths.size())
+{
+	for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+		m_threads.emplace_back(&file_prefetcher::run, this);
+	}
+}
+
+file_prefetcher::~file_prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stopping = true;
+	}
+	m_changed.notify_all();
+	for (auto& t : m_threads) {
+		t.join();
+	}
+	for (size_t i = m_released; i < m_files.size(); ++i) {
+		discard(m_files[i]);
+	}
+}
+
+void file_prefetcher::run()
+{
+	for (;;) {
+		size_t i;
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_changed.wait(guard, [this]() {
+				return m_stopping || m_next >= m_paths.size() || m_next < m_released + m_pool.count();
+			});
+			if (m_stopping || m_next >= m_paths.size()) {
+				return;
+			}
+			i = m_next++;
+		}
+
+		load(i);
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_ready[i] = true;
+		}
+		m_changed.notify_all();
+	}
+}
+
+void file_prefetcher::load(size_t i)
+{
+	file& f = m_files[i];
+	f.fd = ::open(m_paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (f.fd < 0 || fstat(f.fd, &st) != 0) {
+		return;
+	}
+	f.size = st.st_size;
+	f.mtime = st.st_mtime;
+
+	if (f.size > m_pool.buffer_size()) {
+		if (m_hash) {
+			// Reading it through here also leaves it in the page cache for
+			// the consumer's copy
+			f.ok = hash_file(f);
+			return;
+		}
+		posix_fadvise(f.fd, 0, std::min<off_t>(f.size, large_readahead), POSIX_FADV_WILLNEED);
+		f.ok = true;
+		return;
+	}
+
+	// Small enough to read in whole. No more than pool.count() files are
+	// ever in flight, so there's always a buffer to be had.
+	f.data = m_pool.acquire();
+	size_t done = 0;
+	while (done < f.size) {
+		ssize_t n = ::read(f.fd, f.data + done, f.size - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		done += n;
+	}
+	::close(f.fd);
+	f.fd = -1;
+	if (m_hash) {
+		f.hash = xxh64::hash(f.data, f.size);
+	}
+	if (m_compress) {
+		lz41_compress(f.data, f.size, f.packed);
+		if (!lz41_pays_off(f.size, f.packed.size())) {
+			f.packed.clear();
+		}
+	}
+	f.ok = true;
+}
+
+bool file_prefetcher::hash_file(file& f)
+{
+	static thread_local std::vector<char> buf(256 * 1024);
+	xxh64 h;
+	uint64_t offset = 0;
+	while (offset < f.size) {
+		ssize_t n = pread(f.fd, buf.data(), std::min<uint64_t>(buf.size(), f.size - offset), offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		h.update(buf.data(), n);
+		offset += n;
+	}
+	f.hash = h.digest();
+	return true;
+}
+
+void file_prefetcher::discard(file& f)
+{
+	if (f.fd >= 0) {
+		::close(f.fd);
+		f.fd = -1;
+	}
+	if (f.data) {
+		m_pool.release(f.data);
+		f.data = nullptr;
+	}
+	f.packed = {};
+}
+
+const file_prefetcher::file& file_prefetcher::get(size_t i)
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_changed.wait(guard, [this, i]() { return (bool)m_ready[i]; });
+	return m_files[i];
+}
+
+void file_prefetcher::release(size_t i)
+{
+	discard(m_files[i]);
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_released = i + 1;
+	}
+	m_changed.notify_all();
+}
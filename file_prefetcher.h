@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class buffer_pool;
+
+/**
+ * Opens and reads a list of files ahead of a consumer that takes them strictly
+ * in order, such as the package builder's writer.
+ *
+ * A set of reader threads works its way down the list, never getting more
+ * than a fixed window ahead of the consumer. Each file is opened and sized;
+ * a file that fits in one of the pool's buffers is read into it whole, and a
+ * bigger one is just opened, with the kernel asked to start reading it in, so
+ * the consumer can copy it straight from the descriptor.
+ *
+ * The readers can also compress the files they read in whole, so that work
+ * is spread over them too rather than left to the consumer.
+ */
+class file_prefetcher {
+public:
+	struct file {
+		int fd = -1;
+		uint64_t size = 0;
+		int64_t mtime = 0; // Modification time, as a Unix timestamp
+		char* data = nullptr; // Whole contents, if the file fit in a buffer
+		uint64_t hash = 0; // xxh64 of the contents, if asked for
+		std::vector<char> packed; // LZ41 form of data, if asked for and it pays off
+		bool ok = false; // False if the file couldn't be opened or read
+	};
+
+	/// Start the given number of readers (at least one) on paths. Small files
+	/// are read into buffers from pool, one each, and the readers stay at most
+	/// pool.count() files ahead of the consumer. With hash set, every file's
+	/// contents are hashed as well, which means reading big files through too.
+	/// With compress set, files read in whole are compressed as well.
+	file_prefetcher(const std::vector<std::filesystem::path>& paths, unsigned threads, buffer_pool& pool,
+		bool hash = false, bool compress = false);
+
+	/// Stops the readers and releases any files that were never taken
+	~file_prefetcher();
+
+	file_prefetcher(const file_prefetcher&) = delete;
+	file_prefetcher& operator=(const file_prefetcher&) = delete;
+
+	/// Wait for file i to be ready. Files must be taken in order, each one
+	/// released before the next is taken.
+	const file& get(size_t i);
+
+	/// Close file i and return its buffer, letting the readers move on
+	void release(size_t i);
+
+private:
+	void run();
+	void load(size_t i);
+	bool hash_file(file& f);
+	void discard(file& f);
+
+	const std::vector<std::filesystem::path>& m_paths;
+	buffer_pool& m_pool;
+	bool m_hash;
+	bool m_compress;
+	std::vector<file> m_files;
+	std::vector<char> m_ready;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	size_t m_next = 0; // Next file for a reader to pick up
+	size_t m_released = 0; // Files the consumer is done with
+	bool m_stopping = false;
+};
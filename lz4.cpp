@@ -0,0 +1,186 @@
+#include "lz4.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Lengths of 15 carry on in the following bytes, each adding up to 255
+static bool read_length(const uint8_t*& ip, const uint8_t* end, size_t& length)
+{
+	if (length != 15) {
+		return true;
+	}
+	uint8_t b;
+	do {
+		if (ip == end) {
+			return false;
+		}
+		b = *ip++;
+		length += b;
+	} while (b == 255);
+	return true;
+}
+
+int64_t lz4_decompress(const char* src, size_t src_size, char* dst, size_t dst_capacity)
+{
+	const uint8_t* ip = (const uint8_t*)src;
+	const uint8_t* const iend = ip + src_size;
+	uint8_t* op = (uint8_t*)dst;
+	uint8_t* const ostart = op;
+	uint8_t* const oend = op + dst_capacity;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t literals = token >> 4;
+		if (!read_length(ip, iend, literals) || literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) {
+			return -1;
+		}
+		memcpy(op, ip, literals);
+		ip += literals;
+		op += literals;
+
+		// The last sequence is literals only
+		if (ip == iend) {
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return -1;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t length = token & 15;
+		if (offset == 0 || offset > (size_t)(op - ostart) || !read_length(ip, iend, length)) {
+			return -1;
+		}
+		length += 4;
+		if (length > (size_t)(oend - op)) {
+			return -1;
+		}
+
+		// The match may overlap what it's writing, repeating a short pattern.
+		// Each copy doubles how much of the pattern is available.
+		const uint8_t* match = op - offset;
+		while (length > 0) {
+			size_t n = std::min<size_t>(length, op - match);
+			memcpy(op, match, n);
+			op += n;
+			length -= n;
+		}
+	}
+	return op - ostart;
+}
+
+// Limits from the format: the last five bytes of a block are always
+// literals, and the last match starts at least twelve bytes from the end
+static const size_t last_literals = 5;
+static const size_t match_limit = 12;
+static const size_t min_match = 4;
+static const size_t max_offset = 65535;
+
+// Matches are found through a table of recent positions, indexed by a hash
+// of the four bytes there
+static const int hash_bits = 12;
+
+static inline uint32_t read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t hash_position(const uint8_t* p)
+{
+	return (read32(p) * 2654435761u) >> (32 - hash_bits);
+}
+
+// Write the continuation bytes of a length of 15 or more
+static inline uint8_t* write_length(uint8_t* op, size_t length)
+{
+	for (length -= 15; length >= 255; length -= 255) {
+		*op++ = 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+int64_t lz4_compress(const char* src, size_t src_size, char* dst, size_t dst_capacity)
+{
+	const uint8_t* const istart = (const uint8_t*)src;
+	const uint8_t* const iend = istart + src_size;
+	const uint8_t* ip = istart;
+	const uint8_t* anchor = istart; // Start of the pending literals
+	uint8_t* op = (uint8_t*)dst;
+	uint8_t* const ostart = op;
+	uint8_t* const oend = op + dst_capacity;
+
+	// Emit the pending literals, followed by a match unless this is the end
+	auto emit = [&](size_t match_length, size_t offset) {
+		size_t literals = ip - anchor;
+		if ((size_t)(oend - op) < 1 + literals + literals / 255 + 1 + 2 + match_length / 255 + 1) {
+			return false;
+		}
+		uint8_t* token = op++;
+		*token = (uint8_t)(std::min<size_t>(literals, 15) << 4);
+		if (literals >= 15) {
+			op = write_length(op, literals);
+		}
+		memcpy(op, anchor, literals);
+		op += literals;
+		if (match_length == 0) {
+			return true;
+		}
+		*op++ = (uint8_t)offset;
+		*op++ = (uint8_t)(offset >> 8);
+		size_t length = match_length - min_match;
+		*token |= (uint8_t)std::min<size_t>(length, 15);
+		if (length >= 15) {
+			op = write_length(op, length);
+		}
+		return true;
+	};
+
+	if (src_size > match_limit) {
+		uint32_t table[1 << hash_bits] = {};
+		const uint8_t* const search_end = iend - match_limit;
+		const uint8_t* const match_end = iend - last_literals;
+
+		// The step grows the longer nothing matches, so incompressible data
+		// is skipped over quickly
+		size_t misses = 0;
+		while (ip < search_end) {
+			uint32_t h = hash_position(ip);
+			const uint8_t* ref = istart + table[h];
+			table[h] = ip - istart;
+			if (ref >= ip || (size_t)(ip - ref) > max_offset || read32(ref) != read32(ip)) {
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			// Take in any matching bytes just before, then extend forwards
+			while (ip > anchor && ref > istart && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			size_t length = min_match;
+			while (ip + length < match_end && ip[length] == ref[length]) {
+				++length;
+			}
+			if (!emit(length, ip - ref)) {
+				return -1;
+			}
+			ip += length;
+			anchor = ip;
+			if (ip < search_end) {
+				table[hash_position(ip - 2)] = ip - 2 - istart;
+			}
+		}
+	}
+
+	ip = iend;
+	if (!emit(0, 0)) {
+		return -1;
+	}
+	return op - ostart;
+}
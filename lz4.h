@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The LZ4 block format: a series of sequences, each some literal bytes and
+ * then a copy of earlier output. This is just the block format, as used
+ * inside LZ41 package entries (see lz41.h), not the LZ4 frame format with its
+ * own headers and checksums.
+ */
+
+/// Most a block of size bytes can compress to, for sizing output buffers
+inline size_t lz4_compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+/// Compress src as one block into dst, which has room for dst_capacity
+/// bytes. Returns the size of the block, or -1 if it wouldn't fit (it always
+/// fits in lz4_compress_bound(src_size) bytes). Blocks are standalone: no
+/// match reaches back before the start of src. This is a greedy single-pass
+/// compressor, going for speed rather than the smallest output.
+int64_t lz4_compress(const char* src, size_t src_size, char* dst, size_t dst_capacity);
+
+/// Decompress one block into dst, which has room for dst_capacity bytes.
+/// Returns the number of bytes written, or -1 if the block is malformed or
+/// wouldn't fit. Never reads or writes outside the given buffers, whatever
+/// the input.
+int64_t lz4_decompress(const char* src, size_t src_size, char* dst, size_t dst_capacity);
@@ -0,0 +1,162 @@
+#include "lz41.h"
+#include "lz4.h"
+
+#include <algorithm>
+#include <cstring>
+
+// The trailer's three fields
+static const size_t trailer_size = 3 * sizeof(uint32_t);
+
+// Largest block size accepted, to keep a corrupt trailer from asking for
+// absurd buffers
+static const uint32_t max_block_size = 64 << 20;
+
+bool lz41_reader::is_lz41(const char* data, size_t size)
+{
+	return size >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+bool lz41_reader::open(read_function read, uint64_t compressed_size)
+{
+	m_read = std::move(read);
+	m_offsets.clear();
+	m_cached = SIZE_MAX;
+
+	uint32_t trailer[3];
+	if (compressed_size < sizeof(magic) + trailer_size
+		|| !m_read(compressed_size - trailer_size, trailer_size, (char*)trailer)) {
+		return false;
+	}
+	uint32_t num_offsets = trailer[0];
+	m_size = trailer[1];
+	m_block_size = trailer[2];
+	if (num_offsets == 0 || m_block_size == 0 || m_block_size > max_block_size
+		|| (uint64_t)num_offsets * sizeof(uint32_t) > compressed_size - sizeof(magic) - trailer_size
+		|| num_offsets - 1 != (m_size + m_block_size - 1) / m_block_size) {
+		return false;
+	}
+
+	uint64_t table = compressed_size - trailer_size - (uint64_t)num_offsets * sizeof(uint32_t);
+	m_offsets.resize(num_offsets);
+	if (!m_read(table, num_offsets * sizeof(uint32_t), (char*)m_offsets.data())) {
+		m_offsets.clear();
+		return false;
+	}
+	if (m_offsets.front() < sizeof(magic) || m_offsets.back() > table
+		|| !std::is_sorted(m_offsets.begin(), m_offsets.end())) {
+		m_offsets.clear();
+		return false;
+	}
+	return true;
+}
+
+bool lz41_reader::read_block(size_t i, const char*& data, size_t& size)
+{
+	if (i >= num_blocks()) {
+		return false;
+	}
+	size_t expected = std::min<uint64_t>(m_block_size, m_size - (uint64_t)i * m_block_size);
+	if (m_cached != i) {
+		size_t compressed = m_offsets[i + 1] - m_offsets[i];
+		m_compressed.resize(compressed);
+		m_block.resize(m_block_size);
+		m_cached = SIZE_MAX;
+		if (!m_read(m_offsets[i], compressed, m_compressed.data())
+			|| lz4_decompress(m_compressed.data(), compressed, m_block.data(), expected) != (int64_t)expected) {
+			return false;
+		}
+		m_cached = i;
+	}
+	data = m_block.data();
+	size = expected;
+	return true;
+}
+
+bool lz41_reader::read(uint64_t offset, size_t size, char* buf)
+{
+	if (offset > m_size || size > m_size - offset) {
+		return false;
+	}
+	while (size > 0) {
+		const char* block;
+		size_t block_size;
+		if (!read_block(offset / m_block_size, block, block_size)) {
+			return false;
+		}
+		size_t start = offset % m_block_size;
+		size_t n = std::min(size, block_size - start);
+		memcpy(buf, block + start, n);
+		buf += n;
+		offset += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool lz41_reader::for_each_block(const std::function<bool(const char* data, size_t size)>& write)
+{
+	for (size_t i = 0; i < num_blocks(); ++i) {
+		const char* block;
+		size_t size;
+		if (!read_block(i, block, size) || !write(block, size)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Compressing has to save at least this fraction of the original size
+static const uint64_t min_saving = 16;
+
+lz41_writer::lz41_writer(uint64_t size, uint32_t block_size)
+	: m_size(size)
+	, m_block_size(block_size)
+{
+	m_offsets.reserve(num_blocks() + 1);
+	m_offsets.push_back(sizeof(lz41_reader::magic));
+}
+
+size_t lz41_writer::block_length(size_t i) const
+{
+	return std::min<uint64_t>(m_block_size, m_size - block_offset(i));
+}
+
+void lz41_writer::add_block(size_t size)
+{
+	m_offsets.push_back(m_offsets.back() + size);
+}
+
+uint64_t lz41_writer::compressed_size() const
+{
+	return m_offsets.back() + (num_blocks() + 1) * sizeof(uint32_t) + trailer_size;
+}
+
+std::vector<char> lz41_writer::trailer() const
+{
+	uint32_t fields[3] = { (uint32_t)m_offsets.size(), (uint32_t)m_size, m_block_size };
+	std::vector<char> out(m_offsets.size() * sizeof(uint32_t) + sizeof(fields));
+	memcpy(out.data(), m_offsets.data(), m_offsets.size() * sizeof(uint32_t));
+	memcpy(out.data() + m_offsets.size() * sizeof(uint32_t), fields, sizeof(fields));
+	return out;
+}
+
+void lz41_compress(const char* data, size_t size, std::vector<char>& out, uint32_t block_size)
+{
+	lz41_writer writer(size, block_size);
+	out.resize(sizeof(lz41_reader::magic) + writer.num_blocks() * lz4_compress_bound(block_size));
+	memcpy(out.data(), lz41_reader::magic, sizeof(lz41_reader::magic));
+	size_t used = sizeof(lz41_reader::magic);
+	for (size_t i = 0; i < writer.num_blocks(); ++i) {
+		size_t n = lz4_compress(data + writer.block_offset(i), writer.block_length(i), out.data() + used, out.size() - used);
+		writer.add_block(n);
+		used += n;
+	}
+	std::vector<char> trailer = writer.trailer();
+	out.resize(used);
+	out.insert(out.end(), trailer.begin(), trailer.end());
+}
+
+bool lz41_pays_off(uint64_t size, uint64_t compressed_size)
+{
+	return compressed_size <= size - size / min_saving && compressed_size < size;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * Reads LZ41 files, the LZ4-compressed format the FreeSpace Open engine
+ * accepts for package entries. Such a file is laid out as
+ *
+ *     "LZ41" block... offsets[num_offsets] num_offsets original_size block_size
+ *
+ * where the trailing fields are 32-bit little-endian integers. The original
+ * data is cut into blocks of block_size bytes (the last may be shorter), each
+ * compressed on its own as an LZ4 block (see lz4.h); offsets[i] is where
+ * block i starts, counting from the start of the file, and the last offset
+ * is where the blocks end.
+ *
+ * Since blocks stand alone, any part of the original can be had by
+ * decompressing just the blocks that cover it, one at a time.
+ */
+class lz41_reader {
+public:
+	/// Reads size bytes of the compressed file at offset into buf
+	using read_function = std::function<bool(uint64_t offset, size_t size, char* buf)>;
+
+	static constexpr char magic[4] = { 'L', 'Z', '4', '1' };
+
+	/// Whether data starting with these bytes is LZ41
+	static bool is_lz41(const char* data, size_t size);
+
+	/// Read the trailer of a compressed file of the given size. Returns false
+	/// if it doesn't describe a well-formed file.
+	bool open(read_function read, uint64_t compressed_size);
+
+	/// Size of the original data
+	uint64_t size() const { return m_size; }
+
+	uint32_t block_size() const { return m_block_size; }
+	size_t num_blocks() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+
+	/// Decompress block i. The result stays valid until the next call; asking
+	/// for the same block again doesn't decompress it again.
+	bool read_block(size_t i, const char*& data, size_t& size);
+
+	/// Copy size bytes of the original data, starting at offset, into buf
+	bool read(uint64_t offset, size_t size, char* buf);
+
+	/// Call write with each block of the original data in turn
+	bool for_each_block(const std::function<bool(const char* data, size_t size)>& write);
+
+private:
+	read_function m_read;
+	uint64_t m_size = 0;
+	uint32_t m_block_size = 0;
+	std::vector<uint32_t> m_offsets;
+
+	std::vector<char> m_compressed;
+	std::vector<char> m_block;
+	size_t m_cached = SIZE_MAX; // Which block m_block holds
+};
+
+/**
+ * Lays out an LZ41 file for size bytes of original data. The blocks can be
+ * compressed separately, on whatever threads, with lz4_compress(); they're
+ * then written in order after the magic, each one noted with add_block(),
+ * and followed by trailer().
+ */
+class lz41_writer {
+public:
+	/// Large enough for LZ4 to find most of the matches it would in one
+	/// piece, small enough that a read doesn't decompress much it won't use
+	static constexpr uint32_t default_block_size = 64 * 1024;
+
+	explicit lz41_writer(uint64_t size, uint32_t block_size = default_block_size);
+
+	size_t num_blocks() const { return (m_size + m_block_size - 1) / m_block_size; }
+
+	/// Where block i starts in the original data, and how long it is
+	uint64_t block_offset(size_t i) const { return (uint64_t)i * m_block_size; }
+	size_t block_length(size_t i) const;
+
+	/// Note that the next block compressed to size bytes
+	void add_block(size_t size);
+
+	/// Size of the whole file, once the blocks added so far and the trailer
+	/// are written
+	uint64_t compressed_size() const;
+
+	/// The offset table and fields that end the file, once every block has
+	/// been added
+	std::vector<char> trailer() const;
+
+private:
+	uint64_t m_size;
+	uint32_t m_block_size;
+	std::vector<uint32_t> m_offsets;
+};
+
+/// Compress size bytes into a complete LZ41 file in out
+void lz41_compress(const char* data, size_t size, std::vector<char>& out,
+	uint32_t block_size = lz41_writer::default_block_size);
+
+/// Whether data that compresses from size to compressed_size bytes is worth
+/// storing compressed, and decompressing on every read. Data that barely
+/// shrinks, such as audio, video or images that are compressed already, is
+/// better stored as it is.
+bool lz41_pays_off(uint64_t size, uint64_t compressed_size);
@@ -1,11 +1,22 @@
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <list>
 #include <random>
 #include <sstream>
+#include <thread>
 
+#include <csignal>
+#include <pthread.h>
+
+#include <unistd.h>
+
+#include "checksum_manifest.h"
+#include "edit_manifest.h"
 #include "operation.h"
-#include "scoped_tempdir.h"
+#include "package_server.h"
+#include "path_filter.h"
+#include "thread_pool.h"
 #include "vp_parser.h"
 
 bool dump_index(const vp_index* idx)
@@ -24,8 +35,11 @@ bool dump_file(const vp_index* idx, const std::string& filename, const std::stri
 	}
 
 	if (outfilename.empty()) {
-		// Dump to console
-		std::cout << f->dump() << std::endl;
+		// Dump to console. The contents go straight to stdout's descriptor,
+		// letting the kernel splice them into a pipe, so anything cout is
+		// still holding has to go out first.
+		std::cout.flush();
+		return f->write_to(STDOUT_FILENO);
 	} else {
 		// Dump to file (i.e. extract)
 		return f->dump(outfilename);
@@ -39,12 +53,18 @@ bool dump_file(const vp_index* idx, const std::string& filename)
 	return dump_file(idx, filename, "");
 }
 
-bool extract_all(const vp_index* idx, const std::string& outpath)
+bool extract_all(const vp_index* idx, const std::string& outpath, unsigned jobs, const path_filter& filter, vp_update_mode update)
 {
-	return idx->dump(outpath);
+	vp_extract_stats stats;
+	bool ret = idx->dump(outpath, jobs, &filter, update, &stats);
+	if (update != VP_OVERWRITE) {
+		std::cout << stats.written << " files written, " << stats.skipped << " unchanged files skipped\n";
+	}
+	return ret;
 }
 
-bool build_package(const std::string& vp_filename, const std::string& src_path)
+bool build_package(const std::string& vp_filename, const std::string& src_path, unsigned jobs = 1, bool dedup = false,
+	const std::string& base_filename = "", bool compress = false)
 {
 	// Try to find the data directory
 	std::filesystem::path p(src_path);
@@ -62,8 +82,28 @@ bool build_package(const std::string& vp_filename, const std::string& src_path)
 
 	//std::cout << "Building package from " << p << std::endl;
 
+	// Unchanged files can be copied out of an earlier build
+	vp_index base;
+	if (!base_filename.empty() && !base.parse(base_filename, VP_READ_ONLY)) {
+		std::cerr << "Could not read base package " << base_filename << std::endl;
+		return false;
+	}
+
 	vp_index idx;
-	return idx.build(p, vp_filename);
+	vp_build_stats stats;
+	if (!idx.build(p, vp_filename, jobs, dedup, &stats, base_filename.empty() ? nullptr : &base, compress)) {
+		return false;
+	}
+	if (!base_filename.empty()) {
+		std::cout << stats.reused << " of " << stats.files << " files unchanged and copied from " << base_filename << "\n";
+	}
+	if (dedup) {
+		std::cout << stats.duplicates << " of " << stats.files << " files were duplicates, saving " << stats.bytes_saved << " bytes\n";
+	}
+	if (compress) {
+		std::cout << stats.compressed << " of " << stats.files << " files compressed, saving " << stats.compression_saved << " bytes\n";
+	}
+	return true;
 }
 
 bool replace_file(vp_index* idx, const std::string& filename, const std::string& infilename)
@@ -72,6 +112,7 @@ bool replace_file(vp_index* idx, const std::string& filename, const std::string&
 	// the same size or smaller than the original, we can just overwrite the file
 	// data inside the package and update the size in the index. That potentially
 	// results in a bit of wastage in the file data segment, but no big deal.
+	// Not if other files share the data, though, as they would change too.
 	vp_file* currfile = idx->find(filename);
 	if (!currfile) {
 		std::cerr << "Could not find " << filename << " in package!\n";
@@ -80,7 +121,7 @@ bool replace_file(vp_index* idx, const std::string& filename, const std::string&
 
 	std::filesystem::directory_entry direntry(infilename);
 
-	if (currfile->get_size() >= direntry.file_size()) {
+	if (currfile->get_size() >= direntry.file_size() && !idx->shares_data(currfile)) {
 		// Update the file
 		if (!currfile->write_file_contents(direntry.path())) {
 			std::cerr << "Could not write file contents to package for " << filename << std::endl;
@@ -93,33 +134,175 @@ bool replace_file(vp_index* idx, const std::string& filename, const std::string&
 		return true;
 	}
 
-	// vp files don't tend to be massive (I'll probably regret those words at some point)
-	// so for maximum reliability, just extract the whole thing, replace the file, and
-	// then build the new file over top of the old.
-	auto tmpd = scoped_tempdir("vptool-");
-	if (!std::filesystem::is_directory(tmpd)) {
-		std::cerr << "Could not create a temporary directory\n";
+	// Otherwise the new data goes on the end of the package, along with a new
+	// index. The space the old data took up is left unused.
+	if (!idx->append_file(currfile, direntry.path())) {
+		std::cerr << "Could not append new contents to package for " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool edit_package(vp_index* idx, const std::string& manifest_filename)
+{
+	// The manifest can come from a file or, given "-", from stdin
+	std::vector<vp_edit> edits;
+	if (manifest_filename == "-") {
+		if (!read_edit_manifest(std::cin, edits)) {
+			return false;
+		}
+	} else {
+		std::ifstream manifest(manifest_filename);
+		if (!manifest) {
+			std::cerr << "Could not open manifest " << manifest_filename << std::endl;
+			return false;
+		}
+		if (!read_edit_manifest(manifest, edits)) {
+			return false;
+		}
+	}
+
+	if (!idx->apply_edits(edits)) {
+		return false;
+	}
+	std::cout << edits.size() << " edits applied\n";
+	return true;
+}
+
+bool compact_package(vp_index* idx, const std::string& outfilename)
+{
+	// Progress only makes sense on a terminal
+	std::function<void(uint64_t, uint64_t)> progress;
+	if (isatty(STDERR_FILENO)) {
+		progress = [](uint64_t done, uint64_t total) {
+			std::cerr << "\rCompacting: " << (total ? done * 100 / total : 100) << "%" << std::flush;
+		};
+	}
+
+	vp_compact_stats stats;
+	bool ok = idx->compact(outfilename, &stats, progress);
+	if (progress) {
+		std::cerr << "\n";
+	}
+	if (!ok) {
+		return false;
+	}
+	std::cout << outfilename << ": " << stats.new_size << " bytes (was " << stats.old_size << "), "
+			  << (stats.old_size > stats.new_size ? stats.old_size - stats.new_size : 0) << " bytes reclaimed\n";
+	return true;
+}
+
+bool hash_package(const vp_index* idx, const std::string& outfilename, unsigned jobs)
+{
+	std::vector<vp_checksum> sums;
+	if (!idx->checksum(sums, jobs)) {
+		return false;
+	}
+	if (outfilename.empty()) {
+		write_checksum_manifest(std::cout, sums);
+		return true;
+	}
+
+	std::ofstream out(outfilename);
+	write_checksum_manifest(out, sums);
+	out.close();
+	if (!out) {
+		std::cerr << "Could not write manifest " << outfilename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool verify_package(const vp_index* idx, const std::string& manifest_filename, unsigned jobs)
+{
+	std::vector<vp_checksum> expected;
+	if (manifest_filename == "-") {
+		if (!read_checksum_manifest(std::cin, expected)) {
+			return false;
+		}
+	} else {
+		std::ifstream manifest(manifest_filename);
+		if (!manifest) {
+			std::cerr << "Could not open manifest " << manifest_filename << std::endl;
+			return false;
+		}
+		if (!read_checksum_manifest(manifest, expected)) {
+			return false;
+		}
+	}
+
+	vp_verify_stats stats;
+	bool ok = idx->verify(expected, jobs, &stats);
+	std::cout << stats.ok << " files OK, " << stats.mismatched << " mismatched, " << stats.missing << " missing, "
+			  << stats.extra << " not in manifest\n";
+	return ok;
+}
+
+bool diff_packages(const vp_index* idx, const std::string& other_filename, unsigned jobs)
+{
+	vp_index other;
+	if (!other.parse(other_filename, VP_READ_ONLY)) {
+		std::cerr << "Error parsing " << other_filename << std::endl;
 		return false;
 	}
 
-	if (!idx->dump(tmpd)) {
-		std::cerr << "Could not dump package file to " << tmpd << std::endl;
+	std::vector<vp_diff_entry> changes;
+	if (!idx->diff(other, changes, jobs)) {
 		return false;
 	}
+	for (const vp_diff_entry& change : changes) {
+		static const char status[] = { 'A', 'D', 'M' };
+		std::cout << status[change.kind] << '\t' << change.path << '\n';
+	}
+	return true;
+}
 
-	// Replace the file with the new file
-	std::filesystem::path f = tmpd / currfile->get_path();
-	if (!std::filesystem::exists(f)) {
-		std::cerr << "Could not find " << filename << " at path " << f << std::endl;
+bool make_patch(const vp_index* idx, const std::string& new_filename, const std::string& patch_filename)
+{
+	if (patch_filename.empty()) {
+		std::cerr << "Please specify a filename for the patch with -o\n";
 		return false;
 	}
-	if (!std::filesystem::copy_file(infilename, f, std::filesystem::copy_options::overwrite_existing)) {
-		std::cerr << "Could not copy " << infilename << " over " << f << std::endl;
+	vp_index newer;
+	if (!newer.parse(new_filename, VP_READ_ONLY)) {
+		std::cerr << "Error parsing " << new_filename << std::endl;
 		return false;
 	}
 
-	// Repackage the whole dealio
-	return build_package(idx->get_filename(), tmpd);
+	vp_patch_stats stats;
+	if (!idx->make_patch(newer, patch_filename, &stats)) {
+		return false;
+	}
+	std::cout << stats.unchanged << " files unchanged, " << stats.delta << " changed, " << stats.added << " new\n"
+			  << patch_filename << ": " << stats.patch_size << " bytes (" << stats.copied_bytes << " bytes copied from "
+			  << idx->get_filename() << ", " << stats.literal_bytes << " included)\n";
+	return true;
+}
+
+bool serve_packages(const std::string& socket_path, const std::string& index_cache, bool raw)
+{
+	// Ctrl-C or a kill is the way to stop the server. Blocking the signals
+	// here, before any other thread exists, leaves them to the thread
+	// waiting for them, which shuts the server down cleanly.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	package_server server(index_cache, raw);
+	if (!server.listen(socket_path)) {
+		return false;
+	}
+	std::thread waiter([&server, &signals]() {
+		int sig;
+		sigwait(&signals, &sig);
+		server.stop();
+	});
+	std::cout << "Serving packages on " << socket_path << std::endl;
+	server.run();
+	waiter.join();
+	return true;
 }
 
 static void usage()
@@ -130,7 +313,25 @@ static void usage()
 			  << "                    f / extract-file <-f filename> <-o output-file>  Extract the contents of a single file to disk\n"
 			  << "                    x / extract-all  [-o output-path]  Extract the entire package to the output path (or current directory)\n"
 			  << "                    r / replace-file <-f filename> <-i input-file>  Replace the contents of a single file\n"
-			  << "                    p / build-package <-i input-path>  Build a new vp file with the contents of input-path\n";
+			  << "                    p / build-package <-i input-path>  Build a new vp file with the contents of input-path\n"
+			  << "                    e / edit <-i manifest>  Apply a list of replace/add/delete/rename edits in one pass\n"
+			  << "                    k / compact [-o output-file]  Remove unused space from the package (or write a compacted copy)\n"
+			  << "                    h / hash [-o manifest]  Write a CRC-32C of every file to a manifest (or stdout)\n"
+			  << "                    v / verify <-i manifest>  Check every file against a manifest written by hash\n"
+			  << "                    diff <-i other.vp>  List files added (A), removed (D) or modified (M) in other.vp\n"
+			  << "                    make-patch <-i new.vp> <-o patch>  Write a patch that turns the package into new.vp\n"
+			  << "                    apply-patch <-i patch> [-o output-file]  Apply a patch made by make-patch (in place by default)\n"
+			  << "                    serve <socket>  Answer list/stat/read requests for any package over a Unix socket\n"
+			  << "  Options:          -c / --index-cache <path>  Cache the parsed index in a sidecar file (or in a directory of them)\n"
+			  << "                    -j / --jobs <n>  Number of threads for extract-all, build-package, hash, verify and diff (0 = one per CPU)\n"
+			  << "                    -I / --include <glob>  Only extract files matching the pattern (repeatable)\n"
+			  << "                    -X / --exclude <glob>  Don't extract files matching the pattern (repeatable)\n"
+			  << "                    -u / --update  Skip extracting files whose size and modification time already match\n"
+			  << "                    -U / --update-by-content  Skip extracting files whose contents already match\n"
+			  << "                    -D / --dedup  Store files with identical contents only once when building a package\n"
+			  << "                    -B / --base <package>  Copy files that haven't changed since an earlier build from it\n"
+			  << "                    -R / --raw  Read LZ41-compressed files out as stored rather than decompressing them\n"
+			  << "                    -z / --compress  Store files LZ41-compressed when building a package, where it pays\n";
 }
 
 int main(int argc, char** argv)
@@ -157,7 +358,8 @@ int main(int argc, char** argv)
 			return -1;
 		}
 		// Build package operations don't parse an index file beforehand
-		if (!build_package(vpfile, op.get_src_filename())) {
+		unsigned jobs = op.get_jobs() ? op.get_jobs() : thread_pool::default_size();
+		if (!build_package(vpfile, op.get_src_filename(), jobs, op.get_dedup(), op.get_base_package(), op.get_compress())) {
 			std::cerr << "Error building package " << vpfile << std::endl;
 			return -2;
 		}
@@ -165,9 +367,38 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	// Parse the index file
+	if (op.get_type() == APPLY_PATCH) {
+		// The patch is checked against the package's index, but nothing else
+		// about the package needs parsing
+		std::string out = op.get_dest_path().empty() ? op.get_package_filename() : op.get_dest_path();
+		if (!vp_index::apply_patch(op.get_package_filename(), op.get_src_filename(), out)) {
+			std::cerr << "Error applying " << op.get_src_filename() << " to " << op.get_package_filename() << std::endl;
+			return -2;
+		}
+		std::cout << "Success!\n";
+		return 0;
+	}
+
+	if (op.get_type() == SERVE) {
+		// The packages are named in the requests, and parsed as they come up
+		if (op.get_package_filename().empty()) {
+			std::cerr << "Please specify a path for the socket\n";
+			usage();
+			return -1;
+		}
+		return serve_packages(op.get_package_filename(), op.get_index_cache(), op.get_raw()) ? 0 : -2;
+	}
+
+	// Parse the index file. Only replace-file and edit need to write to the
+	// package; everything else can be served from a read-only mapping.
+	vp_access_mode mode = (op.get_type() == REPLACE_FILE || op.get_type() == EDIT) ? VP_READ_WRITE : VP_READ_ONLY;
+	std::string cache_path;
+	if (!op.get_index_cache().empty()) {
+		cache_path = vp_index::get_cache_path(op.get_package_filename(), op.get_index_cache());
+	}
 	vp_index* idx = new vp_index();
-	if (!idx->parse(op.get_package_filename())) {
+	idx->set_raw(op.get_raw());
+	if (!idx->parse(op.get_package_filename(), mode, cache_path)) {
 		std::cerr << "Error parsing " << op.get_package_filename() << std::endl;
 		delete idx;
 		return -2;
@@ -184,12 +415,42 @@ int main(int argc, char** argv)
 	case EXTRACT_FILE:
 		ret = dump_file(idx, op.get_internal_filename(), op.get_dest_path());
 		break;
-	case EXTRACT_ALL:
-		ret = extract_all(idx, op.get_dest_path());
+	case EXTRACT_ALL: {
+		path_filter filter;
+		for (const std::string& pattern : op.get_includes()) {
+			filter.include(pattern);
+		}
+		for (const std::string& pattern : op.get_excludes()) {
+			filter.exclude(pattern);
+		}
+		vp_update_mode update = VP_OVERWRITE;
+		if (op.get_update()) {
+			update = op.get_update_by_content() ? VP_SKIP_IDENTICAL : VP_SKIP_UNCHANGED;
+		}
+		ret = extract_all(idx, op.get_dest_path(), op.get_jobs() ? op.get_jobs() : thread_pool::default_size(), filter, update);
 		break;
+	}
 	case REPLACE_FILE:
 		ret = replace_file(idx, op.get_internal_filename(), op.get_src_filename());
 		break;
+	case EDIT:
+		ret = edit_package(idx, op.get_src_filename());
+		break;
+	case COMPACT:
+		ret = compact_package(idx, op.get_dest_path().empty() ? idx->get_filename() : op.get_dest_path());
+		break;
+	case HASH:
+		ret = hash_package(idx, op.get_dest_path(), op.get_jobs() ? op.get_jobs() : thread_pool::default_size());
+		break;
+	case VERIFY:
+		ret = verify_package(idx, op.get_src_filename(), op.get_jobs() ? op.get_jobs() : thread_pool::default_size());
+		break;
+	case DIFF:
+		ret = diff_packages(idx, op.get_src_filename(), op.get_jobs() ? op.get_jobs() : thread_pool::default_size());
+		break;
+	case MAKE_PATCH:
+		ret = make_patch(idx, op.get_src_filename(), op.get_dest_path());
+		break;
 	default:
 		return -1;
 	}
@@ -0,0 +1,63 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+bool mapped_file::open(const std::string& path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	// mmap() refuses zero-length mappings, but an empty file is still a valid
+	// (if useless) file to have open
+	if (st.st_size > 0) {
+		void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+		m_data = static_cast<const std::byte*>(addr);
+		m_size = st.st_size;
+	}
+
+	m_fd = fd;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (m_data) {
+		munmap(const_cast<std::byte*>(m_data), m_size);
+		m_data = nullptr;
+		m_size = 0;
+	}
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+std::span<const std::byte> mapped_file::subspan(uint64_t offset, uint64_t size) const
+{
+	if (offset > m_size || size > m_size - offset) {
+		return {};
+	}
+	return { m_data + offset, static_cast<size_t>(size) };
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+/**
+ * Read-only memory mapping of an entire file.
+ */
+class mapped_file {
+public:
+	mapped_file() = default;
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	/// Map the given file into memory. Any previous mapping is released first.
+	bool open(const std::string& path);
+
+	/// Release the mapping and close the underlying file
+	void close();
+
+	/// The whole mapped file
+	std::span<const std::byte> data() const { return { m_data, m_size }; }
+
+	/// A range of the mapped file, or an empty span if the range is out of bounds
+	std::span<const std::byte> subspan(uint64_t offset, uint64_t size) const;
+
+	size_t size() const { return m_size; }
+
+	/// File descriptor of the mapped file, or -1 if nothing is mapped
+	int fd() const { return m_fd; }
+
+	operator bool() const { return m_fd >= 0; }
+
+private:
+	const std::byte* m_data = nullptr;
+	size_t m_size = 0;
+	int m_fd = -1;
+};
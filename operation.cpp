@@ -12,6 +12,14 @@ static operation_type string_to_operation_type(const std::string&& arg)
 	//  x extract-all  > EXTRACT_ALL
 	//  r replace-file > REPLACE_FILE
 	//  c p build-package > BUILD_PACKAGE
+	//  e edit         > EDIT
+	//  k compact      > COMPACT
+	//  h hash         > HASH
+	//  v verify       > VERIFY
+	//    diff         > DIFF
+	//    make-patch   > MAKE_PATCH
+	//    apply-patch  > APPLY_PATCH
+	//    serve        > SERVE
 
 	// First check for short argument
 	if (arg.length() == 1) {
@@ -29,6 +37,14 @@ static operation_type string_to_operation_type(const std::string&& arg)
 		case 'c': // Be kind to people who forget this isn't tar
 		case 'p':
 			return BUILD_PACKAGE;
+		case 'e':
+			return EDIT;
+		case 'k':
+			return COMPACT;
+		case 'h':
+			return HASH;
+		case 'v':
+			return VERIFY;
 		default:
 			return INVALID_OPERATION;
 		}
@@ -55,6 +71,22 @@ static operation_type string_to_operation_type(const std::string&& arg)
 		return REPLACE_FILE;
 	} else if (arg.length() >= 13 && arg.substr(0, 5) == "build" && arg.substr(6, 7) == "package") {
 		return BUILD_PACKAGE;
+	} else if (arg == "edit") {
+		return EDIT;
+	} else if (arg == "compact") {
+		return COMPACT;
+	} else if (arg == "hash") {
+		return HASH;
+	} else if (arg == "verify") {
+		return VERIFY;
+	} else if (arg == "diff") {
+		return DIFF;
+	} else if (arg == "make-patch" || arg == "make_patch") {
+		return MAKE_PATCH;
+	} else if (arg == "apply-patch" || arg == "apply_patch") {
+		return APPLY_PATCH;
+	} else if (arg == "serve") {
+		return SERVE;
 	}
 	return INVALID_OPERATION;
 }
@@ -64,6 +96,16 @@ static option_type read_option(const std::string& arg)
 	//  -o  --output-path  > OUT_PATH
 	//  -i  --input-file   > IN_FILE
 	//  -f  --package-file > PACKAGE_FILE
+	//  -c  --index-cache  > INDEX_CACHE
+	//  -j  --jobs         > JOBS
+	//  -I  --include      > INCLUDE
+	//  -X  --exclude      > EXCLUDE
+	//  -u  --update       > UPDATE
+	//  -U  --update-by-content > UPDATE_BY_CONTENT
+	//  -D  --dedup        > DEDUP
+	//  -B  --base         > BASE_PACKAGE
+	//  -R  --raw          > RAW
+	//  -z  --compress     > COMPRESS
 
 	if (arg.length() == 2) {
 		switch (arg[1]) {
@@ -73,6 +115,26 @@ static option_type read_option(const std::string& arg)
 			return IN_PATH;
 		case 'f':
 			return PACKAGE_FILE;
+		case 'c':
+			return INDEX_CACHE;
+		case 'j':
+			return JOBS;
+		case 'I':
+			return INCLUDE;
+		case 'X':
+			return EXCLUDE;
+		case 'u':
+			return UPDATE;
+		case 'U':
+			return UPDATE_BY_CONTENT;
+		case 'D':
+			return DEDUP;
+		case 'B':
+			return BASE_PACKAGE;
+		case 'R':
+			return RAW;
+		case 'z':
+			return COMPRESS;
 		default:
 			return INVALID_OPTION;
 		}
@@ -84,6 +146,26 @@ static option_type read_option(const std::string& arg)
 		return IN_PATH;
 	} else if (arg.length() >= 14 && arg.substr(2, 7) == "package" && arg.substr(10, 4) == "file") {
 		return PACKAGE_FILE;
+	} else if (arg.length() >= 13 && arg.substr(2, 5) == "index" && arg.substr(8, 5) == "cache") {
+		return INDEX_CACHE;
+	} else if (arg.length() >= 6 && arg.substr(2, 4) == "jobs") {
+		return JOBS;
+	} else if (arg.length() >= 9 && arg.substr(2, 7) == "include") {
+		return INCLUDE;
+	} else if (arg.length() >= 9 && arg.substr(2, 7) == "exclude") {
+		return EXCLUDE;
+	} else if (arg.length() >= 19 && arg.substr(2, 6) == "update" && arg.substr(12, 7) == "content") {
+		return UPDATE_BY_CONTENT;
+	} else if (arg.length() >= 8 && arg.substr(2, 6) == "update") {
+		return UPDATE;
+	} else if (arg.length() >= 7 && arg.substr(2, 5) == "dedup") {
+		return DEDUP;
+	} else if (arg.length() >= 6 && arg.substr(2, 4) == "base") {
+		return BASE_PACKAGE;
+	} else if (arg.length() >= 5 && arg.substr(2, 3) == "raw") {
+		return RAW;
+	} else if (arg.length() >= 10 && arg.substr(2, 8) == "compress") {
+		return COMPRESS;
 	}
 	return INVALID_OPTION;
 }
@@ -144,6 +226,56 @@ bool operation::parse(int argc, char** argv)
 				}
 				m_vp_filename = read_param(argc, argv, arg_idx);
 				break;
+			case INDEX_CACHE:
+				if (++arg_idx >= argc) {
+					std::cerr << "Error: -c requires an argument\n";
+					return false;
+				}
+				m_index_cache = read_param(argc, argv, arg_idx);
+				break;
+			case JOBS: {
+				if (++arg_idx >= argc) {
+					std::cerr << "Error: -j requires an argument\n";
+					return false;
+				}
+				std::string jobs = read_param(argc, argv, arg_idx);
+				if (jobs.empty() || jobs.size() > 4 || jobs.find_first_not_of("0123456789") != std::string::npos) {
+					std::cerr << "Error: -j expects a number of jobs, not " << jobs << "\n";
+					return false;
+				}
+				m_jobs = std::stoul(jobs);
+				break;
+			}
+			case INCLUDE:
+			case EXCLUDE:
+				if (++arg_idx >= argc) {
+					std::cerr << "Error: " << param << " requires a pattern\n";
+					return false;
+				}
+				(opt == INCLUDE ? m_includes : m_excludes).push_back(read_param(argc, argv, arg_idx));
+				break;
+			case UPDATE:
+				m_update = true;
+				break;
+			case UPDATE_BY_CONTENT:
+				m_update_by_content = true;
+				break;
+			case DEDUP:
+				m_dedup = true;
+				break;
+			case BASE_PACKAGE:
+				if (++arg_idx >= argc) {
+					std::cerr << "Error: -B requires an argument\n";
+					return false;
+				}
+				m_base_package = read_param(argc, argv, arg_idx);
+				break;
+			case RAW:
+				m_raw = true;
+				break;
+			case COMPRESS:
+				m_compress = true;
+				break;
 			case INVALID_OPTION:
 				return false;
 			}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 enum operation_type {
 	INVALID_OPERATION,
@@ -10,6 +11,14 @@ enum operation_type {
 	EXTRACT_ALL,
 	REPLACE_FILE,
 	BUILD_PACKAGE,
+	EDIT,
+	COMPACT,
+	HASH,
+	VERIFY,
+	DIFF,
+	MAKE_PATCH,
+	APPLY_PATCH,
+	SERVE,
 };
 
 enum option_type {
@@ -17,6 +26,16 @@ enum option_type {
 	OUT_PATH,
 	IN_PATH,
 	PACKAGE_FILE,
+	INDEX_CACHE,
+	JOBS,
+	INCLUDE,
+	EXCLUDE,
+	UPDATE,
+	UPDATE_BY_CONTENT,
+	DEDUP,
+	BASE_PACKAGE,
+	RAW,
+	COMPRESS,
 };
 
 class operation {
@@ -28,6 +47,24 @@ public:
 	const std::string& get_src_filename() const { return m_src_filename; }
 	const std::string& get_dest_path() const { return m_dst_path; }
 	const std::string& get_package_filename() const { return m_package_filename; }
+	const std::string& get_index_cache() const { return m_index_cache; }
+	// Number of worker threads requested; 0 means one per CPU
+	unsigned get_jobs() const { return m_jobs; }
+	// Glob patterns selecting which files extract-all writes out
+	const std::vector<std::string>& get_includes() const { return m_includes; }
+	const std::vector<std::string>& get_excludes() const { return m_excludes; }
+	// Whether extract-all should leave up-to-date output files alone, and
+	// whether that's decided by comparing contents rather than timestamps
+	bool get_update() const { return m_update || m_update_by_content; }
+	bool get_update_by_content() const { return m_update_by_content; }
+	// Whether build-package should store files with identical contents once
+	bool get_dedup() const { return m_dedup; }
+	// Earlier build of the same tree for build-package to copy unchanged files from
+	const std::string& get_base_package() const { return m_base_package; }
+	// Whether LZ41-compressed files should be read out as stored
+	bool get_raw() const { return m_raw; }
+	// Whether build-package should store files LZ41-compressed where it pays
+	bool get_compress() const { return m_compress; }
 
 private:
 	operation_type m_type;
@@ -35,4 +72,14 @@ private:
 	std::string m_src_filename;
 	std::string m_dst_path;
 	std::string m_package_filename;
+	std::string m_index_cache;
+	unsigned m_jobs = 1;
+	std::vector<std::string> m_includes;
+	std::vector<std::string> m_excludes;
+	bool m_update = false;
+	bool m_update_by_content = false;
+	bool m_dedup = false;
+	std::string m_base_package;
+	bool m_raw = false;
+	bool m_compress = false;
 };
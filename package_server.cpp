@@ -0,0 +1,253 @@
+#include "package_server.h"
+#include "file_copy.h"
+#include "path_filter.h"
+#include "vp_parser.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Longest request line accepted; anything longer closes the connection
+static const size_t max_request = 64 * 1024;
+
+package_server::package_server(const std::string& index_cache, bool raw)
+	: m_index_cache(index_cache)
+	, m_raw(raw)
+{
+}
+
+package_server::~package_server()
+{
+	stop();
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_finished.wait(guard, [this]() { return m_clients.empty(); });
+	if (m_listen_fd >= 0) {
+		::close(m_listen_fd);
+		::unlink(m_path.c_str());
+	}
+}
+
+bool package_server::listen(const std::string& path)
+{
+	sockaddr_un addr {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path " << path << " is too long\n";
+		return false;
+	}
+	memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+	// A client going away mid-reply should be an error on the write, not
+	// the end of the server
+	signal(SIGPIPE, SIG_IGN);
+
+	m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listen_fd < 0) {
+		std::cerr << "Could not create a socket: " << strerror(errno) << std::endl;
+		return false;
+	}
+	struct stat st;
+	if (::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+		::unlink(path.c_str());
+	}
+	if (::bind(m_listen_fd, (const sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(m_listen_fd, SOMAXCONN) != 0) {
+		std::cerr << "Could not listen on " << path << ": " << strerror(errno) << std::endl;
+		::close(m_listen_fd);
+		m_listen_fd = -1;
+		return false;
+	}
+	m_path = path;
+	return true;
+}
+
+void package_server::run()
+{
+	for (;;) {
+		int fd = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		std::lock_guard<std::mutex> guard(m_lock);
+		if (m_stopping) {
+			if (fd >= 0) {
+				::close(fd);
+			}
+			break;
+		}
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				std::cerr << "Could not accept a connection: " << strerror(errno) << std::endl;
+			}
+			continue;
+		}
+		m_clients.insert(fd);
+		std::thread(&package_server::serve, this, fd).detach();
+	}
+
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_finished.wait(guard, [this]() { return m_clients.empty(); });
+	::close(m_listen_fd);
+	::unlink(m_path.c_str());
+	m_listen_fd = -1;
+}
+
+void package_server::stop()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_stopping = true;
+	if (m_listen_fd >= 0) {
+		::shutdown(m_listen_fd, SHUT_RDWR);
+	}
+	// Clients get no more requests read, but can finish the current reply
+	for (int fd : m_clients) {
+		::shutdown(fd, SHUT_RD);
+	}
+}
+
+void package_server::serve(int fd)
+{
+	std::string pending;
+	char buf[4096];
+	for (bool open = true; open;) {
+		ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		pending.append(buf, n);
+
+		size_t start = 0;
+		for (size_t end; open && (end = pending.find('\n', start)) != std::string::npos; start = end + 1) {
+			open = handle(fd, pending.substr(start, end - start));
+		}
+		pending.erase(0, start);
+		if (pending.size() > max_request) {
+			break;
+		}
+	}
+
+	::close(fd);
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_clients.erase(fd);
+	m_finished.notify_all();
+}
+
+std::shared_ptr<const vp_index> package_server::open_package(const std::string& path, std::string& error)
+{
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0) {
+		error = "cannot open package " + path + ": " + strerror(errno);
+		return nullptr;
+	}
+	int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	{
+		std::lock_guard<std::mutex> guard(m_packages_lock);
+		auto it = m_packages.find(path);
+		if (it != m_packages.end() && it->second.device == st.st_dev && it->second.inode == st.st_ino
+			&& it->second.size == (uint64_t)st.st_size && it->second.mtime_ns == mtime_ns) {
+			return it->second.index;
+		}
+	}
+
+	// Parse it without holding up requests for other packages. If two
+	// requests race to do this, the second parse just replaces the first.
+	auto index = std::make_shared<vp_index>();
+	index->set_raw(m_raw);
+	std::string cache_path = m_index_cache.empty() ? "" : vp_index::get_cache_path(path, m_index_cache);
+	if (!index->parse(path, VP_READ_ONLY, cache_path)) {
+		error = "cannot parse package " + path;
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> guard(m_packages_lock);
+	m_packages[path] = { index, st.st_dev, st.st_ino, (uint64_t)st.st_size, mtime_ns };
+	return index;
+}
+
+static bool parse_number(const std::string& text, uint64_t& value)
+{
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return ec == std::errc() && end == text.data() + text.size() && !text.empty();
+}
+
+static bool reply(int fd, const std::string& line)
+{
+	return write_all(fd, line.data(), line.size());
+}
+
+bool package_server::handle(int fd, const std::string& request)
+{
+	std::vector<std::string> fields;
+	for (size_t start = 0;;) {
+		size_t end = request.find('\t', start);
+		fields.push_back(request.substr(start, end - start));
+		if (end == std::string::npos) {
+			break;
+		}
+		start = end + 1;
+	}
+	const std::string& command = fields[0];
+	if (command.empty()) {
+		return true;
+	}
+
+	bool known = (command == "list" && fields.size() == 2) || (command == "stat" && fields.size() == 3)
+		|| (command == "read" && (fields.size() == 3 || fields.size() == 5));
+	if (!known) {
+		return reply(fd, "ERR\tbad request: " + command + "\n");
+	}
+
+	std::string error;
+	std::shared_ptr<const vp_index> index = open_package(fields[1], error);
+	if (!index) {
+		return reply(fd, "ERR\t" + error + "\n");
+	}
+
+	if (command == "list") {
+		std::vector<const vp_file*> files = index->select(path_filter());
+		std::string out = "OK\t" + std::to_string(files.size()) + "\n";
+		for (const vp_file* f : files) {
+			out += f->get_package_path() + "\t" + std::to_string(f->get_contents_size()) + "\t"
+				+ std::to_string(f->get_timestamp()) + "\n";
+		}
+		return reply(fd, out);
+	}
+
+	const vp_file* f = index->find(fields[2]);
+	if (!f) {
+		bool ambiguous = !index->find_all(fields[2]).empty();
+		return reply(fd, "ERR\t" + fields[2] + (ambiguous ? " is ambiguous in " : " not found in ") + fields[1] + "\n");
+	}
+	uint64_t size = f->get_contents_size();
+
+	if (command == "stat") {
+		return reply(fd, "OK\t" + f->get_package_path() + "\t" + std::to_string(size) + "\t" + std::to_string(f->get_size())
+				+ "\t" + std::to_string(f->get_timestamp()) + "\t" + (f->is_compressed() ? "1" : "0") + "\n");
+	}
+
+	// Ranges running past the end are cut short, as with HTTP
+	uint64_t offset = 0;
+	uint64_t length = size;
+	if (fields.size() == 5) {
+		if (!parse_number(fields[3], offset) || !parse_number(fields[4], length)) {
+			return reply(fd, "ERR\tbad range: " + fields[3] + " " + fields[4] + "\n");
+		}
+		if (offset > size) {
+			return reply(fd, "ERR\toffset " + fields[3] + " is past the end of " + fields[2] + "\n");
+		}
+		length = std::min(length, size - offset);
+	}
+
+	// Once the header is out the client expects exactly length bytes, so
+	// if they can't all be sent the connection has to go
+	return reply(fd, "OK\t" + std::to_string(length) + "\n") && f->write_to(fd, offset, length);
+}
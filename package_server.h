@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+class vp_index;
+
+/**
+ * Answers requests about packages over a Unix domain socket, keeping every
+ * package it has been asked about parsed and mapped in between, so a request
+ * costs a lookup and a copy rather than starting a process and parsing an
+ * index.
+ *
+ * Requests are single lines of tab-separated fields, and any number of them
+ * can be sent over one connection:
+ *
+ *     list <package>                           every file in the package
+ *     stat <package> <file>                    one file
+ *     read <package> <file> [<offset> <size>]  a file's contents, or part of them
+ *
+ * Packages are named by their path on the server's side; files by bare name
+ * or full internal path, as with vp_index::find(). A reply starts with a line
+ * of "OK" and tab-separated values, or "ERR" and a message:
+ *
+ *     list  OK <count>, then a line of <path> <size> <timestamp> per file
+ *     stat  OK <path> <size> <stored size> <timestamp> <compressed, 0 or 1>
+ *     read  OK <size>, then exactly that many bytes
+ *
+ * Sizes are of the contents as read, so decompressed for LZ41 files.
+ *
+ * Each connection gets a thread of its own, so slow clients don't hold up the
+ * others. Stored file data is sent straight from the package by the kernel
+ * with sendfile(); compressed files are decompressed only as far as the range
+ * asked for. A package whose file has changed since it was parsed (going by
+ * its inode, size and modification time) is parsed again on its next
+ * request; connections still using the old index carry on with it.
+ */
+class package_server {
+public:
+	/// Packages are parsed with the given index cache setting (see
+	/// vp_index::get_cache_path()), and with raw set, compressed files are
+	/// served as stored
+	explicit package_server(const std::string& index_cache = "", bool raw = false);
+
+	/// Stops the server if it's still running
+	~package_server();
+
+	package_server(const package_server&) = delete;
+	package_server& operator=(const package_server&) = delete;
+
+	/// Create the socket at path, replacing any stale one left there
+	bool listen(const std::string& path);
+
+	/// Accept connections until stop() is called, then wait for the ones
+	/// still open to finish and remove the socket
+	void run();
+
+	/// Make run() return. Open connections are shut down, so their threads
+	/// finish once they've dealt with whatever request they were on.
+	void stop();
+
+private:
+	struct package {
+		std::shared_ptr<const vp_index> index;
+		uint64_t device = 0;
+		uint64_t inode = 0;
+		uint64_t size = 0;
+		int64_t mtime_ns = 0;
+	};
+
+	std::shared_ptr<const vp_index> open_package(const std::string& path, std::string& error);
+	void serve(int fd);
+	bool handle(int fd, const std::string& request);
+
+	std::string m_index_cache;
+	bool m_raw;
+	std::string m_path;
+	int m_listen_fd = -1;
+
+	std::mutex m_packages_lock;
+	std::unordered_map<std::string, package> m_packages;
+
+	std::mutex m_lock;
+	std::condition_variable m_finished;
+	std::set<int> m_clients; // Open connections, each served by a thread
+	bool m_stopping = false;
+};
@@ -0,0 +1,165 @@
+#include "path_filter.h"
+
+// Plain ASCII lowercasing; std::tolower goes through the locale, which shows
+// up when matching a million names
+static inline char lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Match c against the character class starting at pattern[p], which is a '['.
+// Returns false if the class is never closed, in which case the '[' is just
+// an ordinary character; otherwise sets end to just past the ']'.
+static bool match_class(std::string_view pattern, size_t p, char c, size_t& end, bool& matched)
+{
+	size_t i = p + 1;
+	bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+	if (negate) {
+		++i;
+	}
+
+	bool found = false;
+	size_t first = i;
+	for (; i < pattern.size() && (pattern[i] != ']' || i == first); ++i) {
+		if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+			found |= pattern[i] <= c && c <= pattern[i + 2];
+			i += 2;
+		} else {
+			found |= pattern[i] == c;
+		}
+	}
+	if (i >= pattern.size()) {
+		return false;
+	}
+
+	end = i + 1;
+	matched = found != negate;
+	return true;
+}
+
+// Match one path component against one component of a pattern. This is the
+// usual iterative wildcard match: remember where the last '*' was and, on a
+// mismatch, let it swallow one more character and carry on from there.
+static bool match_component(std::string_view pattern, std::string_view text)
+{
+	size_t p = 0;
+	size_t t = 0;
+	size_t star = std::string_view::npos;
+	size_t star_t = 0;
+	while (t < text.size()) {
+		if (p < pattern.size() && pattern[p] == '*') {
+			star = ++p;
+			star_t = t;
+			continue;
+		}
+
+		if (p < pattern.size()) {
+			char c = lower(text[t]);
+			size_t end;
+			bool matched;
+			if (pattern[p] == '[' && match_class(pattern, p, c, end, matched)) {
+				if (matched) {
+					p = end;
+					++t;
+					continue;
+				}
+			} else if (pattern[p] == '?' || pattern[p] == c) {
+				++p;
+				++t;
+				continue;
+			}
+		}
+
+		if (star == std::string_view::npos) {
+			return false;
+		}
+		p = star;
+		t = ++star_t;
+	}
+
+	while (p < pattern.size() && pattern[p] == '*') {
+		++p;
+	}
+	return p == pattern.size();
+}
+
+bool path_filter::glob_match(std::string_view pattern, std::string_view text)
+{
+	// Walk the pattern and the text one '/'-separated component at a time
+	size_t p = 0;
+	size_t t = 0;
+	for (;;) {
+		size_t p_end = pattern.find('/', p);
+		std::string_view component = pattern.substr(p, p_end == std::string_view::npos ? p_end : p_end - p);
+
+		if (component == "**") {
+			// Matches any number of directories, including none, so try the
+			// rest of the pattern at every component boundary from here on
+			if (p_end == std::string_view::npos) {
+				return true;
+			}
+			std::string_view rest = pattern.substr(p_end + 1);
+			for (;;) {
+				if (glob_match(rest, text.substr(t))) {
+					return true;
+				}
+				t = text.find('/', t);
+				if (t == std::string_view::npos) {
+					return false;
+				}
+				++t;
+			}
+		}
+
+		size_t t_end = text.find('/', t);
+		if (!match_component(component, text.substr(t, t_end == std::string_view::npos ? t_end : t_end - t))) {
+			return false;
+		}
+		if (p_end == std::string_view::npos || t_end == std::string_view::npos) {
+			return p_end == t_end;
+		}
+		p = p_end + 1;
+		t = t_end + 1;
+	}
+}
+
+path_filter::pattern path_filter::compile(const std::string& glob)
+{
+	pattern compiled;
+	compiled.glob.reserve(glob.size());
+	for (char c : glob) {
+		compiled.glob += lower(c == '\\' ? '/' : c);
+	}
+	compiled.full_path = compiled.glob.find('/') != std::string::npos;
+	return compiled;
+}
+
+void path_filter::include(const std::string& pattern)
+{
+	m_includes.push_back(compile(pattern));
+	m_needs_path |= m_includes.back().full_path;
+}
+
+void path_filter::exclude(const std::string& pattern)
+{
+	m_excludes.push_back(compile(pattern));
+	m_needs_path |= m_excludes.back().full_path;
+}
+
+bool path_filter::any_match(const std::vector<pattern>& patterns, std::string_view path, std::string_view name)
+{
+	for (const pattern& p : patterns) {
+		if (glob_match(p.glob, p.full_path ? path : name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool path_filter::matches(std::string_view path, std::string_view name) const
+{
+	if (!m_includes.empty() && !any_match(m_includes, path, name)) {
+		return false;
+	}
+	return !any_match(m_excludes, path, name);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Include/exclude glob patterns for picking files out of a package index.
+ *
+ * A pattern containing a '/' is matched against the file's full internal path
+ * ("data/tables/ai.tbl"); any other pattern is matched against the bare file
+ * name. Matching is case-insensitive, like the engine's file lookups.
+ *
+ * Supported syntax: '*' matches any run of characters within a path
+ * component, '?' matches any one character other than '/', '[...]' matches a
+ * character class ("[abc]", "[a-z]", "[!0-9]"), and a component that is just
+ * '**' matches any number of directories, including none.
+ */
+class path_filter {
+public:
+	void include(const std::string& pattern);
+	void exclude(const std::string& pattern);
+
+	/// True if the filter has no patterns and so selects everything
+	bool empty() const { return m_includes.empty() && m_excludes.empty(); }
+
+	/// Whether any pattern needs the full path rather than just the name
+	bool needs_path() const { return m_needs_path; }
+
+	/// Whether the file with the given full path and bare name is selected:
+	/// it must match an include pattern (if there are any) and no exclude
+	/// pattern. path may be left empty when needs_path() is false.
+	bool matches(std::string_view path, std::string_view name) const;
+
+	/// Match text against a single glob pattern, which must already be lowercase
+	static bool glob_match(std::string_view pattern, std::string_view text);
+
+private:
+	struct pattern {
+		std::string glob; // Lowercased
+		bool full_path;
+	};
+
+	static pattern compile(const std::string& glob);
+	static bool any_match(const std::vector<pattern>& patterns, std::string_view path, std::string_view name);
+
+	std::vector<pattern> m_includes;
+	std::vector<pattern> m_excludes;
+	bool m_needs_path = false;
+};
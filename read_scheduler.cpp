@@ -0,0 +1,112 @@
+#include "read_scheduler.h"
+#include "file_copy.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static int open_output(const std::filesystem::path& dest)
+{
+	int fd = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		std::cerr << "Could not open " << dest << " for writing\n";
+	}
+	return fd;
+}
+
+static bool close_output(int fd, const read_scheduler::request& r, bool ok)
+{
+	if (ok && r.mtime != 0 && !set_mtime(fd, r.mtime)) {
+		std::cerr << "Warning: could not set the modification time of " << r.dest << std::endl;
+	}
+	if (::close(fd) != 0 || !ok) {
+		std::cerr << "Could not write " << r.dest << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void read_scheduler::add(uint64_t offset, uint64_t size, std::filesystem::path dest, int64_t mtime)
+{
+	m_requests.push_back({ offset, size, std::move(dest), mtime });
+}
+
+void read_scheduler::plan()
+{
+	std::stable_sort(m_requests.begin(), m_requests.end(), [](const request& a, const request& b) {
+		return a.offset < b.offset;
+	});
+
+	m_batches.clear();
+	bool mergeable = false; // Whether the last batch can take more requests
+	for (size_t i = 0; i < m_requests.size(); ++i) {
+		const request& r = m_requests[i];
+		bool small = r.size <= small_size;
+
+		if (mergeable && small) {
+			batch& b = m_batches.back();
+			uint64_t end = b.offset + b.size;
+			// Ranges may overlap (packages are allowed to share data between
+			// entries), so a request can also start before the batch ends
+			uint64_t new_end = std::max(end, r.offset + r.size);
+			if (r.offset <= end + max_gap && new_end - b.offset <= max_batch) {
+				b.size = new_end - b.offset;
+				++b.count;
+				continue;
+			}
+		}
+
+		m_batches.push_back({ r.offset, r.size, i, 1 });
+		mergeable = small;
+	}
+}
+
+bool read_scheduler::run(size_t batch_index, int in_fd) const
+{
+	const batch& b = m_batches[batch_index];
+
+	if (b.count == 1) {
+		// Nothing to merge; let the kernel do the copy
+		const request& r = m_requests[b.first];
+		int out = open_output(r.dest);
+		if (out < 0) {
+			return false;
+		}
+		bool copied = copy_range(in_fd, r.offset, r.size, out);
+		if (!copied) {
+			std::cerr << "Could not read " << r.size << " bytes from package for " << r.dest << std::endl;
+		}
+		return close_output(out, r, copied);
+	}
+
+	static thread_local std::vector<char> buf;
+	buf.resize(std::max<size_t>(buf.size(), b.size));
+	if (!pread_all(in_fd, buf.data(), b.size, b.offset)) {
+		std::cerr << "Could not read " << b.size << " bytes from package at offset " << b.offset << std::endl;
+		return false;
+	}
+
+	bool retval = true;
+	for (size_t i = b.first; i < b.first + b.count; ++i) {
+		const request& r = m_requests[i];
+		int out = open_output(r.dest);
+		if (out < 0) {
+			retval = false;
+			continue;
+		}
+		bool written = write_all(out, buf.data() + (r.offset - b.offset), r.size);
+		retval &= close_output(out, r, written);
+	}
+	return retval;
+}
+
+bool read_scheduler::run(int in_fd) const
+{
+	bool retval = true;
+	for (size_t i = 0; i < m_batches.size(); ++i) {
+		retval &= run(i, in_fd);
+	}
+	return retval;
+}
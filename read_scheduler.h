@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+/**
+ * Plans the reads for copying many byte ranges out of one package file.
+ *
+ * Requests are sorted by offset so the package is read front to back, however
+ * its index happens to be ordered. Runs of neighbouring small ranges are then
+ * merged into batches that are fetched with a single read and scattered to
+ * their output files from memory; big ranges get a batch of their own and are
+ * copied inside the kernel.
+ */
+class read_scheduler {
+public:
+	/// Ranges up to this size are worth merging with their neighbours
+	static constexpr uint64_t small_size = 256 * 1024;
+	/// Unrequested bytes between two ranges that are read through rather than
+	/// skipped, since a short skip costs a disk about as much as reading it
+	static constexpr uint64_t max_gap = 64 * 1024;
+	/// Upper bound on the bytes fetched by one merged read
+	static constexpr uint64_t max_batch = 8 * 1024 * 1024;
+
+	struct request {
+		uint64_t offset;
+		uint64_t size;
+		std::filesystem::path dest;
+		int64_t mtime; // Stamped on dest once written, unless 0
+	};
+
+	/// A span of the package covering requests [first, first + count)
+	struct batch {
+		uint64_t offset;
+		uint64_t size;
+		size_t first;
+		size_t count;
+	};
+
+	/// Ask for size bytes at offset to be written to dest, optionally giving
+	/// the finished file the modification time mtime
+	void add(uint64_t offset, uint64_t size, std::filesystem::path dest, int64_t mtime = 0);
+
+	/// Sort the requests and group them into batches. Call once, after the
+	/// last add().
+	void plan();
+
+	const std::vector<request>& requests() const { return m_requests; }
+	const std::vector<batch>& batches() const { return m_batches; }
+
+	/// Read one batch from in_fd and write out its files. Only positional
+	/// reads are done on in_fd, so batches can be run from several threads.
+	bool run(size_t batch_index, int in_fd) const;
+
+	/// Run every batch in order
+	bool run(int in_fd) const;
+
+private:
+	std::vector<request> m_requests;
+	std::vector<batch> m_batches;
+};
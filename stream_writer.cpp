@@ -0,0 +1,141 @@
+#include "stream_writer.h"
+#include "buffer_pool.h"
+#include "file_copy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+stream_writer::stream_writer(buffer_pool& pool)
+	: m_pool(pool)
+{
+}
+
+stream_writer::~stream_writer()
+{
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+	if (m_buffer) {
+		m_pool.release(m_buffer);
+	}
+}
+
+bool stream_writer::open(const std::string& path)
+{
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		return false;
+	}
+	if (!m_buffer) {
+		m_buffer = m_pool.acquire();
+	}
+	m_used = 0;
+	m_position = 0;
+	return true;
+}
+
+bool stream_writer::flush()
+{
+	if (m_used == 0) {
+		return true;
+	}
+	bool ok = write_all(m_fd, m_buffer, m_used);
+	m_used = 0;
+	return ok;
+}
+
+bool stream_writer::write(const void* data, size_t size)
+{
+	const char* p = (const char*)data;
+	while (size > 0) {
+		if (m_used == m_pool.buffer_size() && !flush()) {
+			return false;
+		}
+		size_t n = std::min(size, m_pool.buffer_size() - m_used);
+		memcpy(m_buffer + m_used, p, n);
+		m_used += n;
+		m_position += n;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool stream_writer::write_fd(int in, uint64_t size)
+{
+	if (size >= large_file) {
+		// Everything before it has to be on disk first, since the kernel
+		// writes at the descriptor's position
+		if (!flush() || !copy_range(in, 0, size, m_fd)) {
+			return false;
+		}
+		m_position += size;
+		return true;
+	}
+
+	// Read straight into the buffer, flushing whenever it fills up
+	uint64_t remaining = size;
+	while (remaining > 0) {
+		if (m_used == m_pool.buffer_size()) {
+			if (!flush()) {
+				return false;
+			}
+			continue;
+		}
+		ssize_t n = ::read(in, m_buffer + m_used, std::min<uint64_t>(remaining, m_pool.buffer_size() - m_used));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		m_used += n;
+		m_position += n;
+		remaining -= n;
+	}
+	return true;
+}
+
+bool stream_writer::write_range(int in, uint64_t offset, uint64_t size)
+{
+	if (!flush() || !copy_range(in, offset, size, m_fd)) {
+		return false;
+	}
+	m_position += size;
+	return true;
+}
+
+bool stream_writer::write_at(uint64_t offset, const void* data, size_t size)
+{
+	return flush() && pwrite_all(m_fd, data, size, offset);
+}
+
+bool stream_writer::truncate(uint64_t position)
+{
+	if (!flush() || ::ftruncate(m_fd, position) != 0 || ::lseek(m_fd, position, SEEK_SET) != (off_t)position) {
+		return false;
+	}
+	m_position = position;
+	return true;
+}
+
+bool stream_writer::close(bool sync)
+{
+	bool ok = flush();
+	if (ok && sync && ::fdatasync(m_fd) != 0) {
+		ok = false;
+	}
+	if (::close(m_fd) != 0) {
+		ok = false;
+	}
+	m_fd = -1;
+	if (m_buffer) {
+		m_pool.release(m_buffer);
+		m_buffer = nullptr;
+	}
+	return ok;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class buffer_pool;
+
+/**
+ * Writes a file front to back out of many pieces, such as a package being
+ * built from a directory tree.
+ *
+ * Small pieces are gathered in a single buffer borrowed from a buffer_pool
+ * and written out a buffer at a time. Whole input files of large_file bytes
+ * or more go straight from their own descriptor into the output through
+ * copy_range(), so their contents never pass through userspace at all.
+ */
+class stream_writer {
+public:
+	/// Files at least this big are copied by the kernel rather than buffered
+	static constexpr uint64_t large_file = 256 * 1024;
+
+	explicit stream_writer(buffer_pool& pool);
+
+	/// Closes the output if close() wasn't called; anything still buffered
+	/// is lost
+	~stream_writer();
+
+	stream_writer(const stream_writer&) = delete;
+	stream_writer& operator=(const stream_writer&) = delete;
+
+	/// Create (or truncate) the output file
+	bool open(const std::string& path);
+
+	/// Append some bytes
+	bool write(const void* data, size_t size);
+
+	/// Append the whole of a file that's already open and positioned at its
+	/// start, which is expected to be exactly size bytes long. Fails if it
+	/// turns out to be shorter.
+	bool write_fd(int fd, uint64_t size);
+
+	/// Append size bytes from offset in another open file, such as an older
+	/// package. This goes through copy_range(), so on filesystems with
+	/// reflinks the data may end up shared rather than copied.
+	bool write_range(int fd, uint64_t offset, uint64_t size);
+
+	/// Overwrite bytes that have already been written, e.g. to fill in a
+	/// header once the rest of the file is known
+	bool write_at(uint64_t offset, const void* data, size_t size);
+
+	/// Throw away everything from position on, so that what's written next
+	/// goes there instead
+	bool truncate(uint64_t position);
+
+	/// Flush everything and close the output. With sync set the data is on
+	/// disk, not just in the page cache, before this returns, as it needs to
+	/// be before the file is renamed over anything that matters.
+	bool close(bool sync = false);
+
+	/// Where the next byte will go
+	uint64_t position() const { return m_position; }
+
+private:
+	bool flush();
+
+	buffer_pool& m_pool;
+	char* m_buffer = nullptr;
+	size_t m_used = 0;
+	int m_fd = -1;
+	uint64_t m_position = 0;
+};
@@ -0,0 +1,37 @@
+#include "../checksum_manifest.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Test that a written manifest reads back the same, paths with spaces and all
+TEST(ChecksumManifestTest, RoundTrips)
+{
+	std::vector<vp_checksum> sums = {
+		{ "data/tables/ai.tbl", 1234, 0xe3069283 },
+		{ "data/missions/my mission.fs2", 5, 0x0000beef },
+	};
+	std::ostringstream out;
+	write_checksum_manifest(out, sums);
+	EXPECT_EQ(out.str(), "e3069283 1234 data/tables/ai.tbl\n0000beef 5 data/missions/my mission.fs2\n");
+
+	std::istringstream in("# Release 1.2\n\n" + out.str());
+	std::vector<vp_checksum> read;
+	ASSERT_TRUE(read_checksum_manifest(in, read));
+	ASSERT_EQ(read.size(), 2u);
+	for (size_t i = 0; i < read.size(); ++i) {
+		EXPECT_EQ(read[i].path, sums[i].path);
+		EXPECT_EQ(read[i].size, sums[i].size);
+		EXPECT_EQ(read[i].crc, sums[i].crc);
+	}
+}
+
+// Test that malformed lines are rejected
+TEST(ChecksumManifestTest, RejectsBadLines)
+{
+	for (const char* bad : { "e3069283 1234\n", "zzz 1234 data/a.tbl\n", "e3069283 data/a.tbl\n" }) {
+		std::istringstream in(bad);
+		std::vector<vp_checksum> sums;
+		EXPECT_FALSE(read_checksum_manifest(in, sums)) << bad;
+	}
+}
@@ -0,0 +1,31 @@
+#include "../crc32c.h"
+#include <gtest/gtest.h>
+#include <string>
+
+// Test against the standard check value and a few other known checksums
+TEST(Crc32cTest, KnownValues)
+{
+	EXPECT_EQ(crc32c(0, "123456789", 9), 0xE3069283u);
+	EXPECT_EQ(crc32c(0, "", 0), 0u);
+	std::string zeros(32, '\0');
+	EXPECT_EQ(crc32c(0, zeros.data(), zeros.size()), 0x8A9136AAu);
+	std::string ones(32, '\xff');
+	EXPECT_EQ(crc32c(0, ones.data(), ones.size()), 0x62A8AB43u);
+}
+
+// Test that checksums can be built up piece by piece, or combined afterwards
+TEST(Crc32cTest, IncrementalAndCombined)
+{
+	std::string data(5000, '\0');
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (char)(i * 7 + i / 13);
+	}
+	uint32_t whole = crc32c(0, data.data(), data.size());
+
+	for (size_t split : { 0, 1, 7, 8, 9, 1000, 4999, 5000 }) {
+		uint32_t first = crc32c(0, data.data(), split);
+		uint32_t second = crc32c(0, data.data() + split, data.size() - split);
+		EXPECT_EQ(crc32c(first, data.data() + split, data.size() - split), whole) << split;
+		EXPECT_EQ(crc32c_combine(first, second, data.size() - split), whole) << split;
+	}
+}
@@ -0,0 +1,69 @@
+#include "../delta.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Rebuild the new data from the old data and a delta
+static std::string apply(const std::string& old_data, const std::string& new_data, const std::vector<delta_op>& ops)
+{
+	std::string out;
+	for (const delta_op& op : ops) {
+		out += (op.copy ? old_data : new_data).substr(op.offset, op.size);
+	}
+	return out;
+}
+
+static std::string random_data(size_t size, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::string data(size, '\0');
+	for (char& c : data) {
+		c = (char)rng();
+	}
+	return data;
+}
+
+// Test that a small change in the middle of a big file costs about a block
+TEST(DeltaTest, SmallChange)
+{
+	std::string old_data = random_data(1 << 20, 1);
+	std::string new_data = old_data;
+	new_data[500000] ^= 1;
+	new_data.insert(700000, "inserted");
+
+	std::vector<delta_op> ops;
+	make_delta(old_data.data(), old_data.size(), new_data.data(), new_data.size(), [&ops](const delta_op& op) {
+		ops.push_back(op);
+	});
+	EXPECT_EQ(apply(old_data, new_data, ops), new_data);
+
+	uint64_t literal = 0;
+	for (const delta_op& op : ops) {
+		if (!op.copy) {
+			literal += op.size;
+		}
+	}
+	EXPECT_GT(literal, 0u);
+	EXPECT_LE(literal, 2 * delta_block_size(old_data.size()));
+}
+
+// Test unrelated, empty and tiny inputs, and data moved around
+TEST(DeltaTest, EdgeCases)
+{
+	std::string big = random_data(100000, 2);
+	std::string other = random_data(100000, 3);
+	std::string moved = big.substr(50000) + big.substr(0, 50000);
+	for (const auto& [old_data, new_data] : std::vector<std::pair<std::string, std::string>> {
+			 { big, other }, { big, moved }, { big, "" }, { "", big }, { "tiny", "tinier" }, { big, big } }) {
+		std::vector<delta_op> ops;
+		make_delta(old_data.data(), old_data.size(), new_data.data(), new_data.size(), [&ops](const delta_op& op) {
+			ops.push_back(op);
+		});
+		EXPECT_EQ(apply(old_data, new_data, ops), new_data);
+		if (new_data == big && old_data == big) {
+			ASSERT_EQ(ops.size(), 1u);
+			EXPECT_TRUE(ops[0].copy);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#include "../edit_manifest.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Test reading every kind of edit, with comments, blank lines and quoting
+TEST(EditManifestTest, ReadsEdits)
+{
+	std::istringstream in("# Patch for 1.2\n"
+						  "replace data/tables/ships.tbl build/ships.tbl\n"
+						  "\n"
+						  "  add\tdata/missions/new.fs2   \"My Missions/new \\\"final\\\".fs2\"\n"
+						  "delete data/maps/old.pcx\n"
+						  "rename data/effects/a.dds data/effects/b.dds\n");
+	std::vector<vp_edit> edits;
+	ASSERT_TRUE(read_edit_manifest(in, edits));
+	ASSERT_EQ(edits.size(), 4u);
+
+	EXPECT_EQ(edits[0].kind, vp_edit::REPLACE);
+	EXPECT_EQ(edits[0].path, "data/tables/ships.tbl");
+	EXPECT_EQ(edits[0].arg, "build/ships.tbl");
+	EXPECT_EQ(edits[1].kind, vp_edit::ADD);
+	EXPECT_EQ(edits[1].path, "data/missions/new.fs2");
+	EXPECT_EQ(edits[1].arg, "My Missions/new \"final\".fs2");
+	EXPECT_EQ(edits[2].kind, vp_edit::DELETE);
+	EXPECT_EQ(edits[2].path, "data/maps/old.pcx");
+	EXPECT_EQ(edits[2].arg, "");
+	EXPECT_EQ(edits[3].kind, vp_edit::RENAME);
+	EXPECT_EQ(edits[3].arg, "data/effects/b.dds");
+}
+
+// Test that malformed lines are rejected
+TEST(EditManifestTest, RejectsBadLines)
+{
+	for (const char* bad : { "frobnicate data/a.tbl\n", "delete data/a.tbl extra\n", "replace data/a.tbl\n",
+			 "add data/a.tbl \"unterminated\n", "rename\n" }) {
+		std::istringstream in(bad);
+		std::vector<vp_edit> edits;
+		EXPECT_FALSE(read_edit_manifest(in, edits)) << bad;
+	}
+}
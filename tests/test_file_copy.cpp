@@ -0,0 +1,133 @@
+#include "../file_copy.h"
+#include "../scoped_tempdir.h"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+class FileCopyTest : public ::testing::Test {
+protected:
+	scoped_tempdir tmpd { "test-" };
+	std::filesystem::path src_path;
+
+	void SetUp() override
+	{
+		ASSERT_TRUE(tmpd);
+		src_path = tmpd / "src.bin";
+		std::ofstream out(src_path, std::ios::binary);
+		for (int i = 0; i < 100000; ++i) {
+			out << (char)('a' + i % 26);
+		}
+	}
+
+	std::string ReadFile(const std::filesystem::path& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	}
+};
+
+// Test copying a range between two files
+TEST_F(FileCopyTest, CopiesRangeBetweenFiles)
+{
+	int in = open(src_path.c_str(), O_RDONLY);
+	ASSERT_GE(in, 0);
+	std::filesystem::path dst_path = tmpd / "dst.bin";
+	int out = open(dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ASSERT_GE(out, 0);
+
+	// Two ranges back to back, appended at the output's position
+	ASSERT_TRUE(copy_range(in, 26 * 100, 50000, out));
+	ASSERT_TRUE(copy_range(in, 3, 5, out));
+	close(out);
+
+	// The source's own position is left alone
+	EXPECT_EQ(lseek(in, 0, SEEK_CUR), 0);
+	close(in);
+
+	std::string expected = ReadFile(src_path).substr(0, 50000) + "defgh";
+	EXPECT_EQ(ReadFile(dst_path), expected);
+}
+
+// Test positional reads, which fail rather than come up short at the end
+TEST_F(FileCopyTest, PreadAll)
+{
+	int in = open(src_path.c_str(), O_RDONLY);
+	ASSERT_GE(in, 0);
+	char buf[8];
+	ASSERT_TRUE(pread_all(in, buf, 5, 26 * 10 + 2));
+	EXPECT_EQ(std::string(buf, 5), "cdefg");
+	EXPECT_FALSE(pread_all(in, buf, 8, 100000 - 4));
+	EXPECT_EQ(lseek(in, 0, SEEK_CUR), 0);
+	close(in);
+}
+
+// Test copying into a pipe, which copy_file_range() can't do
+TEST_F(FileCopyTest, CopiesIntoPipe)
+{
+	int in = open(src_path.c_str(), O_RDONLY);
+	ASSERT_GE(in, 0);
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+
+	ASSERT_TRUE(copy_range(in, 1, 26, fds[1]));
+	close(fds[1]);
+	close(in);
+
+	char buf[64];
+	ssize_t n = read(fds[0], buf, sizeof(buf));
+	close(fds[0]);
+	ASSERT_EQ(n, 26);
+	EXPECT_EQ(std::string(buf, n), "bcdefghijklmnopqrstuvwxyza");
+}
+
+// Test running off the end of the source is an error
+TEST_F(FileCopyTest, FailsPastEndOfSource)
+{
+	int in = open(src_path.c_str(), O_RDONLY);
+	ASSERT_GE(in, 0);
+	std::filesystem::path dst_path = tmpd / "dst.bin";
+	int out = open(dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ASSERT_GE(out, 0);
+
+	EXPECT_FALSE(copy_range(in, 99990, 20, out));
+	close(out);
+	close(in);
+}
+
+// Test comparing a range of one file against the start of another
+TEST_F(FileCopyTest, ComparesRanges)
+{
+	std::filesystem::path other_path = tmpd / "other.bin";
+	{
+		std::ofstream out(other_path, std::ios::binary);
+		out << "cdefg";
+	}
+	int in = open(src_path.c_str(), O_RDONLY);
+	ASSERT_GE(in, 0);
+	int other = open(other_path.c_str(), O_RDONLY);
+	ASSERT_GE(other, 0);
+
+	EXPECT_TRUE(ranges_equal(in, 26 * 10 + 2, 5, other));
+	EXPECT_TRUE(ranges_equal(in, 2, 3, other));
+	EXPECT_FALSE(ranges_equal(in, 3, 5, other));
+	EXPECT_FALSE(ranges_equal(in, 2, 6, other)); // other is too short
+	close(other);
+	close(in);
+}
+
+// Test moving a file over another, and a failed move leaving things alone
+TEST_F(FileCopyTest, RenamesDurably)
+{
+	std::filesystem::path dst_path = tmpd / "dst.bin";
+	std::ofstream(dst_path, std::ios::binary) << "old";
+	EXPECT_TRUE(rename_durably(src_path.string(), dst_path.string()));
+	EXPECT_FALSE(std::filesystem::exists(src_path));
+	EXPECT_EQ(std::filesystem::file_size(dst_path), 100000u);
+
+	EXPECT_FALSE(rename_durably(src_path.string(), dst_path.string()));
+	EXPECT_EQ(std::filesystem::file_size(dst_path), 100000u);
+}
@@ -0,0 +1,198 @@
+#include "../lz4.h"
+#include "../lz41.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::string decompress(const std::string& block, size_t capacity)
+{
+	std::string out(capacity, '\0');
+	int64_t n = lz4_decompress(block.data(), block.size(), out.data(), out.size());
+	return n < 0 ? "<error>" : out.substr(0, n);
+}
+
+// An LZ4 block holding data as literals only
+static std::string literal_block(const std::string& data)
+{
+	std::string block;
+	if (data.size() < 15) {
+		block += (char)(data.size() << 4);
+	} else {
+		block += (char)0xf0;
+		size_t rest = data.size() - 15;
+		for (; rest >= 255; rest -= 255) {
+			block += (char)255;
+		}
+		block += (char)rest;
+	}
+	return block + data;
+}
+
+// Test decoding literals, overlapping matches and long lengths
+TEST(Lz4Test, Decompresses)
+{
+	EXPECT_EQ(decompress(std::string("\x50hello", 6), 64), "hello");
+	// "abc", then a 12-byte match three back, then "!"
+	EXPECT_EQ(decompress(std::string("\x38" "abc" "\x03\x00" "\x10!", 8), 64), "abcabcabcabcabc!");
+	std::string long_data(300, 'x');
+	for (size_t i = 0; i < long_data.size(); ++i) {
+		long_data[i] = (char)('a' + i % 26);
+	}
+	EXPECT_EQ(decompress(literal_block(long_data), 300), long_data);
+	// A run of one byte: one literal, then a long match with extra length bytes
+	EXPECT_EQ(decompress(std::string("\x1f" "z" "\x01\x00" "\xff\x06" "\x00", 7), 400), std::string(1 + 15 + 255 + 6 + 4, 'z'));
+}
+
+// Test that malformed blocks are rejected rather than read or written past
+TEST(Lz4Test, RejectsMalformed)
+{
+	EXPECT_EQ(decompress(std::string("\x50hello", 6), 4), "<error>"); // Doesn't fit
+	EXPECT_EQ(decompress(std::string("\x50hel", 4), 64), "<error>"); // Literals cut short
+	EXPECT_EQ(decompress(std::string("\x10" "a" "\x00\x00", 4), 64), "<error>"); // Offset 0
+	EXPECT_EQ(decompress(std::string("\x10" "a" "\x02\x00", 4), 64), "<error>"); // Before the start
+	EXPECT_EQ(decompress(std::string("\x10" "a" "\x01", 3), 64), "<error>"); // Offset cut short
+	EXPECT_EQ(decompress(std::string("\xf0", 1), 64), "<error>"); // Length cut short
+}
+
+// Build an LZ41 file out of literal-only blocks
+static std::string make_lz41(const std::string& data, uint32_t block_size)
+{
+	std::string file = "LZ41";
+	std::vector<uint32_t> offsets;
+	for (size_t i = 0; i < data.size(); i += block_size) {
+		offsets.push_back(file.size());
+		file += literal_block(data.substr(i, block_size));
+	}
+	offsets.push_back(file.size());
+	file.append((const char*)offsets.data(), offsets.size() * sizeof(uint32_t));
+	uint32_t trailer[3] = { (uint32_t)offsets.size(), (uint32_t)data.size(), block_size };
+	file.append((const char*)trailer, sizeof(trailer));
+	return file;
+}
+
+// Test random access and streaming through an LZ41 file
+TEST(Lz4Test, Lz41Reader)
+{
+	std::string data(1000, '\0');
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (char)(i * 7);
+	}
+	std::string file = make_lz41(data, 256);
+	ASSERT_TRUE(lz41_reader::is_lz41(file.data(), file.size()));
+	EXPECT_FALSE(lz41_reader::is_lz41("LZ4", 3));
+
+	size_t reads = 0;
+	auto read = [&file, &reads](uint64_t offset, size_t size, char* buf) {
+		++reads;
+		if (offset + size > file.size()) {
+			return false;
+		}
+		memcpy(buf, file.data() + offset, size);
+		return true;
+	};
+	lz41_reader reader;
+	ASSERT_TRUE(reader.open(read, file.size()));
+	EXPECT_EQ(reader.size(), 1000u);
+	EXPECT_EQ(reader.num_blocks(), 4u);
+
+	// A range across a block boundary only touches those two blocks
+	char buf[100];
+	reads = 0;
+	ASSERT_TRUE(reader.read(200, 100, buf));
+	EXPECT_EQ(std::string(buf, 100), data.substr(200, 100));
+	EXPECT_EQ(reads, 2u);
+	EXPECT_FALSE(reader.read(950, 100, buf));
+
+	std::string all;
+	ASSERT_TRUE(reader.for_each_block([&all](const char* block, size_t size) {
+		all.append(block, size);
+		return true;
+	}));
+	EXPECT_EQ(all, data);
+
+	// A trailer that doesn't add up is refused
+	file[file.size() - 7] ^= 4; // Original size 2024, which needs 8 blocks
+	EXPECT_FALSE(reader.open(read, file.size()));
+	EXPECT_FALSE(reader.open(read, 10));
+}
+
+// Compress and decompress again, checking the result fits the stated bound
+static std::string round_trip(const std::string& data)
+{
+	std::string block(lz4_compress_bound(data.size()), '\0');
+	int64_t n = lz4_compress(data.data(), data.size(), block.data(), block.size());
+	if (n < 0) {
+		return "<error>";
+	}
+	block.resize(n);
+	return decompress(block, data.size());
+}
+
+// Test compressing text, runs, noise and the awkward sizes around the minimum
+// match and the end-of-block rules
+TEST(Lz4Test, CompressRoundTrips)
+{
+	std::string text;
+	for (int i = 0; i < 5000; ++i) {
+		text += "$Name: ship " + std::to_string(i % 97) + "\n";
+	}
+	std::string noise(100000, '\0');
+	uint32_t x = 12345;
+	for (char& c : noise) {
+		x = x * 1103515245 + 12345;
+		c = (char)(x >> 24);
+	}
+
+	for (const std::string& data : { text, noise, std::string(70000, 'z') }) {
+		EXPECT_EQ(round_trip(data), data);
+	}
+	for (size_t size = 0; size < 40; ++size) {
+		EXPECT_EQ(round_trip(std::string(size, 'a')), std::string(size, 'a'));
+		EXPECT_EQ(round_trip(noise.substr(0, size)), noise.substr(0, size));
+	}
+
+	// Repetitive data shrinks a lot; a buffer too small for the output is refused
+	std::string block(lz4_compress_bound(text.size()), '\0');
+	int64_t n = lz4_compress(text.data(), text.size(), block.data(), block.size());
+	EXPECT_LT(n, (int64_t)text.size() / 4);
+	EXPECT_EQ(lz4_compress(noise.data(), noise.size(), block.data(), 1000), -1);
+}
+
+// Test writing whole LZ41 files, and the rule for when compressing pays
+TEST(Lz4Test, Lz41Writer)
+{
+	std::string data;
+	for (int i = 0; i < 20000; ++i) {
+		data += "line " + std::to_string(i % 300) + "\n";
+	}
+	std::vector<char> file;
+	lz41_compress(data.data(), data.size(), file, 4096);
+	ASSERT_TRUE(lz41_reader::is_lz41(file.data(), file.size()));
+
+	lz41_writer writer(data.size(), 4096);
+	EXPECT_EQ(writer.num_blocks(), (data.size() + 4095) / 4096);
+	EXPECT_EQ(writer.block_length(writer.num_blocks() - 1), data.size() % 4096);
+
+	lz41_reader reader;
+	ASSERT_TRUE(reader.open([&file](uint64_t offset, size_t size, char* buf) {
+		if (offset + size > file.size()) {
+			return false;
+		}
+		memcpy(buf, file.data() + offset, size);
+		return true;
+	}, file.size()));
+	EXPECT_EQ(reader.size(), data.size());
+	EXPECT_EQ(reader.block_size(), 4096u);
+	std::string all;
+	ASSERT_TRUE(reader.for_each_block([&all](const char* block, size_t size) {
+		all.append(block, size);
+		return true;
+	}));
+	EXPECT_EQ(all, data);
+
+	EXPECT_TRUE(lz41_pays_off(data.size(), file.size()));
+	EXPECT_FALSE(lz41_pays_off(1000, 990));
+	EXPECT_FALSE(lz41_pays_off(10, 30));
+	EXPECT_FALSE(lz41_pays_off(0, 0));
+}
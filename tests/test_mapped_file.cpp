@@ -0,0 +1,61 @@
+#include "../mapped_file.h"
+#include "../scoped_tempdir.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// Test mapping a file exposes its contents
+TEST(MappedFileTest, MapsFileContents)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+
+	std::filesystem::path path = tmpd / "mapped.bin";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "0123456789";
+	}
+
+	mapped_file m;
+	ASSERT_TRUE(m.open(path.string()));
+	EXPECT_TRUE(m);
+	ASSERT_EQ(m.size(), 10);
+	EXPECT_EQ(memcmp(m.data().data(), "0123456789", 10), 0);
+
+	auto middle = m.subspan(3, 4);
+	ASSERT_EQ(middle.size(), 4);
+	EXPECT_EQ(memcmp(middle.data(), "3456", 4), 0);
+
+	m.close();
+	EXPECT_FALSE(m);
+	EXPECT_EQ(m.size(), 0);
+}
+
+// Test out-of-range subspans are rejected rather than overrunning the mapping
+TEST(MappedFileTest, RejectsOutOfRangeSubspan)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+
+	std::filesystem::path path = tmpd / "mapped.bin";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "abcd";
+	}
+
+	mapped_file m;
+	ASSERT_TRUE(m.open(path.string()));
+	EXPECT_TRUE(m.subspan(2, 3).empty());
+	EXPECT_TRUE(m.subspan(5, 0).empty());
+	EXPECT_TRUE(m.subspan(2, UINT64_MAX).empty());
+	EXPECT_EQ(m.subspan(4, 0).size(), 0);
+}
+
+// Test opening a missing file fails cleanly
+TEST(MappedFileTest, FailsOnMissingFile)
+{
+	mapped_file m;
+	EXPECT_FALSE(m.open("/nonexistent/path/file.vp"));
+	EXPECT_FALSE(m);
+}
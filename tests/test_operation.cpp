@@ -160,3 +160,263 @@ TEST(OperationTest, LongFormOptions)
 		EXPECT_EQ(op.get_src_filename(), "input.txt");
 	}
 }
+
+// Test the index cache option
+TEST(OperationTest, IndexCacheOption)
+{
+	{
+		const char* argv[] = { "vptool", "t", "test.vp", "-c", "/tmp/cache" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_index_cache(), "/tmp/cache");
+	}
+
+	{
+		const char* argv[] = { "vptool", "t", "test.vp", "--index-cache", "test.vp.idx" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_index_cache(), "test.vp.idx");
+	}
+
+	{
+		const char* argv[] = { "vptool", "t", "test.vp", "-c" };
+		operation op;
+		EXPECT_FALSE(op.parse(4, const_cast<char**>(argv)));
+	}
+}
+
+// Test the jobs option
+TEST(OperationTest, JobsOption)
+{
+	{
+		const char* argv[] = { "vptool", "x", "test.vp" };
+		operation op;
+		ASSERT_TRUE(op.parse(3, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_jobs(), 1);
+	}
+
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "-j", "8" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_jobs(), 8);
+	}
+
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "--jobs", "0" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_jobs(), 0);
+	}
+
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "-j", "lots" };
+		operation op;
+		EXPECT_FALSE(op.parse(5, const_cast<char**>(argv)));
+	}
+}
+
+// Test the include and exclude options
+TEST(OperationTest, IncludeExcludeOptions)
+{
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "-I", "*.tbl", "--include", "*.tbm", "-X", "ai.*" };
+		operation op;
+		ASSERT_TRUE(op.parse(9, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_includes(), std::vector<std::string>({ "*.tbl", "*.tbm" }));
+		EXPECT_EQ(op.get_excludes(), std::vector<std::string>({ "ai.*" }));
+	}
+
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "--exclude" };
+		operation op;
+		EXPECT_FALSE(op.parse(4, const_cast<char**>(argv)));
+	}
+}
+
+// Test the update options
+TEST(OperationTest, UpdateOptions)
+{
+	{
+		const char* argv[] = { "vptool", "x", "test.vp" };
+		operation op;
+		ASSERT_TRUE(op.parse(3, const_cast<char**>(argv)));
+		EXPECT_FALSE(op.get_update());
+	}
+
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "--update" };
+		operation op;
+		ASSERT_TRUE(op.parse(4, const_cast<char**>(argv)));
+		EXPECT_TRUE(op.get_update());
+		EXPECT_FALSE(op.get_update_by_content());
+	}
+
+	{
+		const char* argv[] = { "vptool", "x", "test.vp", "--update-by-content" };
+		operation op;
+		ASSERT_TRUE(op.parse(4, const_cast<char**>(argv)));
+		EXPECT_TRUE(op.get_update());
+		EXPECT_TRUE(op.get_update_by_content());
+	}
+}
+
+// Test the build-package deduplication flag
+TEST(OperationTest, DedupOption)
+{
+	{
+		const char* argv[] = { "vptool", "p", "out.vp", "-i", "src" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_FALSE(op.get_dedup());
+	}
+
+	{
+		const char* argv[] = { "vptool", "p", "out.vp", "-i", "src", "-D" };
+		operation op;
+		ASSERT_TRUE(op.parse(6, const_cast<char**>(argv)));
+		EXPECT_TRUE(op.get_dedup());
+	}
+
+	{
+		const char* argv[] = { "vptool", "p", "out.vp", "--dedup", "-i", "src" };
+		operation op;
+		ASSERT_TRUE(op.parse(6, const_cast<char**>(argv)));
+		EXPECT_TRUE(op.get_dedup());
+		EXPECT_EQ(op.get_src_filename(), "src");
+	}
+}
+
+// Test giving build-package a base package
+TEST(OperationTest, BaseOption)
+{
+	{
+		const char* argv[] = { "vptool", "p", "out.vp", "-i", "src", "-B", "old.vp" };
+		operation op;
+		ASSERT_TRUE(op.parse(7, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_base_package(), "old.vp");
+	}
+
+	{
+		const char* argv[] = { "vptool", "p", "out.vp", "--base" };
+		operation op;
+		EXPECT_FALSE(op.parse(4, const_cast<char**>(argv)));
+	}
+}
+
+// Test the edit operation
+TEST(OperationTest, EditOperation)
+{
+	for (const char* name : { "e", "edit" }) {
+		const char* argv[] = { "vptool", name, "test.vp", "-i", "manifest.txt" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_type(), EDIT);
+		EXPECT_EQ(op.get_src_filename(), "manifest.txt");
+	}
+}
+
+// Test the compact operation
+TEST(OperationTest, CompactOperation)
+{
+	for (const char* name : { "k", "compact" }) {
+		const char* argv[] = { "vptool", name, "test.vp", "-o", "small.vp" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_type(), COMPACT);
+		EXPECT_EQ(op.get_dest_path(), "small.vp");
+	}
+}
+
+// Test the hash and verify operations
+TEST(OperationTest, HashAndVerifyOperations)
+{
+	for (const char* name : { "h", "hash" }) {
+		const char* argv[] = { "vptool", name, "test.vp", "-o", "test.crc" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_type(), HASH);
+		EXPECT_EQ(op.get_dest_path(), "test.crc");
+	}
+	for (const char* name : { "v", "verify" }) {
+		const char* argv[] = { "vptool", name, "test.vp", "-i", "test.crc", "-j", "4" };
+		operation op;
+		ASSERT_TRUE(op.parse(7, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_type(), VERIFY);
+		EXPECT_EQ(op.get_src_filename(), "test.crc");
+		EXPECT_EQ(op.get_jobs(), 4u);
+	}
+}
+
+// Test the diff operation, which has no short form
+TEST(OperationTest, DiffOperation)
+{
+	const char* argv[] = { "vptool", "diff", "old.vp", "-i", "new.vp" };
+	operation op;
+	ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+	EXPECT_EQ(op.get_type(), DIFF);
+	EXPECT_EQ(op.get_package_filename(), "old.vp");
+	EXPECT_EQ(op.get_src_filename(), "new.vp");
+}
+
+// Test the serve operation, which takes the socket path in place of a package
+TEST(OperationTest, ServeOperation)
+{
+	const char* argv[] = { "vptool", "serve", "/tmp/vptool.sock", "-c", "cache" };
+	operation op;
+	ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+	EXPECT_EQ(op.get_type(), SERVE);
+	EXPECT_EQ(op.get_package_filename(), "/tmp/vptool.sock");
+	EXPECT_EQ(op.get_index_cache(), "cache");
+}
+
+// Test the patch operations
+TEST(OperationTest, PatchOperations)
+{
+	{
+		const char* argv[] = { "vptool", "make-patch", "old.vp", "-i", "new.vp", "-o", "update.vpp" };
+		operation op;
+		ASSERT_TRUE(op.parse(7, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_type(), MAKE_PATCH);
+		EXPECT_EQ(op.get_package_filename(), "old.vp");
+		EXPECT_EQ(op.get_src_filename(), "new.vp");
+		EXPECT_EQ(op.get_dest_path(), "update.vpp");
+	}
+	{
+		const char* argv[] = { "vptool", "apply_patch", "old.vp", "-i", "update.vpp" };
+		operation op;
+		ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+		EXPECT_EQ(op.get_type(), APPLY_PATCH);
+		EXPECT_EQ(op.get_src_filename(), "update.vpp");
+	}
+}
+
+// Test the option to read compressed files raw
+TEST(OperationTest, RawOption)
+{
+	for (const char* flag : { "-R", "--raw" }) {
+		const char* argv[] = { "vptool", "x", "test.vp", flag };
+		operation op;
+		ASSERT_TRUE(op.parse(4, const_cast<char**>(argv)));
+		EXPECT_TRUE(op.get_raw());
+	}
+	const char* argv[] = { "vptool", "x", "test.vp" };
+	operation op;
+	ASSERT_TRUE(op.parse(3, const_cast<char**>(argv)));
+	EXPECT_FALSE(op.get_raw());
+}
+
+// Test the build-package compression flag
+TEST(OperationTest, CompressOption)
+{
+	for (const char* flag : { "-z", "--compress" }) {
+		const char* argv[] = { "vptool", "p", "out.vp", flag, "-i", "src" };
+		operation op;
+		ASSERT_TRUE(op.parse(6, const_cast<char**>(argv)));
+		EXPECT_TRUE(op.get_compress());
+	}
+	const char* argv[] = { "vptool", "p", "out.vp", "-i", "src" };
+	operation op;
+	ASSERT_TRUE(op.parse(5, const_cast<char**>(argv)));
+	EXPECT_FALSE(op.get_compress());
+}
@@ -0,0 +1,180 @@
+#include "../package_server.h"
+#include "../scoped_tempdir.h"
+#include "../vp_parser.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+class PackageServerTest : public ::testing::Test {
+protected:
+	scoped_tempdir tmpd { "test-" };
+	std::string socket_path;
+	std::string package;
+	std::string table;
+	package_server server;
+	std::thread runner;
+
+	void SetUp() override
+	{
+		ASSERT_TRUE(tmpd);
+		std::filesystem::create_directories(tmpd / "src/data/tables");
+		for (int i = 0; i < 10000; ++i) {
+			table += "$Name: ship " + std::to_string(i % 50) + "\n";
+		}
+		std::ofstream(tmpd / "src/data/tables/ships.tbl", std::ios::binary) << table;
+		std::ofstream(tmpd / "src/data/readme.txt", std::ios::binary) << "hello";
+		package = (tmpd / "test.vp").string();
+		vp_index built;
+		ASSERT_TRUE(built.build(tmpd / "src/data", package, 1, false, nullptr, nullptr, true));
+
+		socket_path = (tmpd / "vptool.sock").string();
+		ASSERT_TRUE(server.listen(socket_path));
+		runner = std::thread([this]() { server.run(); });
+	}
+
+	void TearDown() override
+	{
+		server.stop();
+		if (runner.joinable()) {
+			runner.join();
+		}
+	}
+
+	int Connect()
+	{
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr {};
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+		if (::connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	// Send one request and read back the reply line, plus a payload of the
+	// size it gives for reads
+	static std::string Request(int fd, const std::string& request, std::string* payload = nullptr)
+	{
+		std::string line = request + "\n";
+		if (::write(fd, line.data(), line.size()) != (ssize_t)line.size()) {
+			return "<write failed>";
+		}
+		std::string reply;
+		char c;
+		while (::read(fd, &c, 1) == 1 && c != '\n') {
+			reply += c;
+		}
+		if (payload && reply.starts_with("OK\t")) {
+			payload->resize(std::stoull(reply.substr(3)));
+			size_t done = 0;
+			while (done < payload->size()) {
+				ssize_t n = ::read(fd, payload->data() + done, payload->size() - done);
+				if (n <= 0) {
+					return "<short payload>";
+				}
+				done += n;
+			}
+		}
+		return reply;
+	}
+};
+
+// Test list, stat and read requests, whole and ranged, over one connection
+TEST_F(PackageServerTest, AnswersRequests)
+{
+	int fd = Connect();
+	ASSERT_GE(fd, 0);
+
+	std::string reply = Request(fd, "list\t" + package);
+	EXPECT_EQ(reply, "OK\t2");
+	std::string line;
+	char c;
+	while (::read(fd, &c, 1) == 1 && c != '\n') {
+		line += c;
+	}
+	EXPECT_TRUE(line.starts_with("data/readme.txt\t5\t")) << line;
+	line.clear();
+	while (::read(fd, &c, 1) == 1 && c != '\n') {
+		line += c;
+	}
+	EXPECT_TRUE(line.starts_with("data/tables/ships.tbl\t" + std::to_string(table.size()) + "\t")) << line;
+
+	reply = Request(fd, "stat\t" + package + "\tships.tbl");
+	EXPECT_TRUE(reply.starts_with("OK\tdata/tables/ships.tbl\t" + std::to_string(table.size()) + "\t")) << reply;
+	EXPECT_TRUE(reply.ends_with("\t1")) << reply;
+
+	std::string payload;
+	EXPECT_EQ(Request(fd, "read\t" + package + "\tdata/readme.txt", &payload), "OK\t5");
+	EXPECT_EQ(payload, "hello");
+	EXPECT_EQ(Request(fd, "read\t" + package + "\tships.tbl", &payload), "OK\t" + std::to_string(table.size()));
+	EXPECT_EQ(payload, table);
+	// A range across a block boundary of the compressed file, and one running
+	// off the end of a file
+	EXPECT_EQ(Request(fd, "read\t" + package + "\tships.tbl\t65500\t100", &payload), "OK\t100");
+	EXPECT_EQ(payload, table.substr(65500, 100));
+	EXPECT_EQ(Request(fd, "read\t" + package + "\treadme.txt\t3\t100", &payload), "OK\t2");
+	EXPECT_EQ(payload, "lo");
+
+	EXPECT_TRUE(Request(fd, "read\t" + package + "\treadme.txt\t6\t1").starts_with("ERR\t"));
+	EXPECT_TRUE(Request(fd, "read\t" + package + "\tmissing.txt").starts_with("ERR\t"));
+	EXPECT_TRUE(Request(fd, "stat\t" + (tmpd / "nope.vp").string() + "\tx").starts_with("ERR\t"));
+	EXPECT_TRUE(Request(fd, "frobnicate").starts_with("ERR\t"));
+	// Still answering after all those errors
+	EXPECT_EQ(Request(fd, "read\t" + package + "\treadme.txt", &payload), "OK\t5");
+	::close(fd);
+}
+
+// Test several clients at once, and picking up a package rebuilt under the server
+TEST_F(PackageServerTest, ConcurrentClientsAndReload)
+{
+	std::vector<std::thread> clients;
+	std::vector<int> good(8);
+	for (size_t i = 0; i < good.size(); ++i) {
+		clients.emplace_back([this, &good, i]() {
+			int fd = Connect();
+			std::string payload;
+			for (int j = 0; fd >= 0 && j < 50; ++j) {
+				if (Request(fd, "read\t" + package + "\tships.tbl", &payload) == "OK\t" + std::to_string(table.size())
+					&& payload == table) {
+					++good[i];
+				}
+			}
+			::close(fd);
+		});
+	}
+	for (auto& t : clients) {
+		t.join();
+	}
+	for (int count : good) {
+		EXPECT_EQ(count, 50);
+	}
+
+	int fd = Connect();
+	ASSERT_GE(fd, 0);
+	std::string payload;
+	EXPECT_EQ(Request(fd, "read\t" + package + "\treadme.txt", &payload), "OK\t5");
+	std::ofstream(tmpd / "src/data/readme.txt", std::ios::binary) << "hello again";
+	vp_index rebuilt;
+	ASSERT_TRUE(rebuilt.build(tmpd / "src/data", package + ".new"));
+	std::filesystem::rename(package + ".new", package);
+	EXPECT_EQ(Request(fd, "read\t" + package + "\treadme.txt", &payload), "OK\t11");
+	EXPECT_EQ(payload, "hello again");
+
+	// Stopping closes connections that are still open
+	server.stop();
+	runner.join();
+	char c;
+	EXPECT_EQ(::read(fd, &c, 1), 0);
+	::close(fd);
+	EXPECT_FALSE(std::filesystem::exists(socket_path));
+}
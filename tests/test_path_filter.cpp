@@ -0,0 +1,50 @@
+#include "../path_filter.h"
+#include <gtest/gtest.h>
+
+// Test the glob syntax on its own
+TEST(PathFilterTest, GlobMatch)
+{
+	EXPECT_TRUE(path_filter::glob_match("*.tbl", "ships.tbl"));
+	EXPECT_FALSE(path_filter::glob_match("*.tbl", "ships.tbm"));
+	EXPECT_FALSE(path_filter::glob_match("*.tbl", "data/ships.tbl"));
+	EXPECT_TRUE(path_filter::glob_match("data/*/ships.tbl", "data/tables/ships.tbl"));
+	EXPECT_FALSE(path_filter::glob_match("data/*/ships.tbl", "data/a/b/ships.tbl"));
+	EXPECT_TRUE(path_filter::glob_match("data/**/ships.tbl", "data/a/b/ships.tbl"));
+	EXPECT_TRUE(path_filter::glob_match("data/**/ships.tbl", "data/ships.tbl"));
+	EXPECT_TRUE(path_filter::glob_match("data/**", "data/maps/a.dds"));
+	EXPECT_TRUE(path_filter::glob_match("file?.fs2", "file1.fs2"));
+	EXPECT_FALSE(path_filter::glob_match("file?.fs2", "file10.fs2"));
+	EXPECT_TRUE(path_filter::glob_match("*.tb[lm]", "ai.tbm"));
+	EXPECT_FALSE(path_filter::glob_match("*.tb[!lm]", "ai.tbm"));
+	EXPECT_TRUE(path_filter::glob_match("sm[0-9]-*.fs2", "sm1-01.fs2"));
+	EXPECT_TRUE(path_filter::glob_match("[abc", "[abc"));
+	EXPECT_TRUE(path_filter::glob_match("", ""));
+	EXPECT_FALSE(path_filter::glob_match("", "a"));
+}
+
+// Test that name patterns, path patterns and case-insensitivity combine properly
+TEST(PathFilterTest, IncludeAndExclude)
+{
+	path_filter all;
+	EXPECT_TRUE(all.empty());
+	EXPECT_TRUE(all.matches("", "anything"));
+
+	path_filter filter;
+	filter.include("*.TBL");
+	EXPECT_FALSE(filter.needs_path());
+	EXPECT_TRUE(filter.matches("", "Ships.tbl"));
+	EXPECT_FALSE(filter.matches("", "ships.tbm"));
+
+	filter.include("data/maps/*");
+	filter.exclude("ai*");
+	EXPECT_TRUE(filter.needs_path());
+	EXPECT_TRUE(filter.matches("data/Maps/a.dds", "a.dds"));
+	EXPECT_FALSE(filter.matches("data/missions/a.dds", "a.dds"));
+	EXPECT_FALSE(filter.matches("data/tables/ai.tbl", "ai.tbl"));
+	EXPECT_FALSE(filter.matches("data/maps/ai.dds", "ai.dds"));
+
+	path_filter exclude_only;
+	exclude_only.exclude("data\\maps\\*");
+	EXPECT_TRUE(exclude_only.matches("data/tables/ai.tbl", "ai.tbl"));
+	EXPECT_FALSE(exclude_only.matches("data/maps/a.dds", "a.dds"));
+}
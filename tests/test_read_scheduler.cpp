@@ -0,0 +1,104 @@
+#include "../read_scheduler.h"
+#include "../scoped_tempdir.h"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+class ReadSchedulerTest : public ::testing::Test {
+protected:
+	scoped_tempdir tmpd { "test-" };
+	std::filesystem::path src_path;
+	std::string src;
+
+	void SetUp() override
+	{
+		ASSERT_TRUE(tmpd);
+		src_path = tmpd / "package.bin";
+		src.resize(read_scheduler::max_batch + 20000);
+		for (size_t i = 0; i < src.size(); ++i) {
+			src[i] = (char)('a' + i % 23);
+		}
+		std::ofstream out(src_path, std::ios::binary);
+		out << src;
+	}
+
+	std::string ReadFile(const std::filesystem::path& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	}
+};
+
+// Test that requests are sorted by offset and neighbouring small ones merged
+TEST_F(ReadSchedulerTest, MergesNeighbouringSmallRanges)
+{
+	read_scheduler scheduler;
+	scheduler.add(300, 100, "c");
+	scheduler.add(0, 100, "a");
+	scheduler.add(100, 100, "b");
+	scheduler.plan();
+
+	ASSERT_EQ(scheduler.batches().size(), 1u);
+	EXPECT_EQ(scheduler.batches()[0].offset, 0u);
+	EXPECT_EQ(scheduler.batches()[0].size, 400u);
+	EXPECT_EQ(scheduler.batches()[0].count, 3u);
+	EXPECT_EQ(scheduler.requests()[0].dest, "a");
+	EXPECT_EQ(scheduler.requests()[1].dest, "b");
+	EXPECT_EQ(scheduler.requests()[2].dest, "c");
+}
+
+// Test the cases that start a new batch: large ranges, big gaps and full batches
+TEST_F(ReadSchedulerTest, SplitsBatches)
+{
+	const uint64_t small = read_scheduler::small_size;
+
+	read_scheduler scheduler;
+	scheduler.add(0, 100, "a");
+	scheduler.add(100, small + 1, "big");
+	scheduler.add(small + 101, 100, "b");
+	scheduler.add(small + 201 + read_scheduler::max_gap + 1, 100, "far");
+	uint64_t offset = 2 * small + read_scheduler::max_gap;
+	for (uint64_t filled = 0; filled <= read_scheduler::max_batch; filled += small) {
+		scheduler.add(offset + filled, small, "run");
+	}
+	scheduler.plan();
+
+	const auto& batches = scheduler.batches();
+	ASSERT_EQ(batches.size(), 6u);
+	EXPECT_EQ(batches[0].count, 1u); // a can't merge with big
+	EXPECT_EQ(batches[1].count, 1u); // big is on its own
+	EXPECT_EQ(batches[2].count, 1u); // b is too far from far
+	EXPECT_EQ(batches[3].count, 1u); // and far from the run
+	EXPECT_EQ(batches[4].count, read_scheduler::max_batch / small);
+	EXPECT_EQ(batches[5].count, 1u); // the run overflowed one batch
+	for (const auto& b : batches) {
+		EXPECT_LE(b.size, read_scheduler::max_batch);
+	}
+}
+
+// Test that running a plan writes every range, including overlapping ones
+TEST_F(ReadSchedulerTest, WritesEveryRange)
+{
+	read_scheduler scheduler;
+	scheduler.add(5000, 3000, tmpd / "overlap");
+	scheduler.add(1000, 5000, tmpd / "small");
+	scheduler.add(0, 0, tmpd / "empty");
+	scheduler.add(20000, read_scheduler::max_batch, tmpd / "large");
+	scheduler.plan();
+	EXPECT_EQ(scheduler.batches().size(), 2u);
+
+	int fd = open(src_path.c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0);
+	EXPECT_TRUE(scheduler.run(fd));
+	close(fd);
+
+	EXPECT_EQ(ReadFile(tmpd / "small"), src.substr(1000, 5000));
+	EXPECT_EQ(ReadFile(tmpd / "overlap"), src.substr(5000, 3000));
+	EXPECT_TRUE(std::filesystem::exists(tmpd / "empty"));
+	EXPECT_EQ(ReadFile(tmpd / "empty"), "");
+	EXPECT_EQ(ReadFile(tmpd / "large"), src.substr(20000, read_scheduler::max_batch));
+}
@@ -0,0 +1,171 @@
+#include "../buffer_pool.h"
+#include "../file_prefetcher.h"
+#include "../scoped_tempdir.h"
+#include "../stream_writer.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static std::string read_file(const std::filesystem::path& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// Test that acquire() waits for a buffer to come back once they're all out
+TEST(BufferPoolTest, AcquireBlocksWhenExhausted)
+{
+	buffer_pool pool(2, 16);
+	char* a = pool.acquire();
+	char* b = pool.acquire();
+	EXPECT_NE(a, b);
+
+	std::atomic<bool> got_one = false;
+	std::thread t([&pool, &got_one]() {
+		pool.release(pool.acquire());
+		got_one = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_FALSE(got_one);
+
+	pool.release(a);
+	t.join();
+	EXPECT_TRUE(got_one);
+	pool.release(b);
+}
+
+// Test mixing buffered writes, small and large files, and patching earlier bytes
+TEST(StreamWriterTest, WritesPiecesInOrder)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+
+	std::string small = "small file";
+	std::string large(stream_writer::large_file + 1000, 'L');
+	for (size_t i = 0; i < large.size(); i += 97) {
+		large[i] = 'a' + i % 26;
+	}
+	std::ofstream(tmpd / "small.txt", std::ios::binary) << small;
+	std::ofstream(tmpd / "large.bin", std::ios::binary) << large;
+
+	// A tiny buffer, so everything has to be flushed several times over
+	buffer_pool pool(1, 7);
+	stream_writer out(pool);
+	ASSERT_TRUE(out.open((tmpd / "out.bin").string()));
+	ASSERT_TRUE(out.write("HEADER", 6));
+	int small_fd = ::open((tmpd / "small.txt").c_str(), O_RDONLY);
+	int large_fd = ::open((tmpd / "large.bin").c_str(), O_RDONLY);
+	ASSERT_TRUE(out.write_fd(small_fd, small.size()));
+	ASSERT_TRUE(out.write_fd(large_fd, large.size()));
+	::close(small_fd);
+	::close(large_fd);
+	ASSERT_TRUE(out.write("tail", 4));
+	EXPECT_EQ(out.position(), 6 + small.size() + large.size() + 4);
+	ASSERT_TRUE(out.write_at(0, "header", 6));
+	ASSERT_TRUE(out.close());
+
+	EXPECT_EQ(read_file(tmpd / "out.bin"), "header" + small + large + "tail");
+}
+
+// Test that an input file shorter than promised is an error
+TEST(StreamWriterTest, FailsOnShortInput)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::ofstream(tmpd / "short.txt", std::ios::binary) << "abc";
+
+	buffer_pool pool(1, 64);
+	stream_writer out(pool);
+	ASSERT_TRUE(out.open((tmpd / "out.bin").string()));
+	int fd = ::open((tmpd / "short.txt").c_str(), O_RDONLY);
+	EXPECT_FALSE(out.write_fd(fd, 10));
+	::close(fd);
+}
+
+// Test taking back bytes already written, buffered or not
+TEST(StreamWriterTest, Truncate)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+
+	buffer_pool pool(1, 8);
+	stream_writer out(pool);
+	ASSERT_TRUE(out.open((tmpd / "out.bin").string()));
+	ASSERT_TRUE(out.write("keep", 4));
+	ASSERT_TRUE(out.write("throw this away", 15));
+	ASSERT_TRUE(out.truncate(4));
+	EXPECT_EQ(out.position(), 4u);
+	ASSERT_TRUE(out.write("!", 1));
+	ASSERT_TRUE(out.close(true));
+
+	EXPECT_EQ(read_file(tmpd / "out.bin"), "keep!");
+}
+
+// Test that files come out in order, small ones read in and big ones left open,
+// with far more files than the readers may have in flight at once
+TEST(FilePrefetcherTest, DeliversInOrder)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+
+	std::vector<std::filesystem::path> paths;
+	for (int i = 0; i < 50; ++i) {
+		paths.push_back(tmpd / ("f" + std::to_string(i)));
+		// Every tenth file is too big for a buffer
+		std::ofstream(paths.back(), std::ios::binary) << std::string(i % 10 == 0 ? 100 : i, 'a' + i % 26);
+	}
+	paths.push_back(tmpd / "missing");
+
+	buffer_pool pool(3, 64);
+	file_prefetcher prefetch(paths, 4, pool);
+	for (size_t i = 0; i < paths.size() - 1; ++i) {
+		const file_prefetcher::file& f = prefetch.get(i);
+		ASSERT_TRUE(f.ok);
+		if (i % 10 == 0) {
+			EXPECT_EQ(f.size, 100u);
+			EXPECT_EQ(f.data, nullptr);
+			EXPECT_GE(f.fd, 0);
+		} else {
+			ASSERT_NE(f.data, nullptr);
+			EXPECT_EQ(std::string(f.data, f.size), std::string(i, 'a' + i % 26));
+		}
+		prefetch.release(i);
+	}
+	EXPECT_FALSE(prefetch.get(paths.size() - 1).ok);
+}
+
+// Test that the prefetcher can be torn down before everything's been taken
+TEST(FilePrefetcherTest, StopsEarly)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+
+	std::vector<std::filesystem::path> paths;
+	for (int i = 0; i < 20; ++i) {
+		paths.push_back(tmpd / ("f" + std::to_string(i)));
+		std::ofstream(paths.back(), std::ios::binary) << "contents";
+	}
+
+	buffer_pool pool(2, 64);
+	{
+		file_prefetcher prefetch(paths, 2, pool);
+		prefetch.get(0);
+		prefetch.release(0);
+		prefetch.get(1);
+	}
+	// Every buffer made it back
+	pool.release(pool.acquire());
+	pool.release(pool.acquire());
+	char* a = pool.acquire();
+	char* b = pool.acquire();
+	EXPECT_NE(a, b);
+	pool.release(a);
+	pool.release(b);
+}
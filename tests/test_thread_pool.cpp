@@ -0,0 +1,67 @@
+#include "../thread_pool.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Test every submitted task runs before wait() returns
+TEST(ThreadPoolTest, RunsAllTasks)
+{
+	thread_pool pool(4);
+	EXPECT_EQ(pool.size(), 4);
+
+	std::atomic<int> count = 0;
+	for (int i = 0; i < 1000; ++i) {
+		pool.submit([&count]() { ++count; });
+	}
+	pool.wait();
+	EXPECT_EQ(count, 1000);
+
+	// The pool can be reused after a wait()
+	for (int i = 0; i < 10; ++i) {
+		pool.submit([&count]() { ++count; });
+	}
+	pool.wait();
+	EXPECT_EQ(count, 1010);
+}
+
+// Test idle workers steal from a worker stuck on a long task
+TEST(ThreadPoolTest, IdleWorkersSteal)
+{
+	thread_pool pool(2);
+
+	// Worker queues are dealt tasks in turn, so the slow task and half of
+	// the quick ones land in the same queue
+	std::atomic<bool> release = false;
+	std::atomic<int> count = 0;
+	pool.submit([&release]() {
+		while (!release) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+	for (int i = 0; i < 99; ++i) {
+		pool.submit([&count]() { ++count; });
+	}
+
+	// All the quick tasks get done while the slow one is still blocked
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (count < 99 && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_EQ(count, 99);
+
+	release = true;
+	pool.wait();
+}
+
+// Test a zero-sized pool still gets one worker
+TEST(ThreadPoolTest, AtLeastOneWorker)
+{
+	thread_pool pool(0);
+	EXPECT_EQ(pool.size(), 1);
+
+	bool ran = false;
+	pool.submit([&ran]() { ran = true; });
+	pool.wait();
+	EXPECT_TRUE(ran);
+}
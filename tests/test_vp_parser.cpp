@@ -1,8 +1,20 @@
+#include "../checksum_manifest.h"
+#include "../crc32c.h"
+#include "../edit_manifest.h"
+#include "../path_filter.h"
+#include "../scoped_tempdir.h"
 #include "../vp_parser.h"
 #include <gtest/gtest.h>
 #include <filesystem>
 #include <fstream>
+#include <chrono>
+#include <cstddef>
 #include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // VP file format structures (copied from vp_parser.cpp for testing)
 const uint32_t vp_sig = 0x50565056;
@@ -36,6 +48,7 @@ protected:
 		if (std::filesystem::exists(test_vp_path)) {
 			std::filesystem::remove(test_vp_path);
 		}
+		std::filesystem::remove(test_vp_path.string() + ".idx");
 	}
 
 	// Create a minimal valid VP file
@@ -159,6 +172,44 @@ protected:
 
 		vp.close();
 	}
+
+	// Create a VP file from a list of (name, contents) entries. A name ending
+	// in '/' opens a directory and ".." closes one; everything else is a file.
+	void CreateVPFile(const std::vector<std::pair<std::string, std::string>>& entries, int timestamp = 0)
+	{
+		std::ofstream vp(test_vp_path, std::ios::binary);
+
+		vp_header hdr;
+		memcpy(hdr.header, "VPVP", 4);
+		hdr.version = 2;
+		hdr.diroffset = sizeof(vp_header);
+		hdr.direntries = entries.size();
+		vp.write((char*)&hdr, sizeof(hdr));
+
+		std::vector<vp_direntry> index;
+		for (const auto& [name, contents] : entries) {
+			vp_direntry entry;
+			memset(&entry, 0, sizeof(entry));
+			if (name == "..") {
+				strcpy(entry.name, "..");
+			} else if (name.back() == '/') {
+				strncpy(entry.name, name.c_str(), name.size() - 1);
+			} else {
+				strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+				entry.offset = hdr.diroffset;
+				entry.size = contents.size();
+				entry.timestamp = timestamp;
+				vp.write(contents.data(), contents.size());
+				hdr.diroffset += contents.size();
+			}
+			index.push_back(entry);
+		}
+		vp.write((char*)index.data(), index.size() * sizeof(vp_direntry));
+
+		vp.seekp(0);
+		vp.write((char*)&hdr, sizeof(hdr));
+		vp.close();
+	}
 };
 
 // Test parsing a valid VP file
@@ -245,3 +296,1130 @@ TEST_F(VPFileFixture, ExtractFileContent)
 	std::string content = file->dump();
 	EXPECT_EQ(content, "Hello World");
 }
+
+// Test read-only mode serves file contents straight from the mapping
+TEST_F(VPFileFixture, ReadOnlyMappedContent)
+{
+	CreateValidVPFile();
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+
+	vp_file* file = idx.find("test.txt");
+	ASSERT_NE(file, nullptr);
+
+	std::span<const std::byte> contents = file->data();
+	ASSERT_EQ(contents.size(), 11);
+	EXPECT_EQ(std::string((const char*)contents.data(), contents.size()), "Hello World");
+	EXPECT_EQ(file->dump(), "Hello World");
+}
+
+// Test read-write mode does not hand out mapped views
+TEST_F(VPFileFixture, ReadWriteHasNoMappedData)
+{
+	CreateValidVPFile();
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+
+	vp_file* file = idx.find("test.txt");
+	ASSERT_NE(file, nullptr);
+	EXPECT_TRUE(file->data().empty());
+}
+
+// Test read-only packages refuse writes
+TEST_F(VPFileFixture, ReadOnlyRejectsWrites)
+{
+	CreateValidVPFile();
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+
+	vp_file* file = idx.find("test.txt");
+	ASSERT_NE(file, nullptr);
+	EXPECT_FALSE(file->write_file_contents(test_vp_path));
+	EXPECT_FALSE(idx.update_index(file));
+}
+
+// Test read-only mode applies the same validation as read-write mode
+TEST_F(VPFileFixture, ReadOnlyRejectsInvalidSignature)
+{
+	CreateInvalidSignatureVPFile();
+
+	vp_index idx;
+	EXPECT_FALSE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+}
+
+// Test lookups by full internal path
+TEST_F(VPFileFixture, FindByFullPath)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "maps/", "" },
+		{ "a.txt", "first" },
+		{ "..", "" },
+		{ "missions/", "" },
+		{ "b.txt", "second" },
+		{ "..", "" },
+		{ "..", "" } });
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+
+	vp_file* a = idx.find("data/maps/a.txt");
+	ASSERT_NE(a, nullptr);
+	EXPECT_EQ(a->dump(), "first");
+
+	vp_file* b = idx.find("./data/missions/b.txt");
+	ASSERT_NE(b, nullptr);
+	EXPECT_EQ(b->dump(), "second");
+
+	EXPECT_EQ(idx.find("data\\missions\\b.txt"), b);
+	EXPECT_EQ(idx.find("data/maps/b.txt"), nullptr);
+	EXPECT_EQ(idx.find("b.txt"), b);
+}
+
+// Test lookups are case-insensitive, like the engine
+TEST_F(VPFileFixture, FindIsCaseInsensitive)
+{
+	CreateVPFile({ { "data/", "" }, { "Tables/", "" }, { "Ships.tbl", "ships" }, { "..", "" }, { "..", "" } });
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+
+	vp_file* f = idx.find("ships.TBL");
+	ASSERT_NE(f, nullptr);
+	EXPECT_EQ(f->get_name(), "Ships.tbl");
+	EXPECT_EQ(idx.find("DATA/tables/ships.tbl"), f);
+}
+
+// Test ambiguous bare names are reported instead of picking one
+TEST_F(VPFileFixture, FindReportsAmbiguousNames)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "maps/", "" },
+		{ "dup.txt", "one" },
+		{ "..", "" },
+		{ "missions/", "" },
+		{ "dup.txt", "two" },
+		{ "..", "" },
+		{ "..", "" } });
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+
+	EXPECT_EQ(idx.find("dup.txt"), nullptr);
+	std::vector<vp_file*> matches = idx.find_all("dup.txt");
+	ASSERT_EQ(matches.size(), 2);
+	EXPECT_EQ(matches[0]->dump(), "one");
+	EXPECT_EQ(matches[1]->dump(), "two");
+
+	// The full path disambiguates
+	vp_file* two = idx.find("data/missions/dup.txt");
+	ASSERT_NE(two, nullptr);
+	EXPECT_EQ(two->dump(), "two");
+}
+
+// Test tree structure (parents, children, paths) survives the flat storage
+TEST_F(VPFileFixture, TreeStructureAndPaths)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "maps/", "" },
+		{ "a.txt", "first" },
+		{ "b.txt", "second" },
+		{ "..", "" },
+		{ "c.txt", "third" },
+		{ "..", "" } });
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+
+	EXPECT_EQ(idx.print_index_listing(), "data/\n   maps/\n      a.txt\n      b.txt\n   c.txt\n");
+
+	vp_file* b = idx.find("b.txt");
+	ASSERT_NE(b, nullptr);
+	EXPECT_EQ(b->get_path(), "./data/maps/b.txt");
+	EXPECT_EQ(b->get_package_path(), "data/maps/b.txt");
+	ASSERT_NE(b->get_parent(), nullptr);
+	EXPECT_EQ(b->get_parent()->get_name(), "maps");
+	EXPECT_EQ(b->get_parent()->get_parent()->get_name(), "data");
+
+	std::vector<std::string> children;
+	b->get_parent()->foreach_child([&children](const vp_node* child) {
+		children.emplace_back(child->get_name());
+	});
+	EXPECT_EQ(children, (std::vector<std::string> { "a.txt", "b.txt" }));
+}
+
+// Test the sidecar cache is written, reused while the package is unchanged,
+// and ignored once the package changes
+TEST_F(VPFileFixture, IndexCacheRoundTrip)
+{
+	CreateVPFile({ { "data/", "" }, { "a.txt", "first" }, { "b.txt", "second" }, { "..", "" } });
+	std::string cache = vp_index::get_cache_path(test_vp_path.string(), test_vp_path.string() + ".idx");
+	EXPECT_EQ(cache, test_vp_path.string() + ".idx");
+
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY, cache));
+		ASSERT_TRUE(std::filesystem::exists(cache));
+	}
+
+	// Rename a.txt in the package index behind the cache's back, keeping the
+	// size and modification time the same
+	auto mtime = std::filesystem::last_write_time(test_vp_path);
+	{
+		std::fstream vp(test_vp_path, std::ios::in | std::ios::out | std::ios::binary);
+		vp_header hdr;
+		vp.read((char*)&hdr, sizeof(hdr));
+		vp.seekp(hdr.diroffset + sizeof(vp_direntry) + offsetof(vp_direntry, name));
+		vp.write("z", 1);
+	}
+	std::filesystem::last_write_time(test_vp_path, mtime);
+
+	{
+		// The cache still matches, so it wins
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY, cache));
+		vp_file* a = idx.find("data/a.txt");
+		ASSERT_NE(a, nullptr);
+		EXPECT_EQ(a->dump(), "first");
+		EXPECT_EQ(idx.find("z.txt"), nullptr);
+		EXPECT_EQ(idx.print_index_listing(), "data/\n   a.txt\n   b.txt\n");
+	}
+
+	std::filesystem::last_write_time(test_vp_path, mtime + std::chrono::seconds(1));
+
+	{
+		// Now the package looks different, so the cache is rebuilt
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_WRITE, cache));
+		EXPECT_EQ(idx.find("a.txt"), nullptr);
+		ASSERT_NE(idx.find("z.txt"), nullptr);
+	}
+
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY, cache));
+		ASSERT_NE(idx.find("z.txt"), nullptr);
+		EXPECT_EQ(idx.find("z.txt")->dump(), "first");
+	}
+}
+
+// Test a corrupt sidecar cache is ignored rather than trusted
+TEST_F(VPFileFixture, IndexCacheIgnoresCorruptCache)
+{
+	CreateVPFile({ { "data/", "" }, { "a.txt", "first" }, { "..", "" } });
+	std::string cache = test_vp_path.string() + ".idx";
+
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY, cache));
+	}
+
+	// Chop the cache short
+	std::filesystem::resize_file(cache, std::filesystem::file_size(cache) - 4);
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY, cache));
+	ASSERT_NE(idx.find("a.txt"), nullptr);
+	EXPECT_EQ(idx.find("a.txt")->dump(), "first");
+}
+
+// Test parallel extraction produces the same tree as serial extraction
+TEST_F(VPFileFixture, ParallelExtractMatchesSerial)
+{
+	std::string big(300000, 'b');
+	CreateVPFile({ { "data/", "" },
+		{ "maps/", "" },
+		{ "a.txt", "first" },
+		{ "big.bin", big },
+		{ "..", "" },
+		{ "empty/", "" },
+		{ "..", "" },
+		{ "c.txt", "third" },
+		{ "..", "" } });
+
+	for (vp_access_mode mode : { VP_READ_WRITE, VP_READ_ONLY }) {
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), mode));
+
+		scoped_tempdir serial("test-");
+		scoped_tempdir parallel("test-");
+		ASSERT_TRUE(idx.dump(serial, 1));
+		ASSERT_TRUE(idx.dump(parallel, 4));
+
+		for (const char* file : { "data/maps/a.txt", "data/maps/big.bin", "data/c.txt" }) {
+			std::ifstream s(serial / file, std::ios::binary);
+			std::ifstream p(parallel / file, std::ios::binary);
+			std::string serial_contents((std::istreambuf_iterator<char>(s)), std::istreambuf_iterator<char>());
+			std::string parallel_contents((std::istreambuf_iterator<char>(p)), std::istreambuf_iterator<char>());
+			EXPECT_FALSE(serial_contents.empty()) << file;
+			EXPECT_EQ(serial_contents, parallel_contents) << file;
+		}
+		EXPECT_TRUE(std::filesystem::is_directory(parallel / "data/empty"));
+	}
+}
+
+// Test extracting to disk sees contents just written through the package stream
+TEST_F(VPFileFixture, ExtractSeesInPlaceWrites)
+{
+	CreateValidVPFile();
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::path replacement = tmpd / "replacement.txt";
+	{
+		std::ofstream out(replacement, std::ios::binary);
+		out << "Howdy";
+	}
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+	vp_file* file = idx.find("test.txt");
+	ASSERT_NE(file, nullptr);
+	ASSERT_TRUE(file->write_file_contents(replacement));
+
+	std::filesystem::path extracted = tmpd / "extracted.txt";
+	ASSERT_TRUE(file->dump(extracted.string()));
+	std::ifstream in(extracted, std::ios::binary);
+	std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, "Howdy");
+}
+
+// Test streaming a file's contents into a pipe, in both access modes
+TEST_F(VPFileFixture, WriteToPipe)
+{
+	CreateValidVPFile();
+
+	for (vp_access_mode mode : { VP_READ_WRITE, VP_READ_ONLY }) {
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), mode));
+		vp_file* file = idx.find("test.txt");
+		ASSERT_NE(file, nullptr);
+
+		int fds[2];
+		ASSERT_EQ(pipe(fds), 0);
+		EXPECT_TRUE(file->write_to(fds[1]));
+		close(fds[1]);
+
+		char buf[64];
+		ssize_t n = read(fds[0], buf, sizeof(buf));
+		close(fds[0]);
+		ASSERT_GT(n, 0);
+		EXPECT_EQ(std::string(buf, n), "Hello World");
+	}
+}
+
+// Test extracting only the files selected by include/exclude patterns
+TEST_F(VPFileFixture, DumpWithFilter)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "tables/", "" },
+		{ "ships.tbl", "ships" },
+		{ "weapons.TBM", "weapons" },
+		{ "ai.tbl", "ai" },
+		{ "..", "" },
+		{ "maps/", "" },
+		{ "a.dds", "texture" },
+		{ "..", "" },
+		{ "..", "" } });
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+
+	path_filter filter;
+	filter.include("*.tb[lm]");
+	filter.exclude("data/tables/ai.*");
+	std::vector<const vp_file*> selected = idx.select(filter);
+	ASSERT_EQ(selected.size(), 2u);
+	EXPECT_EQ(selected[0]->get_name(), "ships.tbl");
+	EXPECT_EQ(selected[1]->get_name(), "weapons.TBM");
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	ASSERT_TRUE(idx.dump(tmpd.get_path().string(), 1, &filter));
+	EXPECT_TRUE(std::filesystem::exists(tmpd / "data/tables/ships.tbl"));
+	EXPECT_TRUE(std::filesystem::exists(tmpd / "data/tables/weapons.TBM"));
+	EXPECT_FALSE(std::filesystem::exists(tmpd / "data/tables/ai.tbl"));
+	EXPECT_FALSE(std::filesystem::exists(tmpd / "data/maps"));
+}
+
+// Test that updating an extraction only rewrites outputs that have changed
+TEST_F(VPFileFixture, DumpSkipsUnchangedFiles)
+{
+	const int timestamp = 1500000000;
+	CreateVPFile({ { "data/", "" }, { "a.txt", "first" }, { "b.txt", "second" }, { "..", "" } }, timestamp);
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::string dest = tmpd.get_path().string();
+	std::filesystem::path a = tmpd / "data/a.txt";
+	auto read_a = [&a]() {
+		std::ifstream in(a, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	};
+	auto overwrite_a = [&a](const char* contents) {
+		std::ofstream out(a, std::ios::binary | std::ios::trunc);
+		out << contents;
+	};
+
+	vp_extract_stats stats;
+	ASSERT_TRUE(idx.dump(dest, 1, nullptr, VP_SKIP_UNCHANGED, &stats));
+	EXPECT_EQ(stats.written, 2u);
+	EXPECT_EQ(stats.skipped, 0u);
+	struct stat st;
+	ASSERT_EQ(stat(a.c_str(), &st), 0);
+	EXPECT_EQ(st.st_mtime, timestamp);
+
+	ASSERT_TRUE(idx.dump(dest, 2, nullptr, VP_SKIP_UNCHANGED, &stats));
+	EXPECT_EQ(stats.written, 0u);
+	EXPECT_EQ(stats.skipped, 2u);
+
+	// Same size, but touched since, so it's rewritten
+	overwrite_a("FIRST");
+	ASSERT_TRUE(idx.dump(dest, 1, nullptr, VP_SKIP_UNCHANGED, &stats));
+	EXPECT_EQ(stats.written, 1u);
+	EXPECT_EQ(read_a(), "first");
+
+	// Changed behind our back with the timestamp put back: only a content
+	// comparison notices
+	overwrite_a("FIRST");
+	std::filesystem::last_write_time(a, std::filesystem::last_write_time(tmpd / "data/b.txt"));
+	ASSERT_TRUE(idx.dump(dest, 1, nullptr, VP_SKIP_UNCHANGED, &stats));
+	EXPECT_EQ(stats.written, 0u);
+	ASSERT_TRUE(idx.dump(dest, 1, nullptr, VP_SKIP_IDENTICAL, &stats));
+	EXPECT_EQ(stats.written, 1u);
+	EXPECT_EQ(stats.skipped, 1u);
+	EXPECT_EQ(read_a(), "first");
+}
+
+// Test that a built package holds every file, however it was streamed in
+TEST_F(VPFileFixture, BuildRoundTrip)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data/maps");
+	std::filesystem::create_directories(tmpd / "src/data/empty");
+	std::string big(3 * 1024 * 1024 + 5, 'x');
+	for (size_t i = 0; i < big.size(); i += 4096) {
+		big[i] = 'a' + (i / 4096) % 26;
+	}
+	std::ofstream(tmpd / "src/data/maps/big.bin", std::ios::binary) << big;
+	std::ofstream(tmpd / "src/data/maps/small.txt", std::ios::binary) << "tiny";
+
+	vp_index built;
+	ASSERT_TRUE(built.build(tmpd / "src/data", test_vp_path.string()));
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(idx.print_index_listing(), "data/\n   empty/\n   maps/\n      big.bin\n      small.txt\n");
+	ASSERT_NE(idx.find("big.bin"), nullptr);
+	EXPECT_EQ(idx.find("big.bin")->dump(), big);
+	EXPECT_EQ(idx.find("small.txt")->dump(), "tiny");
+}
+
+// Test that building with several readers gives exactly the same package
+TEST_F(VPFileFixture, BuildWithJobsMatchesSerial)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data/tables");
+	for (int i = 0; i < 100; ++i) {
+		std::ofstream(tmpd / "src/data/tables" / ("t" + std::to_string(i) + ".tbl"), std::ios::binary)
+			<< std::string(i * 37 + 1, 'a' + i % 26);
+	}
+	std::ofstream(tmpd / "src/data/tables/large.bin", std::ios::binary) << std::string(600 * 1024, 'L');
+
+	vp_index serial;
+	ASSERT_TRUE(serial.build(tmpd / "src/data", (tmpd / "serial.vp").string(), 1));
+	vp_index parallel;
+	ASSERT_TRUE(parallel.build(tmpd / "src/data", test_vp_path.string(), 4));
+
+	auto read_file = [](const std::filesystem::path& path) {
+		std::ifstream in(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	};
+	EXPECT_EQ(read_file(tmpd / "serial.vp"), read_file(test_vp_path));
+}
+
+// Test that identical files are stored once, and that files which merely share
+// a size are not mistaken for duplicates
+TEST_F(VPFileFixture, BuildDeduplicates)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data/a");
+	std::filesystem::create_directories(tmpd / "src/data/b");
+	std::string big(400 * 1024, 'B');
+	std::ofstream(tmpd / "src/data/a/big.dds", std::ios::binary) << big;
+	std::ofstream(tmpd / "src/data/b/big.dds", std::ios::binary) << big;
+	std::ofstream(tmpd / "src/data/a/one.tbl", std::ios::binary) << "same";
+	std::ofstream(tmpd / "src/data/b/two.tbl", std::ios::binary) << "same";
+	std::ofstream(tmpd / "src/data/b/other.tbl", std::ios::binary) << "diff";
+
+	vp_index plain;
+	ASSERT_TRUE(plain.build(tmpd / "src/data", (tmpd / "plain.vp").string()));
+
+	vp_index built;
+	vp_build_stats stats;
+	ASSERT_TRUE(built.build(tmpd / "src/data", test_vp_path.string(), 2, true, &stats));
+	EXPECT_EQ(stats.files, 5u);
+	EXPECT_EQ(stats.duplicates, 2u);
+	EXPECT_EQ(stats.bytes_saved, big.size() + 4);
+	EXPECT_EQ(std::filesystem::file_size(tmpd / "plain.vp") - std::filesystem::file_size(test_vp_path), stats.bytes_saved);
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	const vp_file* big_a = idx.find("data/a/big.dds");
+	const vp_file* big_b = idx.find("data/b/big.dds");
+	ASSERT_NE(big_a, nullptr);
+	ASSERT_NE(big_b, nullptr);
+	EXPECT_EQ(big_a->get_offset(), big_b->get_offset());
+	EXPECT_EQ(big_b->dump(), big);
+	EXPECT_EQ(idx.find("one.tbl")->get_offset(), idx.find("two.tbl")->get_offset());
+	EXPECT_NE(idx.find("one.tbl")->get_offset(), idx.find("other.tbl")->get_offset());
+	EXPECT_EQ(idx.find("two.tbl")->dump(), "same");
+	EXPECT_EQ(idx.find("other.tbl")->dump(), "diff");
+}
+
+// Test spotting files whose data is shared with another entry
+TEST_F(VPFileFixture, SharesData)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data");
+	std::ofstream(tmpd / "src/data/a.tbl", std::ios::binary) << "same";
+	std::ofstream(tmpd / "src/data/b.tbl", std::ios::binary) << "same";
+	std::ofstream(tmpd / "src/data/c.tbl", std::ios::binary) << "diff";
+
+	vp_index built;
+	ASSERT_TRUE(built.build(tmpd / "src/data", test_vp_path.string(), 1, true));
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_TRUE(idx.shares_data(idx.find("a.tbl")));
+	EXPECT_TRUE(idx.shares_data(idx.find("b.tbl")));
+	EXPECT_FALSE(idx.shares_data(idx.find("c.tbl")));
+}
+
+// Test rebuilding on top of an earlier build: unchanged files come from the
+// base, changed and new ones from the tree, and the result is the same as a
+// fresh build
+TEST_F(VPFileFixture, BuildFromBase)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data/missions");
+	std::filesystem::create_directories(tmpd / "src/data/tables");
+	std::ofstream(tmpd / "src/data/missions/m1.fs2", std::ios::binary) << "mission one";
+	std::ofstream(tmpd / "src/data/missions/m2.fs2", std::ios::binary) << "mission two";
+	std::ofstream(tmpd / "src/data/tables/ships.tbl", std::ios::binary) << std::string(300 * 1024, 'S');
+
+	vp_index first;
+	ASSERT_TRUE(first.build(tmpd / "src/data", test_vp_path.string()));
+
+	// Same size, but a different timestamp, so it has to be read again
+	std::ofstream(tmpd / "src/data/missions/m2.fs2", std::ios::binary) << "mission TWO";
+	std::filesystem::last_write_time(tmpd / "src/data/missions/m2.fs2",
+		std::filesystem::last_write_time(tmpd / "src/data/missions/m2.fs2") + std::chrono::seconds(5));
+	std::ofstream(tmpd / "src/data/missions/m3.fs2", std::ios::binary) << "mission three";
+
+	vp_index base;
+	ASSERT_TRUE(base.parse(test_vp_path.string(), VP_READ_ONLY));
+	vp_index rebuilt;
+	vp_build_stats stats;
+	ASSERT_TRUE(rebuilt.build(tmpd / "src/data", test_vp_path.string(), 2, false, &stats, &base));
+	EXPECT_EQ(stats.files, 4u);
+	EXPECT_EQ(stats.reused, 2u);
+	EXPECT_EQ(stats.bytes_reused, 11u + 300 * 1024);
+	EXPECT_FALSE(std::filesystem::exists(test_vp_path.string() + ".tmp"));
+
+	vp_index fresh;
+	ASSERT_TRUE(fresh.build(tmpd / "src/data", (tmpd / "fresh.vp").string()));
+	auto read_file = [](const std::filesystem::path& path) {
+		std::ifstream in(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	};
+	EXPECT_EQ(read_file(test_vp_path), read_file(tmpd / "fresh.vp"));
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(idx.find("m2.fs2")->dump(), "mission TWO");
+	EXPECT_EQ(idx.find("m3.fs2")->dump(), "mission three");
+}
+
+// Test a compressed build: text is stored LZ41-compressed, small and large
+// files alike, noise is stored as it is, and everything reads back the same
+TEST_F(VPFileFixture, BuildCompressed)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data/tables");
+	std::filesystem::create_directories(tmpd / "src/data/music");
+	std::string table;
+	for (int i = 0; i < 1000; ++i) {
+		table += "$Name: GTF Ulysses " + std::to_string(i % 10) + "\n";
+	}
+	std::string big;
+	while (big.size() < 700 * 1024) {
+		big += "#Mission " + std::to_string(big.size() % 1000) + " events\n";
+	}
+	std::string noise(300 * 1024, '\0');
+	uint32_t x = 1;
+	for (char& c : noise) {
+		x = x * 1103515245 + 12345;
+		c = (char)(x >> 24);
+	}
+	std::ofstream(tmpd / "src/data/tables/ships.tbl", std::ios::binary) << table;
+	std::ofstream(tmpd / "src/data/tables/copy.tbl", std::ios::binary) << table;
+	std::ofstream(tmpd / "src/data/tables/big.fs2", std::ios::binary) << big;
+	std::ofstream(tmpd / "src/data/tables/tiny.txt", std::ios::binary) << "tiny";
+	std::ofstream(tmpd / "src/data/music/theme.ogg", std::ios::binary) << noise;
+
+	vp_index serial;
+	vp_build_stats stats;
+	ASSERT_TRUE(serial.build(tmpd / "src/data", (tmpd / "serial.vp").string(), 1, true, &stats, nullptr, true));
+	EXPECT_EQ(stats.files, 5u);
+	EXPECT_EQ(stats.compressed, 2u);
+	EXPECT_EQ(stats.duplicates, 1u);
+	vp_index parallel;
+	ASSERT_TRUE(parallel.build(tmpd / "src/data", test_vp_path.string(), 4, true, nullptr, nullptr, true));
+	auto read_file = [](const std::filesystem::path& path) {
+		std::ifstream in(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	};
+	EXPECT_EQ(read_file(tmpd / "serial.vp"), read_file(test_vp_path));
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	for (const char* name : { "ships.tbl", "copy.tbl", "big.fs2" }) {
+		vp_file* f = idx.find(name);
+		ASSERT_TRUE(f);
+		EXPECT_TRUE(f->is_compressed()) << name;
+		EXPECT_LT(f->get_size(), f->get_contents_size() / 2) << name;
+	}
+	EXPECT_EQ(idx.find("copy.tbl")->get_offset(), idx.find("ships.tbl")->get_offset());
+	EXPECT_FALSE(idx.find("theme.ogg")->is_compressed());
+	EXPECT_FALSE(idx.find("tiny.txt")->is_compressed());
+	EXPECT_EQ(idx.find("theme.ogg")->get_size(), noise.size());
+	EXPECT_EQ(idx.find("copy.tbl")->dump(), table);
+	EXPECT_EQ(idx.find("big.fs2")->dump(), big);
+	EXPECT_EQ(idx.find("theme.ogg")->dump(), noise);
+	EXPECT_EQ(idx.find("tiny.txt")->dump(), "tiny");
+
+	// Compressed files are recognised as unchanged when rebuilding on top
+	vp_index rebuilt;
+	ASSERT_TRUE(rebuilt.build(tmpd / "src/data", test_vp_path.string(), 2, true, &stats, &idx, true));
+	EXPECT_EQ(stats.reused, 5u);
+	EXPECT_EQ(read_file(tmpd / "serial.vp"), read_file(test_vp_path));
+}
+
+// Test replacing a file with a bigger one by appending it, when another file
+// of the same name comes first in the index
+TEST_F(VPFileFixture, AppendFile)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "a/", "" }, { "same.tbl", "first" }, { "..", "" },
+		{ "b/", "" }, { "same.tbl", "second" }, { "..", "" },
+		{ "other.txt", "untouched" }, { "..", "" } });
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::string replacement(100 * 1024, 'R');
+	for (size_t i = 0; i < replacement.size(); i += 13) {
+		replacement[i] = 'a' + i % 26;
+	}
+	std::ofstream(tmpd / "new.tbl", std::ios::binary) << replacement;
+
+	uintmax_t old_size = std::filesystem::file_size(test_vp_path);
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string()));
+		vp_file* file = idx.find("data/b/same.tbl");
+		ASSERT_NE(file, nullptr);
+		ASSERT_TRUE(idx.append_file(file, tmpd / "new.tbl"));
+		EXPECT_EQ(file->get_offset(), old_size);
+		EXPECT_EQ(file->dump(), replacement);
+	}
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(idx.find("data/a/same.tbl")->dump(), "first");
+	EXPECT_EQ(idx.find("data/b/same.tbl")->dump(), replacement);
+	EXPECT_EQ(idx.find("other.txt")->dump(), "untouched");
+	EXPECT_EQ(idx.print_index_listing(), "data/\n   a/\n      same.tbl\n   b/\n      same.tbl\n   other.txt\n");
+}
+
+// Test overwriting a file in place with something longer than a few bytes
+TEST_F(VPFileFixture, WriteFileContentsInPlace)
+{
+	std::string original(1000, 'o');
+	CreateVPFile({ { "data/", "" }, { "a.txt", original }, { "b.txt", "after" }, { "..", "" } });
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::string replacement(900, 'n');
+	replacement[0] = 'N';
+	replacement[899] = 'n' + 1;
+	std::ofstream(tmpd / "new.txt", std::ios::binary) << replacement;
+
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string()));
+		vp_file* file = idx.find("a.txt");
+		ASSERT_TRUE(file->write_file_contents(tmpd / "new.txt"));
+		ASSERT_TRUE(idx.update_index(file));
+	}
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(idx.find("a.txt")->dump(), replacement);
+	EXPECT_EQ(idx.find("b.txt")->dump(), "after");
+}
+
+// Test applying a batch of edits in one go
+TEST_F(VPFileFixture, ApplyEdits)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "maps/", "" }, { "a.pcx", "map a" }, { "b.pcx", "map b" }, { "..", "" },
+		{ "tables/", "" }, { "ships.tbl", "old ships" }, { "..", "" },
+		{ "..", "" } });
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::ofstream(tmpd / "ships.tbl", std::ios::binary) << "new ships, and more of them";
+	std::ofstream(tmpd / "new.fs2", std::ios::binary) << "new mission";
+
+	std::vector<vp_edit> edits = {
+		{ vp_edit::REPLACE, "data/tables/ships.tbl", (tmpd / "ships.tbl").string() },
+		{ vp_edit::ADD, "data/missions/campaign/new.fs2", (tmpd / "new.fs2").string() },
+		{ vp_edit::DELETE, "data/maps/a.pcx", "" },
+		{ vp_edit::RENAME, "data/maps/b.pcx", "data/maps/c.pcx" },
+		// Edits see the ones before them
+		{ vp_edit::ADD, "data/maps/a.pcx", (tmpd / "new.fs2").string() },
+		// A replaced file that's then deleted isn't written at all
+		{ vp_edit::REPLACE, "data/maps/c.pcx", (tmpd / "ships.tbl").string() },
+		{ vp_edit::DELETE, "data/maps/c.pcx", "" },
+	};
+
+	uint64_t old_size = std::filesystem::file_size(test_vp_path);
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+	ASSERT_TRUE(idx.apply_edits(edits));
+	EXPECT_EQ(idx.find("ships.tbl")->dump(), "new ships, and more of them");
+
+	vp_index reread;
+	ASSERT_TRUE(reread.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(reread.print_index_listing(),
+		"data/\n   maps/\n      a.pcx\n   tables/\n      ships.tbl\n   missions/\n      campaign/\n         new.fs2\n");
+	// Only the new ships.tbl, new.fs2 twice and the new index were appended
+	EXPECT_EQ(std::filesystem::file_size(test_vp_path), old_size + 27 + 2 * 11 + 13 * sizeof(vp_direntry));
+	EXPECT_EQ(reread.find("data/maps/a.pcx")->dump(), "new mission");
+	EXPECT_EQ(reread.find("new.fs2")->dump(), "new mission");
+}
+
+// Test that a batch with a bad edit anywhere in it changes nothing
+TEST_F(VPFileFixture, ApplyEditsAllOrNothing)
+{
+	CreateVPFile({ { "data/", "" }, { "a.txt", "first" }, { "b.txt", "second" }, { "..", "" } });
+	auto read_package = [this]() {
+		std::ifstream in(test_vp_path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	};
+	std::string before = read_package();
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::ofstream(tmpd / "new.txt", std::ios::binary) << "new";
+	std::ofstream(tmpd / "empty.txt", std::ios::binary);
+
+	std::vector<std::vector<vp_edit>> bad_batches = {
+		{ { vp_edit::REPLACE, "data/a.txt", (tmpd / "new.txt").string() }, { vp_edit::DELETE, "data/missing.txt", "" } },
+		{ { vp_edit::ADD, "data/b.txt", (tmpd / "new.txt").string() } },
+		{ { vp_edit::RENAME, "data/a.txt", "data/B.TXT" } },
+		{ { vp_edit::ADD, "data/a.txt/c.txt", (tmpd / "new.txt").string() } },
+		{ { vp_edit::ADD, "data/c.txt", (tmpd / "missing.txt").string() } },
+		// Sources are all opened before anything is appended
+		{ { vp_edit::REPLACE, "data/a.txt", (tmpd / "new.txt").string() }, { vp_edit::ADD, "data/c.txt", (tmpd / "missing.txt").string() } },
+		{ { vp_edit::ADD, "data/c.txt", (tmpd / "new.txt").string() }, { vp_edit::REPLACE, "data/b.txt", (tmpd / "empty.txt").string() } },
+	};
+	for (const auto& batch : bad_batches) {
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string()));
+		EXPECT_FALSE(idx.apply_edits(batch));
+		EXPECT_EQ(read_package(), before);
+	}
+}
+
+// Test that an index update lands on the node's own entry, not on the first
+// entry with the same name
+TEST_F(VPFileFixture, UpdateIndexByPosition)
+{
+	CreateVPFile({ { "data/", "" },
+		{ "a/", "" }, { "same.tbl", "first file" }, { "..", "" },
+		{ "b/", "" }, { "same.tbl", "second file" }, { "..", "" },
+		{ "..", "" } });
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::ofstream(tmpd / "new.tbl", std::ios::binary) << "2nd";
+
+	// Go through the index cache too, which has to keep the positions
+	std::string cache = (tmpd / "index.cache").string();
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_WRITE, cache));
+	}
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_WRITE, cache));
+		vp_file* file = idx.find("data/b/same.tbl");
+		ASSERT_TRUE(file->write_file_contents(tmpd / "new.tbl"));
+		ASSERT_TRUE(idx.update_index(file));
+	}
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(idx.find("data/a/same.tbl")->dump(), "first file");
+	EXPECT_EQ(idx.find("data/b/same.tbl")->dump(), "2nd");
+}
+
+// Test updating several entries at once, neighbours and otherwise
+TEST_F(VPFileFixture, UpdateIndexBatch)
+{
+	CreateVPFile({ { "data/", "" }, { "a.txt", "aaaa" }, { "b.txt", "bbbb" }, { "c.txt", "cccc" },
+		{ "sub/", "" }, { "d.txt", "dddd" }, { "..", "" }, { "..", "" } });
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::ofstream(tmpd / "x", std::ios::binary) << "x";
+
+	{
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string()));
+		std::vector<const vp_node*> nodes;
+		for (const char* name : { "d.txt", "a.txt", "b.txt" }) {
+			vp_file* file = idx.find(name);
+			ASSERT_TRUE(file->write_file_contents(tmpd / "x"));
+			nodes.push_back(file);
+		}
+		ASSERT_TRUE(idx.update_index(nodes));
+	}
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(idx.find("a.txt")->dump(), "x");
+	EXPECT_EQ(idx.find("b.txt")->dump(), "x");
+	EXPECT_EQ(idx.find("c.txt")->dump(), "cccc");
+	EXPECT_EQ(idx.find("d.txt")->dump(), "x");
+	EXPECT_EQ(idx.print_index_listing(), "data/\n   a.txt\n   b.txt\n   c.txt\n   sub/\n      d.txt\n");
+}
+
+// Test squeezing out the space left behind by replaced files, in place
+TEST_F(VPFileFixture, CompactInPlace)
+{
+	CreateVPFile({ { "data/", "" }, { "a.txt", "aaaaaaaaaa" }, { "b.txt", "bbbbbbbbbb" }, { "c.txt", "cccccccccc" },
+		{ "..", "" } });
+
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::ofstream(tmpd / "short", std::ios::binary) << "B";
+	std::ofstream(tmpd / "long", std::ios::binary) << std::string(100, 'C');
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string()));
+	// One shrinks in place, one moves to the end
+	vp_file* b = idx.find("b.txt");
+	ASSERT_TRUE(b->write_file_contents(tmpd / "short"));
+	ASSERT_TRUE(idx.update_index(b));
+	ASSERT_TRUE(idx.append_file(idx.find("c.txt"), tmpd / "long"));
+
+	vp_compact_stats stats;
+	std::vector<std::pair<uint64_t, uint64_t>> progress;
+	ASSERT_TRUE(idx.compact(test_vp_path.string(), &stats, [&progress](uint64_t done, uint64_t total) {
+		progress.emplace_back(done, total);
+	}));
+	EXPECT_EQ(stats.live_bytes, 10u + 1 + 100);
+	EXPECT_EQ(stats.new_size, 16 + stats.live_bytes + 5 * 44);
+	EXPECT_EQ(std::filesystem::file_size(test_vp_path), stats.new_size);
+	EXPECT_GT(stats.old_size, stats.new_size);
+	ASSERT_FALSE(progress.empty());
+	EXPECT_EQ(progress.back(), std::make_pair(stats.live_bytes, stats.live_bytes));
+	EXPECT_FALSE(std::filesystem::exists(test_vp_path.string() + ".tmp"));
+
+	// The index was parsed again, and the package on disk agrees with it
+	EXPECT_EQ(idx.find("a.txt")->dump(), "aaaaaaaaaa");
+	EXPECT_EQ(idx.find("b.txt")->dump(), "B");
+	EXPECT_EQ(idx.find("c.txt")->dump(), std::string(100, 'C'));
+	vp_index reread;
+	ASSERT_TRUE(reread.parse(test_vp_path.string(), VP_READ_ONLY));
+	EXPECT_EQ(reread.print_index_listing(), "data/\n   a.txt\n   b.txt\n   c.txt\n");
+	EXPECT_EQ(reread.find("c.txt")->dump(), std::string(100, 'C'));
+}
+
+// Test that compacting into a new file keeps shared data shared
+TEST_F(VPFileFixture, CompactKeepsSharedData)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::filesystem::create_directories(tmpd / "src/data");
+	std::ofstream(tmpd / "src/data/a.tbl", std::ios::binary) << "same";
+	std::ofstream(tmpd / "src/data/b.tbl", std::ios::binary) << "same";
+	std::ofstream(tmpd / "src/data/c.tbl", std::ios::binary) << "diff";
+	vp_index built;
+	ASSERT_TRUE(built.build(tmpd / "src/data", test_vp_path.string(), 1, true));
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	vp_compact_stats stats;
+	ASSERT_TRUE(idx.compact((tmpd / "out.vp").string(), &stats));
+	EXPECT_EQ(stats.live_bytes, 8u);
+	EXPECT_EQ(stats.old_size, stats.new_size);
+
+	vp_index out;
+	ASSERT_TRUE(out.parse((tmpd / "out.vp").string(), VP_READ_ONLY));
+	EXPECT_EQ(out.find("a.tbl")->get_offset(), out.find("b.tbl")->get_offset());
+	EXPECT_EQ(out.find("b.tbl")->dump(), "same");
+	EXPECT_EQ(out.find("c.tbl")->dump(), "diff");
+}
+
+// Test that checksums come out the same however the data is read, including
+// for a file big enough to be split into pieces
+TEST_F(VPFileFixture, ChecksumFiles)
+{
+	std::string big(9 << 20, '\0');
+	for (size_t i = 0; i < big.size(); ++i) {
+		big[i] = (char)(i * 31 + i / 4099);
+	}
+	CreateVPFile({ { "data/", "" }, { "a.txt", "123456789" }, { "big.bin", big }, { "tables/", "" },
+		{ "b.tbl", "bbbb" }, { "..", "" }, { "..", "" } });
+
+	for (vp_access_mode mode : { VP_READ_WRITE, VP_READ_ONLY }) {
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), mode));
+		for (unsigned jobs : { 1u, 4u }) {
+			std::vector<vp_checksum> sums;
+			ASSERT_TRUE(idx.checksum(sums, jobs));
+			ASSERT_EQ(sums.size(), 3u);
+			EXPECT_EQ(sums[0].path, "data/a.txt");
+			EXPECT_EQ(sums[0].crc, 0xE3069283u);
+			EXPECT_EQ(sums[1].path, "data/big.bin");
+			EXPECT_EQ(sums[1].size, big.size());
+			EXPECT_EQ(sums[1].crc, crc32c(0, big.data(), big.size()));
+			EXPECT_EQ(sums[2].path, "data/tables/b.tbl");
+			EXPECT_EQ(sums[2].crc, crc32c(0, "bbbb", 4));
+		}
+	}
+}
+
+// Test that verify reports changed, missing and unexpected files
+TEST_F(VPFileFixture, VerifyAgainstManifest)
+{
+	CreateVPFile({ { "data/", "" }, { "a.txt", "aaaa" }, { "b.txt", "bbbb" }, { "c.txt", "cccc" }, { "..", "" } });
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	std::vector<vp_checksum> sums;
+	ASSERT_TRUE(idx.checksum(sums));
+
+	vp_verify_stats stats;
+	EXPECT_TRUE(idx.verify(sums, 2, &stats));
+	EXPECT_EQ(stats.ok, 3u);
+
+	sums[0].crc ^= 1; // a.txt changed
+	sums.erase(sums.begin() + 1); // b.txt not in the manifest
+	sums.push_back({ "data/d.txt", 4, 0 }); // d.txt not in the package
+	EXPECT_FALSE(idx.verify(sums, 2, &stats));
+	EXPECT_EQ(stats.ok, 1u);
+	EXPECT_EQ(stats.mismatched, 1u);
+	EXPECT_EQ(stats.missing, 1u);
+	EXPECT_EQ(stats.extra, 1u);
+}
+
+// Test that diff finds added, removed and changed files, including a change
+// in the last piece of a big file, without reporting identical ones
+TEST_F(VPFileFixture, DiffPackages)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::string big(9 << 20, 'x');
+	CreateVPFile({ { "data/", "" }, { "big.bin", big }, { "same.txt", "same" }, { "grows.txt", "abc" },
+		{ "edited.txt", "abcd" }, { "gone.txt", "gone" }, { "..", "" } });
+	std::filesystem::copy_file(test_vp_path, tmpd / "old.vp");
+	std::string big2 = big;
+	big2.back() = 'y';
+	CreateVPFile({ { "data/", "" }, { "big.bin", big2 }, { "edited.txt", "abce" }, { "grows.txt", "abcdef" },
+		{ "new.txt", "new" }, { "same.txt", "same" }, { "..", "" } });
+
+	vp_index old_idx, new_idx;
+	ASSERT_TRUE(old_idx.parse((tmpd / "old.vp").string(), VP_READ_ONLY));
+	ASSERT_TRUE(new_idx.parse(test_vp_path.string(), VP_READ_WRITE));
+	for (unsigned jobs : { 1u, 4u }) {
+		std::vector<vp_diff_entry> changes;
+		ASSERT_TRUE(old_idx.diff(new_idx, changes, jobs));
+		std::vector<std::pair<vp_diff_entry::kind_type, std::string>> found;
+		for (const vp_diff_entry& change : changes) {
+			found.emplace_back(change.kind, change.path);
+		}
+		std::vector<std::pair<vp_diff_entry::kind_type, std::string>> expected = {
+			{ vp_diff_entry::CHANGED, "data/big.bin" },
+			{ vp_diff_entry::CHANGED, "data/edited.txt" },
+			{ vp_diff_entry::REMOVED, "data/gone.txt" },
+			{ vp_diff_entry::CHANGED, "data/grows.txt" },
+			{ vp_diff_entry::ADDED, "data/new.txt" },
+		};
+		EXPECT_EQ(found, expected);
+	}
+
+	std::vector<vp_diff_entry> changes;
+	ASSERT_TRUE(new_idx.diff(new_idx, changes, 2));
+	EXPECT_TRUE(changes.empty());
+}
+
+// Test that a patch rebuilds the new package exactly, copying unchanged and
+// moved data by reference and sending only the change in a big file
+TEST_F(VPFileFixture, MakeAndApplyPatch)
+{
+	scoped_tempdir tmpd("test-");
+	ASSERT_TRUE(tmpd);
+	std::string big(1 << 20, '\0');
+	for (size_t i = 0; i < big.size(); ++i) {
+		big[i] = (char)(i * 2654435761u >> 13);
+	}
+	CreateVPFile({ { "data/", "" }, { "big.bin", big }, { "same.txt", std::string(1000, 's') }, { "gone.txt", "gone" },
+		{ "..", "" } }, 1000);
+	std::filesystem::path old_path = tmpd / "old.vp";
+	std::filesystem::copy_file(test_vp_path, old_path);
+	std::filesystem::copy_file(test_vp_path, tmpd / "orig.vp");
+	std::string big2 = big;
+	big2[300000] ^= 0x55;
+	CreateVPFile({ { "data/", "" }, { "added.txt", "new file" }, { "big.bin", big2 }, { "maps/", "" },
+		{ "moved.txt", std::string(1000, 's') }, { "..", "" }, { "..", "" } }, 2000);
+
+	vp_index old_idx, new_idx;
+	ASSERT_TRUE(old_idx.parse(old_path.string(), VP_READ_ONLY));
+	ASSERT_TRUE(new_idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	std::filesystem::path patch_path = tmpd / "update.vpp";
+	vp_patch_stats stats;
+	ASSERT_TRUE(old_idx.make_patch(new_idx, patch_path.string(), &stats));
+	EXPECT_EQ(stats.unchanged, 1u);
+	EXPECT_EQ(stats.delta, 1u);
+	EXPECT_EQ(stats.added, 1u);
+	EXPECT_EQ(stats.copied_bytes + stats.literal_bytes, std::filesystem::file_size(test_vp_path));
+	EXPECT_LT(stats.patch_size, 20000u);
+	EXPECT_EQ(stats.patch_size, std::filesystem::file_size(patch_path));
+
+	auto read_all = [](const std::filesystem::path& path) {
+		std::ifstream in(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	};
+	std::filesystem::path out_path = tmpd / "out.vp";
+	ASSERT_TRUE(vp_index::apply_patch(old_path.string(), patch_path.string(), out_path.string()));
+	EXPECT_EQ(read_all(out_path), read_all(test_vp_path));
+	EXPECT_FALSE(std::filesystem::exists(out_path.string() + ".tmp"));
+
+	// In place works too, but only on the package the patch was made from
+	EXPECT_FALSE(vp_index::apply_patch(test_vp_path.string(), patch_path.string(), out_path.string()));
+	ASSERT_TRUE(vp_index::apply_patch(old_path.string(), patch_path.string(), old_path.string()));
+	EXPECT_EQ(read_all(old_path), read_all(test_vp_path));
+
+	// An operation so big that the running size would wrap around is refused
+	// up front, rather than being started on. The header is the first 40 bytes.
+	std::string patch = read_all(patch_path);
+	std::string corrupt = patch.substr(0, 40);
+	uint64_t ops[2][3] = { { 'D', 0, 10 }, { 'D', 0, UINT64_MAX - 5 } };
+	corrupt.append((const char*)ops[0], sizeof(ops[0])).append(10, 'x').append((const char*)ops[1], sizeof(ops[1]));
+	std::ofstream(patch_path, std::ios::binary) << corrupt;
+	EXPECT_FALSE(vp_index::apply_patch((tmpd / "orig.vp").string(), patch_path.string(), out_path.string()));
+	EXPECT_FALSE(std::filesystem::exists(out_path.string() + ".tmp"));
+
+	// A patch whose data was damaged still produces a package with the right
+	// index, but not the right contents, so it goes no further than the .tmp
+	std::string contents = read_all(test_vp_path);
+	contents[sizeof(vp_header)] ^= 1;
+	corrupt = patch.substr(0, 40);
+	uint64_t data_op[3] = { 'D', 0, contents.size() };
+	uint64_t end_op[3] = { 'E', 0, 0 };
+	corrupt.append((const char*)data_op, sizeof(data_op)).append(contents).append((const char*)end_op, sizeof(end_op));
+	std::ofstream(patch_path, std::ios::binary) << corrupt;
+	EXPECT_FALSE(vp_index::apply_patch((tmpd / "orig.vp").string(), patch_path.string(), out_path.string()));
+	EXPECT_FALSE(std::filesystem::exists(out_path.string() + ".tmp"));
+	contents[sizeof(vp_header)] ^= 1;
+	corrupt.replace(40 + sizeof(data_op), contents.size(), contents);
+	std::ofstream(patch_path, std::ios::binary) << corrupt;
+	ASSERT_TRUE(vp_index::apply_patch((tmpd / "orig.vp").string(), patch_path.string(), out_path.string()));
+	EXPECT_EQ(read_all(out_path), read_all(test_vp_path));
+}
+
+// An LZ41 file holding data as literal-only LZ4 blocks
+static std::string make_lz41(const std::string& data, uint32_t block_size)
+{
+	std::string file = "LZ41";
+	std::vector<uint32_t> offsets;
+	for (size_t i = 0; i < data.size(); i += block_size) {
+		offsets.push_back(file.size());
+		std::string block = data.substr(i, block_size);
+		file += (char)0xf0;
+		size_t rest = block.size() - 15;
+		for (; rest >= 255; rest -= 255) {
+			file += (char)255;
+		}
+		file += (char)rest;
+		file += block;
+	}
+	offsets.push_back(file.size());
+	file.append((const char*)offsets.data(), offsets.size() * sizeof(uint32_t));
+	uint32_t trailer[3] = { (uint32_t)offsets.size(), (uint32_t)data.size(), block_size };
+	file.append((const char*)trailer, sizeof(trailer));
+	return file;
+}
+
+// Test that LZ41 entries are decompressed on every read path, unless raw
+TEST_F(VPFileFixture, CompressedEntries)
+{
+	std::string data(1000, '\0');
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (char)('a' + i % 23);
+	}
+	std::string packed = make_lz41(data, 256);
+	CreateVPFile({ { "data/", "" }, { "packed.tbl", packed }, { "plain.txt", "plain" }, { "..", "" } }, 1000);
+
+	for (vp_access_mode mode : { VP_READ_WRITE, VP_READ_ONLY }) {
+		vp_index idx;
+		ASSERT_TRUE(idx.parse(test_vp_path.string(), mode));
+		vp_file* f = idx.find("packed.tbl");
+		ASSERT_TRUE(f);
+		EXPECT_TRUE(f->is_compressed());
+		EXPECT_FALSE(idx.find("plain.txt")->is_compressed());
+		EXPECT_EQ(f->dump(), data);
+		char buf[100];
+		ASSERT_TRUE(f->read(200, 100, buf));
+		EXPECT_EQ(std::string(buf, 100), data.substr(200, 100));
+		ASSERT_TRUE(idx.find("plain.txt")->read(1, 3, buf));
+		EXPECT_EQ(std::string(buf, 3), "lai");
+
+		idx.set_raw(true);
+		EXPECT_FALSE(f->is_compressed());
+		EXPECT_EQ(f->dump(), packed);
+	}
+
+	vp_index idx;
+	ASSERT_TRUE(idx.parse(test_vp_path.string(), VP_READ_ONLY));
+	for (unsigned jobs : { 1u, 4u }) {
+		scoped_tempdir tmpd("test-");
+		ASSERT_TRUE(tmpd);
+		ASSERT_TRUE(idx.dump(tmpd.get_path().string(), jobs));
+		std::ifstream in(tmpd / "data/packed.tbl", std::ios::binary);
+		std::string extracted((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		EXPECT_EQ(extracted, data);
+
+		// Up-to-date checks compare against the decompressed contents
+		vp_extract_stats stats;
+		ASSERT_TRUE(idx.dump(tmpd.get_path().string(), jobs, nullptr, VP_SKIP_IDENTICAL, &stats));
+		EXPECT_EQ(stats.skipped, 2u);
+		ASSERT_TRUE(idx.dump(tmpd.get_path().string(), jobs, nullptr, VP_SKIP_UNCHANGED, &stats));
+		EXPECT_EQ(stats.skipped, 2u);
+	}
+}
@@ -0,0 +1,35 @@
+#include "../xxh64.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+
+// Test against the reference implementation's published values
+TEST(Xxh64Test, KnownValues)
+{
+	EXPECT_EQ(xxh64::hash("", 0), 0xEF46DB3751D8E999ULL);
+	EXPECT_EQ(xxh64::hash("a", 1), 0xD24EC4F1A98C6E5BULL);
+	EXPECT_EQ(xxh64::hash("abc", 3), 0x44BC2CF5AD770999ULL);
+	const char* spam = "Nobody inspects the spammish repetition";
+	EXPECT_EQ(xxh64::hash(spam, strlen(spam)), 0xFBCEA83C8A378BF1ULL);
+}
+
+// Test that hashing in pieces of any size gives the same answer as in one go
+TEST(Xxh64Test, IncrementalMatchesOneShot)
+{
+	std::string data(1000, '\0');
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (char)(i * 131 + 7);
+	}
+
+	for (size_t len : { 0, 5, 31, 32, 33, 100, 1000 }) {
+		uint64_t expected = xxh64::hash(data.data(), len, 42);
+		for (size_t piece : { 1, 3, 8, 31, 32, 64 }) {
+			xxh64 h(42);
+			for (size_t done = 0; done < len; done += piece) {
+				h.update(data.data() + done, std::min(piece, len - done));
+			}
+			EXPECT_EQ(h.digest(), expected) << "length " << len << ", pieces of " << piece;
+		}
+	}
+	EXPECT_NE(xxh64::hash(data.data(), 100, 0), xxh64::hash(data.data(), 100, 1));
+}
@@ -0,0 +1,104 @@
+#include "thread_pool.h"
+
+thread_pool::thread_pool(unsigned num_threads)
+	: m_queues(num_threads ? num_threads : 1)
+{
+	for (unsigned i = 0; i < m_queues.size(); ++i) {
+		m_threads.emplace_back(&thread_pool::run, this, i);
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	wait();
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stopping = true;
+	}
+	m_work_available.notify_all();
+	for (auto& t : m_threads) {
+		t.join();
+	}
+}
+
+unsigned thread_pool::default_size()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	return n ? n : 1;
+}
+
+void thread_pool::submit(std::function<void()> task)
+{
+	// Count the task before it becomes visible, so the counters can never
+	// run behind a worker that picks it up straight away
+	unsigned q;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		q = m_next_queue++ % m_queues.size();
+		++m_pending;
+		++m_queued;
+	}
+	{
+		std::lock_guard<std::mutex> guard(m_queues[q].lock);
+		m_queues[q].tasks.push_back(std::move(task));
+	}
+	m_work_available.notify_one();
+}
+
+void thread_pool::wait()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_all_done.wait(guard, [this]() { return m_pending == 0; });
+}
+
+bool thread_pool::try_pop(unsigned id, std::function<void()>& task)
+{
+	// Our own queue first, oldest task first
+	{
+		worker_queue& own = m_queues[id];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.front());
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	// Then steal the newest task from someone else
+	for (unsigned i = 1; i < m_queues.size(); ++i) {
+		worker_queue& victim = m_queues[(id + i) % m_queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.back());
+			victim.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void thread_pool::run(unsigned id)
+{
+	for (;;) {
+		std::function<void()> task;
+		if (try_pop(id, task)) {
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				--m_queued;
+			}
+			task();
+
+			std::lock_guard<std::mutex> guard(m_lock);
+			if (--m_pending == 0) {
+				m_all_done.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(m_lock);
+		m_work_available.wait(guard, [this]() { return m_stopping || m_queued > 0; });
+		if (m_stopping && m_queued == 0) {
+			return;
+		}
+	}
+}
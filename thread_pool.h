@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed-size pool of worker threads with work stealing.
+ *
+ * Each worker has its own task queue and submitted tasks are dealt out to the
+ * queues in turn. A worker takes tasks from the front of its own queue; once
+ * that runs dry it steals from the back of the other workers' queues, so a
+ * worker that drew slow tasks doesn't hold up the rest.
+ *
+ * Callers submit batches of roughly even size in the order they would be done
+ * serially: vp_index::dump() hands out read_scheduler batches in package offset
+ * order, so the workers between them still move through the package more or
+ * less front to back; checksum(), verify() and diff() hand out runs of pieces
+ * adding up to about the same number of bytes; and a compressed build hands out
+ * a buffer's worth of LZ41 blocks at a time.
+ */
+class thread_pool {
+public:
+	/// Start the given number of workers (at least one)
+	explicit thread_pool(unsigned num_threads);
+
+	/// Waits for all outstanding tasks, then stops the workers
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	/// Queue a task to be run on one of the workers
+	void submit(std::function<void()> task);
+
+	/// Block until every submitted task has finished
+	void wait();
+
+	unsigned size() const { return m_threads.size(); }
+
+	/// A sensible number of workers for this machine
+	static unsigned default_size();
+
+private:
+	struct worker_queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void run(unsigned id);
+	bool try_pop(unsigned id, std::function<void()>& task);
+
+	std::vector<worker_queue> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_lock;
+	std::condition_variable m_work_available;
+	std::condition_variable m_all_done;
+	size_t m_queued = 0; // Tasks sitting in a queue
+	size_t m_pending = 0; // Tasks submitted but not yet finished
+	unsigned m_next_queue = 0;
+	bool m_stopping = false;
+};
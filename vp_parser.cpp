@@ -1,5 +1,23 @@
 #include "vp_parser.h"
-
+#include "buffer_pool.h"
+#include "checksum_manifest.h"
+#include "crc32c.h"
+#include "delta.h"
+#include "edit_manifest.h"
+#include "file_copy.h"
+#include "file_prefetcher.h"
+#include "lz4.h"
+#include "lz41.h"
+#include "mapped_file.h"
+#include "path_filter.h"
+#include "read_scheduler.h"
+#include "stream_writer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <ctime>
@@ -8,10 +26,17 @@
 #include <functional>
 #include <iostream>
 #include <list>
+#include <optional>
 #include <set>
 #include <sstream>
 #include <string>
 #include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 //////////////////////////////////////////////////////////////
 /// Pieces of a VP file used for parsing
@@ -31,17 +56,409 @@ struct vp_direntry {
 	int timestamp; // Time the file was last modified, in unix time.
 };
 
+// Sidecar index cache. The cache is only valid for the exact package it was
+// built from, identified by its size, modification time and header. The
+// arrays that follow the header are raw host-endian copies of the
+// vp_entry_table arrays, so the cache is not portable between machines.
+const char vp_cache_sig[4] = { 'V', 'P', 'I', 'C' };
+const uint32_t vp_cache_version = 2;
+
+struct vp_cache_key {
+	uint64_t package_size;
+	int64_t package_mtime; // Nanoseconds since the file clock's epoch
+	vp_header package_header;
+};
+
+// Binary patch between two packages: a header, then operations that write
+// the new package front to back, ending with patch_end. A copy names a range
+// of the old package; a data operation is followed by its bytes.
+const char vp_patch_sig[8] = { 'V', 'P', 'P', 'A', 'T', 'C', 'H', '2' };
+
+struct vp_patch_header {
+	char sig[8]; // Always "VPPATCH2"
+	uint64_t old_size;
+	uint64_t new_size;
+	uint32_t old_index_crc; // CRC-32C of the old package's header and index
+	uint32_t new_index_crc; // Likewise for the new package
+	uint32_t new_crc; // CRC-32C of the whole new package
+	uint32_t reserved;
+};
+
+enum vp_patch_kind : uint32_t {
+	patch_copy = 'C',
+	patch_data = 'D',
+	patch_end = 'E',
+};
+
+struct vp_patch_op {
+	uint32_t kind; // A vp_patch_kind
+	uint32_t reserved;
+	uint64_t offset; // In the old package, for a copy
+	uint64_t size;
+};
+
+struct vp_cache_header {
+	char sig[4]; // Always "VPIC"
+	uint32_t version;
+	uint32_t entry_size; // sizeof(vp_entry), to catch layout changes
+	uint32_t lookup_size; // sizeof(vp_lookup_slot)
+	vp_cache_key key;
+	uint64_t num_entries;
+	uint64_t num_files;
+	uint64_t names_size;
+	uint64_t lookup_slots;
+};
+
+/////////////////////////////////////////////////////////////
+/// Lookup helpers
+
+// Turn a user-supplied name or path into a lookup key: lowercase, forward
+// slashes, and no leading "./" or "/"
+static std::string make_lookup_key(const std::string& name)
+{
+	std::string key;
+	key.reserve(name.size());
+	for (char c : name) {
+		key.push_back(c == '\\' ? '/' : (char)tolower((unsigned char)c));
+	}
+
+	size_t start = 0;
+	while (start < key.size()) {
+		if (key.compare(start, 2, "./") == 0) {
+			start += 2;
+		} else if (key[start] == '/') {
+			++start;
+		} else {
+			break;
+		}
+	}
+	return key.substr(start);
+}
+
+// FNV-1a over the lowercased input. It can be fed incrementally, which lets
+// parse() build up path hashes one directory at a time.
+static const uint32_t fnv_basis = 2166136261u;
+
+static inline uint32_t hash_lower(uint32_t hash, std::string_view s)
+{
+	for (char c : s) {
+		hash ^= (unsigned char)tolower((unsigned char)c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Compare a name against an already-lowercased key
+static inline bool lower_equals(std::string_view name, std::string_view key)
+{
+	if (name.size() != key.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < name.size(); ++i) {
+		if (tolower((unsigned char)name[i]) != key[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Put an entry into the first free slot for its hash
+static void insert_slot(std::vector<vp_lookup_slot>& table, uint32_t hash, uint32_t id)
+{
+	size_t mask = table.size() - 1;
+	size_t i = hash & mask;
+	while (table[i].entry != vp_entry::none) {
+		i = (i + 1) & mask;
+	}
+	table[i] = { hash, id };
+}
+
+/////////////////////////////////////////////////////////////
+/// vp_entry_table methods
+
+void vp_entry_table::reserve(uint32_t num_dirs, uint32_t num_files, size_t name_bytes)
+{
+	// The root directory isn't in the package index, so make room for it too
+	entries.reserve(entries.size() + num_dirs + num_files + 1);
+	dirs.reserve(dirs.size() + num_dirs + 1);
+	files.reserve(files.size() + num_files);
+	names.reserve(names.size() + name_bytes + 2);
+	name_chain.reserve(files.capacity());
+	path_chain.reserve(files.capacity());
+	m_last_child.reserve(dirs.capacity());
+
+	// Keep the lookup tables at most half full
+	size_t slots = 8;
+	while (slots < 2 * files.capacity()) {
+		slots *= 2;
+	}
+	if (slots > name_lookup.size()) {
+		rehash(slots);
+	}
+}
+
+uint32_t vp_entry_table::add(std::string_view name,
+	uint32_t parent,
+	bool is_directory,
+	uint32_t offset,
+	uint32_t size,
+	uint32_t timestamp,
+	uint32_t ordinal)
+{
+	uint32_t id = entries.size();
+	vp_entry& e = entries.emplace_back();
+	e.name = names.size();
+	names.append(name);
+	names.push_back('\0');
+	e.parent = parent;
+	e.offset = offset;
+	e.size = size;
+	e.timestamp = timestamp;
+	e.ordinal = ordinal;
+	e.is_directory = is_directory;
+
+	if (is_directory) {
+		e.node = dirs.size();
+		dirs.emplace_back(this, id);
+		m_last_child.push_back(vp_entry::none);
+	} else {
+		e.node = files.size();
+		files.emplace_back(this, id);
+	}
+
+	// Link it in as the last child of its parent
+	if (parent != vp_entry::none) {
+		uint32_t& last = m_last_child[entries[parent].node];
+		if (last == vp_entry::none) {
+			entries[parent].first_child = id;
+		} else {
+			entries[last].next_sibling = id;
+		}
+		last = id;
+	}
+	return id;
+}
+
+std::string_view vp_entry_table::get_name(uint32_t id) const
+{
+	return names.c_str() + entries[id].name;
+}
+
+vp_node* vp_entry_table::get_node(uint32_t id)
+{
+	const vp_entry& e = entries[id];
+	if (e.is_directory) {
+		return &dirs[e.node];
+	}
+	return &files[e.node];
+}
+
+bool vp_entry_table::rebuild_nodes()
+{
+	dirs.clear();
+	files.clear();
+	m_last_child.clear();
+	if (entries.empty() || names.empty() || names.back() != '\0') {
+		return false;
+	}
+
+	uint32_t num_dirs = 0;
+	for (const vp_entry& e : entries) {
+		num_dirs += e.is_directory;
+	}
+	dirs.reserve(num_dirs);
+	files.reserve(entries.size() - num_dirs);
+	m_last_child.resize(num_dirs, vp_entry::none);
+
+	for (uint32_t id = 0; id < entries.size(); ++id) {
+		vp_entry& e = entries[id];
+
+		// Parents always come before their children, and links must stay in bounds
+		bool linked_ok = (id == 0) ? e.parent == vp_entry::none : e.parent < id && entries[e.parent].is_directory;
+		for (uint32_t link : { e.first_child, e.next_sibling }) {
+			linked_ok &= (link == vp_entry::none || (link > id && link < entries.size()));
+		}
+		if (!linked_ok || e.name >= names.size()) {
+			dirs.clear();
+			files.clear();
+			return false;
+		}
+
+		if (e.is_directory) {
+			e.node = dirs.size();
+			dirs.emplace_back(this, id);
+		} else {
+			e.node = files.size();
+			files.emplace_back(this, id);
+		}
+		// Children are stored in order, so the last one seen is the last child
+		if (e.parent != vp_entry::none) {
+			m_last_child[entries[e.parent].node] = id;
+		}
+	}
+
+	m_lookup_count = files.size();
+	return true;
+}
+
+void vp_entry_table::add_lookup(uint32_t id, uint32_t name_hash, uint32_t path_hash)
+{
+	if (2 * (m_lookup_count + 1) > name_lookup.size()) {
+		rehash(std::max<size_t>(8, 2 * name_lookup.size()));
+	}
+	name_chain.resize(files.size(), vp_entry::none);
+	path_chain.resize(files.size(), vp_entry::none);
+	insert(name_lookup, name_chain, name_hash, id, [this](uint32_t a, uint32_t b) { return name_matches(a, b); });
+	insert(path_lookup, path_chain, path_hash, id, [this](uint32_t a, uint32_t b) { return path_matches(a, b); });
+	++m_lookup_count;
+}
+
+template <typename Equal>
+void vp_entry_table::insert(std::vector<vp_lookup_slot>& table,
+	std::vector<uint32_t>& chain,
+	uint32_t hash,
+	uint32_t id,
+	Equal equal)
+{
+	size_t mask = table.size() - 1;
+	size_t i = hash & mask;
+	for (; table[i].entry != vp_entry::none; i = (i + 1) & mask) {
+		if (table[i].hash == hash && equal(table[i].entry, id)) {
+			// Same key as an existing file; chain it in front of that one
+			chain[entries[id].node] = table[i].entry;
+			table[i].entry = id;
+			return;
+		}
+	}
+	table[i] = { hash, id };
+}
+
+bool vp_entry_table::name_matches(uint32_t a, uint32_t b) const
+{
+	std::string_view name_a = get_name(a);
+	std::string_view name_b = get_name(b);
+	if (name_a.size() != name_b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < name_a.size(); ++i) {
+		if (tolower((unsigned char)name_a[i]) != tolower((unsigned char)name_b[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool vp_entry_table::path_matches(uint32_t a, uint32_t b) const
+{
+	// Two paths match if every name matches on the way up to the root
+	while (a != vp_entry::none && b != vp_entry::none) {
+		if (a == b) {
+			return true;
+		}
+		if (!name_matches(a, b)) {
+			return false;
+		}
+		a = entries[a].parent;
+		b = entries[b].parent;
+	}
+	return a == b;
+}
+
+void vp_entry_table::rehash(size_t slots)
+{
+	for (auto* table : { &name_lookup, &path_lookup }) {
+		std::vector<vp_lookup_slot> old(slots);
+		old.swap(*table);
+		for (const auto& slot : old) {
+			if (slot.entry != vp_entry::none) {
+				insert_slot(*table, slot.hash, slot.entry);
+			}
+		}
+	}
+}
+
+bool vp_entry_table::path_matches(uint32_t id, std::string_view key) const
+{
+	// Walk up from the entry, peeling names off the end of the key
+	size_t end = key.size();
+	for (;;) {
+		std::string_view name = get_name(id);
+		if (end < name.size() || !lower_equals(name, key.substr(end - name.size(), name.size()))) {
+			return false;
+		}
+		end -= name.size();
+
+		id = entries[id].parent;
+		if (entries[id].parent == vp_entry::none) {
+			// Reached the root, which isn't part of the path
+			return end == 0;
+		}
+		if (end == 0 || key[end - 1] != '/') {
+			return false;
+		}
+		--end;
+	}
+}
+
+std::vector<uint32_t> vp_entry_table::lookup(const std::string& key) const
+{
+	// Anything with a slash in it is a path; everything else is a bare name
+	bool is_path = key.find('/') != std::string::npos;
+	const auto& table = is_path ? path_lookup : name_lookup;
+
+	std::vector<uint32_t> matches;
+	if (table.empty()) {
+		return matches;
+	}
+
+	uint32_t hash = hash_lower(fnv_basis, key);
+	size_t mask = table.size() - 1;
+	for (size_t i = hash & mask; table[i].entry != vp_entry::none; i = (i + 1) & mask) {
+		const vp_lookup_slot& slot = table[i];
+		if (slot.hash != hash) {
+			continue;
+		}
+		if (is_path ? path_matches(slot.entry, key) : lower_equals(get_name(slot.entry), key)) {
+			// Each key has a single slot, so this is the only chain to walk
+			const auto& chain = is_path ? path_chain : name_chain;
+			for (uint32_t id = slot.entry; id != vp_entry::none; id = chain[entries[id].node]) {
+				matches.push_back(id);
+			}
+			break;
+		}
+	}
+
+	// Chains run newest first; entry ids are in index order
+	std::sort(matches.begin(), matches.end());
+	return matches;
+}
+
 /////////////////////////////////////////////////////////////
 /// vp_index methods
 
 vp_index::~vp_index()
 {
-	if (m_root) {
-		delete m_root;
+	reset();
+}
+
+void vp_index::reset()
+{
+	if (m_table) {
+		delete m_table;
+		m_table = nullptr;
 	}
 	if (m_filestream) {
 		m_filestream->close();
 		delete m_filestream;
+		m_filestream = nullptr;
+	}
+	if (m_mapping) {
+		delete m_mapping;
+		m_mapping = nullptr;
+	}
+	if (m_package_fd >= 0) {
+		::close(m_package_fd);
+		m_package_fd = -1;
 	}
 }
 
@@ -50,27 +467,184 @@ std::string vp_index::to_string() const
 	return m_filename;
 }
 
-bool vp_index::parse(const std::string& path)
+void vp_index::set_raw(bool raw)
 {
-	vp_header header;
-	m_filestream = new std::fstream(path, std::ios::in | std::ios::out | std::ios::binary);
-	m_filestream->read((char*)&header, sizeof(header));
+	m_raw = raw;
+	if (m_table) {
+		m_table->raw = raw;
+	}
+}
+
+std::string vp_index::get_cache_path(const std::string& vp_filename, const std::string& cache)
+{
+	std::error_code err;
+	if (!std::filesystem::is_directory(cache, err)) {
+		return cache;
+	}
+
+	// Packages with the same name in different directories get their own
+	// sidecars, told apart by a hash of the package's full path
+	std::filesystem::path package = std::filesystem::absolute(vp_filename, err);
+	std::stringstream name;
+	name << package.filename().string() << '-' << std::hex << hash_lower(fnv_basis, package.string()) << ".idx";
+	return (std::filesystem::path(cache) / name.str()).string();
+}
+
+bool vp_index::load_cache(const std::string& cache_path, const vp_cache_key& key)
+{
+	mapped_file cache;
+	vp_cache_header hdr;
+	if (!cache.open(cache_path) || cache.size() < sizeof(hdr)) {
+		return false;
+	}
+	memcpy(&hdr, cache.data().data(), sizeof(hdr));
+
+	if (memcmp(hdr.sig, vp_cache_sig, sizeof(hdr.sig)) != 0 || hdr.version != vp_cache_version
+		|| hdr.entry_size != sizeof(vp_entry) || hdr.lookup_size != sizeof(vp_lookup_slot)
+		|| memcmp(&hdr.key, &key, sizeof(key)) != 0) {
+		// Stale, or from some other build of vptool
+		return false;
+	}
 
-	if (!*m_filestream) {
-		std::cerr << "Error while reading file " << path << std::endl;
+	// Slice up the rest of the file, making sure it's all there
+	uint64_t pos = sizeof(hdr);
+	auto take = [&cache, &pos](uint64_t count, uint64_t size) {
+		std::span<const std::byte> chunk;
+		if (count <= cache.size() / size) {
+			chunk = cache.subspan(pos, count * size);
+			pos += chunk.size();
+		}
+		return chunk;
+	};
+	auto entries = take(hdr.num_entries, sizeof(vp_entry));
+	auto names = take(hdr.names_size, 1);
+	auto name_lookup = take(hdr.lookup_slots, sizeof(vp_lookup_slot));
+	auto path_lookup = take(hdr.lookup_slots, sizeof(vp_lookup_slot));
+	auto name_chain = take(hdr.num_files, sizeof(uint32_t));
+	auto path_chain = take(hdr.num_files, sizeof(uint32_t));
+	if (pos != cache.size() || entries.size() != hdr.num_entries * sizeof(vp_entry)
+		|| hdr.lookup_slots == 0 || (hdr.lookup_slots & (hdr.lookup_slots - 1)) != 0) {
+		return false;
+	}
+
+	vp_entry_table* table = new vp_entry_table();
+	table->filestream = m_filestream;
+	table->mapping = m_mapping;
+	table->package_fd = m_mapping ? m_mapping->fd() : m_package_fd;
+	table->raw = m_raw;
+	auto copy_into = [](auto& vec, std::span<const std::byte> chunk) {
+		vec.resize(chunk.size() / sizeof(vec[0]));
+		memcpy(vec.data(), chunk.data(), chunk.size());
+	};
+	copy_into(table->entries, entries);
+	copy_into(table->names, names);
+	copy_into(table->name_lookup, name_lookup);
+	copy_into(table->path_lookup, path_lookup);
+	copy_into(table->name_chain, name_chain);
+	copy_into(table->path_chain, path_chain);
+
+	if (!table->rebuild_nodes() || table->files.size() != hdr.num_files) {
+		delete table;
 		return false;
 	}
+	for (const auto* lookup : { &table->name_lookup, &table->path_lookup }) {
+		for (const vp_lookup_slot& slot : *lookup) {
+			if (slot.entry != vp_entry::none && (slot.entry >= table->entries.size() || table->entries[slot.entry].is_directory)) {
+				delete table;
+				return false;
+			}
+		}
+	}
+	for (const auto* chain : { &table->name_chain, &table->path_chain }) {
+		for (uint32_t id : *chain) {
+			if (id != vp_entry::none && (id >= table->entries.size() || table->entries[id].is_directory)) {
+				delete table;
+				return false;
+			}
+		}
+	}
+
+	m_table = table;
+	return true;
+}
+
+bool vp_index::save_cache(const std::string& cache_path, const vp_cache_key& key) const
+{
+	vp_cache_header hdr;
+	memcpy(hdr.sig, vp_cache_sig, sizeof(hdr.sig));
+	hdr.version = vp_cache_version;
+	hdr.entry_size = sizeof(vp_entry);
+	hdr.lookup_size = sizeof(vp_lookup_slot);
+	hdr.key = key;
+	hdr.num_entries = m_table->entries.size();
+	hdr.num_files = m_table->files.size();
+	hdr.names_size = m_table->names.size();
+	hdr.lookup_slots = m_table->name_lookup.size();
+
+	// Write to a temporary file and rename it into place, so that a reader
+	// never sees a half-written cache
+	std::string tmp_path = cache_path + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream out(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		auto write_vec = [&out](const auto& vec) {
+			out.write((const char*)vec.data(), vec.size() * sizeof(vec[0]));
+		};
+		out.write((const char*)&hdr, sizeof(hdr));
+		write_vec(m_table->entries);
+		write_vec(m_table->names);
+		write_vec(m_table->name_lookup);
+		write_vec(m_table->path_lookup);
+		write_vec(m_table->name_chain);
+		write_vec(m_table->path_chain);
+		if (!out) {
+			std::error_code err;
+			std::filesystem::remove(tmp_path, err);
+			return false;
+		}
+	}
+
+	std::error_code err;
+	std::filesystem::rename(tmp_path, cache_path, err);
+	return !err;
+}
+
+bool vp_index::parse(const std::string& path, vp_access_mode mode, const std::string& cache_path)
+{
+	vp_header header;
+	std::streampos file_size;
+
+	if (mode == VP_READ_ONLY) {
+		m_mapping = new mapped_file();
+		if (!m_mapping->open(path) || m_mapping->size() < sizeof(header)) {
+			std::cerr << "Error while reading file " << path << std::endl;
+			return false;
+		}
+		memcpy(&header, m_mapping->data().data(), sizeof(header));
+		file_size = m_mapping->size();
+	} else {
+		m_filestream = new std::fstream(path, std::ios::in | std::ios::out | std::ios::binary);
+		m_filestream->read((char*)&header, sizeof(header));
+
+		// Extraction reads payloads with positional I/O on a descriptor of its
+		// own; index updates are written through it the same way
+		m_package_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+		if (!*m_filestream) {
+			std::cerr << "Error while reading file " << path << std::endl;
+			return false;
+		}
+
+		// Get file size for validation
+		m_filestream->seekg(0, std::ios::end);
+		file_size = m_filestream->tellg();
+		m_filestream->seekg(0, std::ios::beg);
+	}
 
 	if (*(uint32_t*)&header.header != vp_sig) {
 		std::cerr << path << ": File signature incorrect: " << header.header << std::endl;
 		return false;
 	}
 
-	// Get file size for validation
-	m_filestream->seekg(0, std::ios::end);
-	std::streampos file_size = m_filestream->tellg();
-	m_filestream->seekg(0, std::ios::beg);
-
 	// Validate header fields
 	if (header.diroffset < 0 || header.diroffset >= file_size) {
 		std::cerr << path << ": Invalid directory offset: " << header.diroffset << std::endl;
@@ -90,70 +664,165 @@ bool vp_index::parse(const std::string& path)
 	}
 
 	m_filename = path;
+	m_diroffset = header.diroffset;
+
+	vp_cache_key cache_key;
+	if (!cache_path.empty()) {
+		memset(&cache_key, 0, sizeof(cache_key));
+		std::error_code err;
+		auto mtime = std::filesystem::last_write_time(path, err);
+		cache_key.package_size = file_size;
+		cache_key.package_mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+		cache_key.package_header = header;
+
+		if (!err && load_cache(cache_path, cache_key)) {
+			return true;
+		}
+	}
+
+	// Pull in the whole directory block in one go and parse it from memory.
+	// Mapped packages already have it in memory; otherwise it's a single read.
+	const std::byte* index_data = nullptr;
+	std::vector<vp_direntry> index_buf;
+	if (m_mapping) {
+		index_data = m_mapping->data().data() + header.diroffset;
+	} else {
+		index_buf.resize(header.direntries);
+		m_filestream->seekg(header.diroffset);
+		m_filestream->read((char*)index_buf.data(), index_size);
+		if (!*m_filestream) {
+			std::cerr << path << ": Could not read directory index\n";
+			return false;
+		}
+		index_data = (const std::byte*)index_buf.data();
+	}
+
+	// The index is not necessarily aligned in a mapped package, so copy each
+	// entry out rather than pointing into the block
+	auto read_entry = [index_data](int i, vp_direntry& entry) {
+		memcpy(&entry, index_data + i * sizeof(entry), sizeof(entry));
+		entry.name[sizeof(entry.name) - 1] = '\0';
+	};
+
+	// Size everything up first so the entry table is allocated in one go
+	uint32_t num_dirs = 0;
+	uint32_t num_files = 0;
+	size_t name_bytes = 0;
+	for (int i = 0; i < header.direntries; ++i) {
+		vp_direntry entry;
+		read_entry(i, entry);
+		if (entry.size != 0) {
+			++num_files;
+		} else if (strcmp(entry.name, "..") != 0) {
+			++num_dirs;
+		}
+		name_bytes += strlen(entry.name) + 1;
+	}
+
+	m_table = new vp_entry_table();
+	m_table->filestream = m_filestream;
+	m_table->mapping = m_mapping;
+	m_table->package_fd = m_mapping ? m_mapping->fd() : m_package_fd;
+	m_table->raw = m_raw;
+	m_table->reserve(num_dirs, num_files, name_bytes);
+
 	// Create the root node
-	m_root = new vp_directory(".", 0, nullptr);
+	uint32_t current = m_table->add(".", vp_entry::none, true, 0, 0, 0, vp_entry::none);
 
-	// Seek to the index
-	m_filestream->seekg(header.diroffset);
+	// Lookup hash of each open directory's lowercased path, with a trailing slash
+	std::vector<uint32_t> path_hashes { fnv_basis };
 
-	// Now read in each entry one by one
-	vp_directory* current = m_root;
 	for (int i = 0; i < header.direntries; ++i) {
 		vp_direntry entry;
-		m_filestream->read((char*)&entry, sizeof(entry));
+		read_entry(i, entry);
 
 		// Check if directory
 		if (entry.size == 0) {
 			// Am I an updir?
 			if (entry.name[0] == '.' && entry.name[1] == '.' && entry.name[2] == '\0') {
-				current = current->get_parent();
-				if (!current) {
+				current = m_table->entries[current].parent;
+				if (current == vp_entry::none) {
 					std::cerr << path << ": Unexpected updir; already at top level!\n";
-					delete m_root;
-					m_root = nullptr;
+					delete m_table;
+					m_table = nullptr;
 					return false;
 				}
+				path_hashes.pop_back();
 			} else {
 				// Not an updir; create a new directory node
-				vp_directory* new_dir = new vp_directory(entry.name, entry.timestamp, current);
-				current->add_child(new_dir);
-				current = new_dir;
+				current = m_table->add(entry.name, current, true, 0, 0, entry.timestamp, i);
+				path_hashes.push_back(hash_lower(hash_lower(path_hashes.back(), entry.name), "/"));
 			}
 		} else {
 			// Not a directory - validate file offset and size
 			if (entry.offset < 0 || entry.size < 0) {
 				std::cerr << path << ": Invalid offset or size for file " << entry.name << std::endl;
-				delete m_root;
-				m_root = nullptr;
+				delete m_table;
+				m_table = nullptr;
 				return false;
 			}
 
 			std::streampos file_end = static_cast<std::streampos>(entry.offset) + static_cast<std::streampos>(entry.size);
 			if (file_end > file_size) {
 				std::cerr << path << ": File " << entry.name << " extends beyond package size\n";
-				delete m_root;
-				m_root = nullptr;
+				delete m_table;
+				m_table = nullptr;
 				return false;
 			}
 
-			vp_file* new_file = new vp_file(entry.name,
-				entry.offset,
-				entry.size,
-				entry.timestamp,
-				current,
-				m_filestream);
-			current->add_child(new_file);
+			uint32_t id = m_table->add(entry.name, current, false, entry.offset, entry.size, entry.timestamp, i);
+			m_table->add_lookup(id, hash_lower(fnv_basis, entry.name), hash_lower(path_hashes.back(), entry.name));
 		}
 	}
 
+	if (!cache_path.empty() && !save_cache(cache_path, cache_key)) {
+		std::cerr << "Warning: could not write index cache " << cache_path << std::endl;
+	}
+
 	return true;
 }
 
+std::vector<vp_file*> vp_index::find_all(const std::string& name) const
+{
+	std::vector<vp_file*> matches;
+	if (m_table) {
+		for (uint32_t id : m_table->lookup(make_lookup_key(name))) {
+			matches.push_back(&m_table->files[m_table->entries[id].node]);
+		}
+	}
+	return matches;
+}
+
 vp_file* vp_index::find(const std::string& name) const
 {
-	if (m_root) {
-		return m_root->find(name);
+	std::vector<vp_file*> matches = find_all(name);
+	if (matches.size() == 1) {
+		return matches.front();
+	}
+	if (matches.empty()) {
+		return nullptr;
 	}
+
+	// More than one candidate. An exact-case match breaks the tie if there is
+	// exactly one of those.
+	vp_file* exact = nullptr;
+	size_t exact_count = 0;
+	for (vp_file* f : matches) {
+		std::string path = f->get_path();
+		if (f->get_name() == name || path.ends_with("/" + name)) {
+			exact = f;
+			++exact_count;
+		}
+	}
+	if (exact_count == 1) {
+		return exact;
+	}
+
+	std::cerr << name << " is ambiguous in " << m_filename << "; it matches:\n";
+	for (vp_file* f : matches) {
+		std::cerr << "   " << f->get_path() << "\n";
+	}
+	std::cerr << "Use the full path to pick one.\n";
 	return nullptr;
 }
 
@@ -175,223 +844,1799 @@ std::string vp_index::print_index_listing() const
 	};
 
 	// Apply to root node (which will recurse down the tree depth-wise)
-	if (m_root) {
-		m_root->foreach_child(print_func);
+	if (m_table) {
+		m_table->get_root()->foreach_child(print_func);
+	}
+	return ss.str();
+}
+
+bool vp_index::shares_data(const vp_file* file) const
+{
+	const vp_entry& mine = m_table->entries[file->get_id()];
+	for (uint32_t id = 0; id < m_table->entries.size(); ++id) {
+		const vp_entry& other = m_table->entries[id];
+		if (id != file->get_id() && !other.is_directory && other.size > 0
+			&& other.offset < mine.offset + mine.size && mine.offset < other.offset + other.size) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool vp_index::update_index(const vp_node* node) const
+{
+	return update_index(std::vector<const vp_node*> { node });
+}
+
+bool vp_index::update_index(const std::vector<const vp_node*>& nodes) const
+{
+	if (!m_filestream || !m_table) {
+		std::cerr << "Cannot update index entries in " << m_filename << ": package is open read-only\n";
+		return false;
+	}
+
+	// New entries in index order, so neighbours can go out together
+	std::vector<std::pair<uint32_t, vp_direntry>> updates;
+	for (const vp_node* node : nodes) {
+		uint32_t ordinal = m_table->entries[node->get_id()].ordinal;
+		if (ordinal == vp_entry::none) {
+			std::cerr << "Cannot update index entry for " << node->get_path() << ": it isn't in the index\n";
+			return false;
+		}
+		vp_direntry entry;
+		node->to_direntry(&entry);
+		updates.emplace_back(ordinal, entry);
+	}
+	std::sort(updates.begin(), updates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	// Anything the stream is still holding has to land first, or it could
+	// overwrite what's written here
+	m_filestream->flush();
+
+	std::vector<vp_direntry> run;
+	for (size_t i = 0; i < updates.size();) {
+		uint32_t first = updates[i].first;
+		run.clear();
+		for (; i < updates.size() && updates[i].first <= first + run.size(); ++i) {
+			if (updates[i].first == first + run.size()) {
+				run.push_back(updates[i].second);
+			} else {
+				run.back() = updates[i].second; // The same node twice
+			}
+		}
+		if (!pwrite_all(m_package_fd, run.data(), run.size() * sizeof(vp_direntry), m_diroffset + (uint64_t)first * sizeof(vp_direntry))) {
+			std::cerr << "Error while updating index entries in " << m_filename << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Read a package's header and index straight from its descriptor
+static bool read_raw_index(int fd, vp_header& header, std::vector<vp_direntry>& index)
+{
+	if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.direntries < 0) {
+		return false;
+	}
+	index.resize(header.direntries);
+	size_t index_size = index.size() * sizeof(vp_direntry);
+	return ::pread(fd, index.data(), index_size, header.diroffset) == (ssize_t)index_size;
+}
+
+bool vp_index::append_file(vp_file* file, const std::filesystem::path& newfile)
+{
+	if (!m_filestream) {
+		std::cerr << "Cannot replace " << file->get_path() << ": package is open read-only\n";
+		return false;
+	}
+
+	// Everything below goes around the stream, so it mustn't be holding
+	// anything back
+	m_filestream->flush();
+
+	int in = ::open(newfile.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (in < 0 || fstat(in, &st) != 0) {
+		std::cerr << "Could not open file " << newfile << " for reading\n";
+		if (in >= 0) {
+			::close(in);
+		}
+		return false;
+	}
+	int out = ::open(m_filename.c_str(), O_RDWR | O_CLOEXEC);
+	if (out < 0) {
+		std::cerr << "Could not open " << m_filename << " for writing\n";
+		::close(in);
+		return false;
+	}
+
+	auto fail = [in, out](const std::string& why) {
+		std::cerr << why << std::endl;
+		::close(in);
+		::close(out);
+		return false;
+	};
+
+	// Work from the index as it is on disk
+	vp_header header;
+	std::vector<vp_direntry> index;
+	if (!read_raw_index(out, header, index)) {
+		return fail("Could not read the index of " + m_filename);
+	}
+	size_t index_size = index.size() * sizeof(vp_direntry);
+
+	size_t ordinal = m_table->entries[file->get_id()].ordinal;
+	if (ordinal >= index.size()) {
+		return fail("Could not find the index entry for " + file->get_path());
+	}
+
+	// The new data goes after everything that's there now, followed by a
+	// fresh copy of the index. Offsets in the format are signed 32-bit.
+	off_t end = ::lseek(out, 0, SEEK_END);
+	if (end < 0 || (uint64_t)end + st.st_size + index_size > INT32_MAX) {
+		return fail("Not enough room left in " + m_filename + " for " + newfile.string());
+	}
+	index[ordinal].offset = end;
+	index[ordinal].size = st.st_size;
+	index[ordinal].timestamp = st.st_mtime;
+
+	// The header is only switched over to the new index once the data and the
+	// index are safely on disk. A crash before then leaves the package as it
+	// was, with some junk at the end; nothing already there is overwritten.
+	header.diroffset = end + st.st_size;
+	if (!copy_range(in, 0, st.st_size, out) || !write_all(out, index.data(), index_size) || ::fdatasync(out) != 0) {
+		return fail("Could not append " + newfile.string() + " to " + m_filename);
+	}
+	if (!pwrite_all(out, &header, sizeof(header), 0) || ::fdatasync(out) != 0) {
+		return fail("Could not update the header of " + m_filename);
+	}
+
+	::close(in);
+	::close(out);
+
+	m_diroffset = header.diroffset;
+	vp_entry& entry = m_table->entries[file->get_id()];
+	entry.offset = index[ordinal].offset;
+	entry.size = index[ordinal].size;
+	entry.timestamp = index[ordinal].timestamp;
+	return true;
+}
+
+// A package's directory tree in a form that's easy to rearrange, for
+// apply_edits(). Node ids match the ids in a freshly parsed entry table.
+struct edit_node {
+	std::string name;
+	bool is_directory = false;
+	uint32_t parent = vp_entry::none;
+	std::vector<uint32_t> children;
+	vp_direntry entry { 0, 0, {}, 0 };
+	std::string source; // File to take new contents from, if any
+	int source_fd = -1; // source, opened while checking the edits
+	uint64_t source_size = 0;
+	int64_t source_mtime = 0;
+};
+
+static bool same_name(std::string_view a, std::string_view b)
+{
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+		return tolower((unsigned char)x) == tolower((unsigned char)y);
+	});
+}
+
+// Split an internal path into its components
+static std::vector<std::string> split_path(const std::string& path)
+{
+	std::vector<std::string> parts;
+	std::string part;
+	for (char c : path + "/") {
+		if (c == '/' || c == '\\') {
+			if (!part.empty()) {
+				parts.push_back(part);
+			}
+			part.clear();
+		} else {
+			part += c;
+		}
+	}
+	return parts;
+}
+
+// Child of dir with the given name, preferring one whose case matches exactly
+static uint32_t find_child(const std::vector<edit_node>& nodes, uint32_t dir, std::string_view name)
+{
+	uint32_t found = vp_entry::none;
+	for (uint32_t child : nodes[dir].children) {
+		if (nodes[child].name == name) {
+			return child;
+		}
+		if (found == vp_entry::none && same_name(nodes[child].name, name)) {
+			found = child;
+		}
+	}
+	return found;
+}
+
+// The node at a full internal path, or none
+static uint32_t resolve(const std::vector<edit_node>& nodes, const std::vector<std::string>& parts)
+{
+	uint32_t id = 0;
+	for (const std::string& part : parts) {
+		if (!nodes[id].is_directory || (id = find_child(nodes, id, part)) == vp_entry::none) {
+			return vp_entry::none;
+		}
+	}
+	return parts.empty() ? vp_entry::none : id;
+}
+
+// The directory that should hold the file at parts, created if need be. Sets
+// error and returns none if the way is blocked by a file.
+static uint32_t make_parent(std::vector<edit_node>& nodes, const std::vector<std::string>& parts, std::string& error)
+{
+	uint32_t dir = 0;
+	for (size_t i = 0; i + 1 < parts.size(); ++i) {
+		uint32_t next = find_child(nodes, dir, parts[i]);
+		if (next == vp_entry::none) {
+			if (parts[i].size() >= sizeof(vp_direntry::name)) {
+				error = "directory name " + parts[i] + " is too long";
+				return vp_entry::none;
+			}
+			next = nodes.size();
+			edit_node& node = nodes.emplace_back();
+			node.name = parts[i];
+			node.is_directory = true;
+			node.parent = dir;
+			node.entry.timestamp = time(nullptr);
+			nodes[dir].children.push_back(next);
+		} else if (!nodes[next].is_directory) {
+			error = parts[i] + " is a file";
+			return vp_entry::none;
+		}
+		dir = next;
+	}
+	return dir;
+}
+
+static void detach(std::vector<edit_node>& nodes, uint32_t id)
+{
+	std::vector<uint32_t>& siblings = nodes[nodes[id].parent].children;
+	siblings.erase(std::find(siblings.begin(), siblings.end(), id));
+}
+
+static void close_source(edit_node& node)
+{
+	if (node.source_fd >= 0) {
+		::close(node.source_fd);
+		node.source_fd = -1;
+	}
+}
+
+// Open the file that's to become node's new contents and check it can be
+// stored, with the package ending at end. Sets error if not.
+static bool open_source(edit_node& node, const std::string& source, uint64_t end, std::string& error)
+{
+	close_source(node);
+	node.source = source;
+	node.source_fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (node.source_fd < 0 || fstat(node.source_fd, &st) != 0) {
+		error = "could not read " + source;
+		return false;
+	}
+	// A zero-size entry would read back as a directory
+	if (st.st_size == 0) {
+		error = source + " is empty";
+		return false;
+	}
+	if ((uint64_t)st.st_size > INT32_MAX - end) {
+		error = source + " is too big for the package";
+		return false;
+	}
+	node.source_size = st.st_size;
+	node.source_mtime = st.st_mtime;
+	return true;
+}
+
+bool vp_index::apply_edits(const std::vector<vp_edit>& edits)
+{
+	if (!m_filestream || !m_table) {
+		std::cerr << "Cannot edit " << m_filename << ": package is open read-only\n";
+		return false;
+	}
+	m_filestream->flush();
+
+	int out = ::open(m_filename.c_str(), O_RDWR | O_CLOEXEC);
+	if (out < 0) {
+		std::cerr << "Could not open " << m_filename << " for writing\n";
+		return false;
+	}
+	// Once new data is being appended, failing cuts the package back to
+	// where it ended, so nothing is left behind
+	std::vector<edit_node> nodes(1);
+	off_t end = -1;
+	bool appending = false;
+	auto fail = [out, &nodes, &end, &appending](const std::string& why) {
+		std::cerr << why << std::endl;
+		for (edit_node& node : nodes) {
+			close_source(node);
+		}
+		if (appending && ::ftruncate(out, end) != 0) {
+			std::cerr << "Could not remove the partly appended data" << std::endl;
+		}
+		::close(out);
+		return false;
+	};
+
+	vp_header header;
+	std::vector<vp_direntry> index;
+	if (!read_raw_index(out, header, index)) {
+		return fail("Could not read the index of " + m_filename);
+	}
+
+	end = ::lseek(out, 0, SEEK_END);
+	if (end < 0 || (uint64_t)end > INT32_MAX) {
+		return fail("Could not seek in " + m_filename);
+	}
+
+	// Rebuild the tree from the index
+	nodes[0].is_directory = true;
+	std::vector<uint32_t> open_dirs { 0 };
+	for (const vp_direntry& entry : index) {
+		std::string name(entry.name, strnlen(entry.name, sizeof(entry.name)));
+		if (entry.size == 0 && name == "..") {
+			if (open_dirs.size() > 1) {
+				open_dirs.pop_back();
+			}
+			continue;
+		}
+		uint32_t id = nodes.size();
+		edit_node& node = nodes.emplace_back();
+		node.name = name;
+		node.is_directory = entry.size == 0;
+		node.parent = open_dirs.back();
+		node.entry = entry;
+		nodes[node.parent].children.push_back(id);
+		if (node.is_directory) {
+			open_dirs.push_back(id);
+		}
+	}
+
+	// Apply every edit to the tree. Nothing is written until they've all
+	// been checked and every new file opened, so a bad manifest (or an
+	// unreadable source) leaves the package alone.
+	static const char* kind_names[] = { "replace", "add", "delete", "rename" };
+	for (size_t i = 0; i < edits.size(); ++i) {
+		const vp_edit& edit = edits[i];
+		std::string what = "Edit " + std::to_string(i + 1) + " (" + kind_names[edit.kind] + " " + edit.path + "): ";
+		std::vector<std::string> parts = split_path(edit.path);
+		uint32_t id = resolve(nodes, parts);
+		if (edit.kind != vp_edit::ADD && (id == vp_entry::none || nodes[id].is_directory)) {
+			return fail(what + "no such file in the package");
+		}
+
+		std::string error;
+		switch (edit.kind) {
+		case vp_edit::REPLACE:
+			if (!open_source(nodes[id], edit.arg, end, error)) {
+				return fail(what + error);
+			}
+			break;
+		case vp_edit::ADD: {
+			if (id != vp_entry::none) {
+				return fail(what + "already in the package");
+			}
+			if (parts.back().size() >= sizeof(vp_direntry::name)) {
+				return fail(what + "file name is too long");
+			}
+			uint32_t dir = make_parent(nodes, parts, error);
+			if (dir == vp_entry::none) {
+				return fail(what + error);
+			}
+			id = nodes.size();
+			edit_node& node = nodes.emplace_back();
+			node.name = parts.back();
+			node.parent = dir;
+			nodes[dir].children.push_back(id);
+			if (!open_source(node, edit.arg, end, error)) {
+				return fail(what + error);
+			}
+			break;
+		}
+		case vp_edit::DELETE:
+			// Gone from the tree, and nothing of it gets written
+			detach(nodes, id);
+			close_source(nodes[id]);
+			nodes[id].source.clear();
+			nodes[id].parent = vp_entry::none;
+			break;
+		case vp_edit::RENAME: {
+			std::vector<std::string> new_parts = split_path(edit.arg);
+			if (new_parts.empty() || resolve(nodes, new_parts) != vp_entry::none) {
+				return fail(what + edit.arg + " is already in the package");
+			}
+			if (new_parts.back().size() >= sizeof(vp_direntry::name)) {
+				return fail(what + "file name is too long");
+			}
+			uint32_t dir = make_parent(nodes, new_parts, error);
+			if (dir == vp_entry::none) {
+				return fail(what + error);
+			}
+			detach(nodes, id);
+			nodes[id].name = new_parts.back();
+			nodes[id].parent = dir;
+			nodes[dir].children.push_back(id);
+			break;
+		}
+		}
+	}
+
+	// Every file on its own fits, but all of them together might not
+	uint64_t position = end;
+	for (const edit_node& node : nodes) {
+		position += node.source_fd >= 0 ? node.source_size : 0;
+	}
+	if (position > INT32_MAX) {
+		return fail("The new files are too big for " + m_filename);
+	}
+
+	// Write out the new data one file after another at the end of the
+	// package, then the new index after it. As with append_file(), the
+	// header only changes once all of that is on disk.
+	appending = true;
+	position = end;
+	for (edit_node& node : nodes) {
+		if (node.source_fd < 0) {
+			continue;
+		}
+		if (!copy_range(node.source_fd, 0, node.source_size, out)) {
+			return fail("Could not append " + node.source + " to " + m_filename);
+		}
+		close_source(node);
+		node.entry.offset = position;
+		node.entry.size = node.source_size;
+		node.entry.timestamp = node.source_mtime;
+		position += node.source_size;
+	}
+
+	std::vector<vp_direntry> new_index;
+	std::function<void(uint32_t)> add_entries = [&](uint32_t dir) {
+		for (uint32_t id : nodes[dir].children) {
+			vp_direntry entry = nodes[id].entry;
+			memset(entry.name, 0, sizeof(entry.name));
+			memcpy(entry.name, nodes[id].name.data(), nodes[id].name.size());
+			if (nodes[id].is_directory) {
+				entry.offset = 0;
+				entry.size = 0;
+				new_index.push_back(entry);
+				add_entries(id);
+				new_index.push_back({ 0, 0, { '.', '.' }, 0 });
+			} else {
+				new_index.push_back(entry);
+			}
+		}
+	};
+	add_entries(0);
+
+	size_t index_size = new_index.size() * sizeof(vp_direntry);
+	if (position + index_size > INT32_MAX || !write_all(out, new_index.data(), index_size) || ::fdatasync(out) != 0) {
+		return fail("Could not write the new index to " + m_filename);
+	}
+	// A header that failed to write may point at the new index already, so
+	// from here on that has to stay
+	appending = false;
+	header.diroffset = position;
+	header.direntries = new_index.size();
+	if (!pwrite_all(out, &header, sizeof(header), 0) || ::fdatasync(out) != 0) {
+		return fail("Could not update the header of " + m_filename);
+	}
+	::close(out);
+
+	// The parsed index no longer matches the package, so start over
+	std::string filename = m_filename;
+	reset();
+	return parse(filename, VP_READ_WRITE);
+}
+
+std::vector<const vp_file*> vp_index::select(const path_filter& filter) const
+{
+	std::vector<const vp_file*> selected;
+	if (!m_table) {
+		return selected;
+	}
+
+	// Internal path of each directory relative to the root, '/'-terminated.
+	// Only worth building if a pattern looks at more than the file name.
+	std::vector<std::string> dir_prefixes;
+	if (filter.needs_path()) {
+		dir_prefixes.resize(m_table->dirs.size());
+	}
+
+	std::string path;
+	for (uint32_t id = 0; id < m_table->entries.size(); ++id) {
+		const vp_entry& e = m_table->entries[id];
+		std::string_view name = m_table->get_name(id);
+		if (e.is_directory) {
+			if (!dir_prefixes.empty() && e.parent != vp_entry::none) {
+				const std::string& parent = dir_prefixes[m_table->entries[e.parent].node];
+				dir_prefixes[e.node].reserve(parent.size() + name.size() + 1);
+				dir_prefixes[e.node].append(parent).append(name).push_back('/');
+			}
+			continue;
+		}
+
+		if (!dir_prefixes.empty()) {
+			path.assign(dir_prefixes[m_table->entries[e.parent].node]).append(name);
+		}
+		if (filter.matches(path, name)) {
+			selected.push_back(&m_table->files[e.node]);
+		}
+	}
+	return selected;
+}
+
+bool vp_index::dump(const std::string& dest_path, unsigned jobs, const path_filter* filter, vp_update_mode update, vp_extract_stats* stats) const
+{
+	if (!m_table) {
+		return false;
+	}
+
+	// Entries are stored parents first, so every directory's parent path is
+	// known by the time we get to it
+	std::vector<std::filesystem::path> dir_paths(m_table->dirs.size());
+	dir_paths[0] = dest_path;
+	for (const vp_directory& dir : m_table->dirs) {
+		const vp_entry& e = m_table->entries[dir.get_id()];
+		if (e.parent != vp_entry::none) {
+			dir_paths[e.node] = dir_paths[m_table->entries[e.parent].node] / dir.get_name();
+		}
+	}
+
+	std::vector<bool> created(m_table->dirs.size());
+	auto create_dir = [&dir_paths, &created](uint32_t node) {
+		if (created[node] || dir_paths[node].empty()) {
+			return true;
+		}
+		std::error_code err;
+		if (!std::filesystem::create_directories(dir_paths[node], err) && err.value() != 0) {
+			std::cerr << "Failed to create directory " << dir_paths[node] << ": " << err << std::endl;
+			return false;
+		}
+		created[node] = true;
+		return true;
+	};
+
+	// Create the directory skeleton up front: all of it for a full
+	// extraction, but only the directories that end up holding something when
+	// the files are filtered
+	std::vector<const vp_file*> files;
+	if (filter && !filter->empty()) {
+		files = select(*filter);
+		for (const vp_file* f : files) {
+			if (!create_dir(m_table->entries[m_table->entries[f->get_id()].parent].node)) {
+				return false;
+			}
+		}
+	} else {
+		for (uint32_t node = 0; node < m_table->dirs.size(); ++node) {
+			if (!create_dir(node)) {
+				return false;
+			}
+		}
+		files.reserve(m_table->files.size());
+		for (const vp_file& f : m_table->files) {
+			files.push_back(&f);
+		}
+	}
+
+	std::vector<std::filesystem::path> dests;
+	dests.reserve(files.size());
+	for (const vp_file* f : files) {
+		const vp_entry& parent = m_table->entries[m_table->entries[f->get_id()].parent];
+		dests.push_back(dir_paths[parent.node] / f->get_name());
+	}
+
+	// Only positional reads are done on the package, so any number of
+	// workers can share one descriptor. They can't see writes still sitting
+	// in the stream's buffer, though.
+	int package_fd = m_table->package_fd;
+	if (m_filestream) {
+		m_filestream->flush();
+	}
+
+	std::optional<thread_pool> pool;
+	if (jobs > 1) {
+		pool.emplace(jobs);
+	}
+
+	// Find the outputs that are already up to date. Checking contents means
+	// reading both copies, so that's worth spreading over the pool too.
+	std::vector<char> skip(files.size());
+	if (update != VP_OVERWRITE) {
+		auto check = [this, &files, &dests, &skip, update, package_fd](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				skip[i] = files[i]->is_extracted(dests[i], update == VP_SKIP_IDENTICAL, package_fd);
+			}
+		};
+		if (!pool) {
+			check(0, files.size());
+		} else {
+			const size_t chunk = 64;
+			for (size_t begin = 0; begin < files.size(); begin += chunk) {
+				pool->submit([&check, begin, end = std::min(begin + chunk, files.size())]() {
+					check(begin, end);
+				});
+			}
+			pool->wait();
+		}
+	}
+
+	// Read the package front to back, whatever order the index is in.
+	// Compressed files can't simply be copied out; they're decompressed a
+	// file per task instead.
+	read_scheduler scheduler;
+	std::vector<size_t> compressed;
+	size_t skipped = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (skip[i]) {
+			++skipped;
+			continue;
+		}
+		if (files[i]->is_compressed()) {
+			compressed.push_back(i);
+			continue;
+		}
+		scheduler.add(files[i]->get_offset(), files[i]->get_size(), dests[i], files[i]->get_timestamp());
+	}
+	scheduler.plan();
+	if (stats) {
+		stats->written = files.size() - skipped;
+		stats->skipped = skipped;
+	}
+
+	if (!pool) {
+		bool retval = scheduler.run(package_fd);
+		for (size_t i : compressed) {
+			retval = files[i]->extract(dests[i], package_fd) && retval;
+		}
+		return retval;
+	}
+
+	// Batches are dealt out in offset order, so the workers between them
+	// still move through the package more or less sequentially
+	std::atomic<bool> retval = true;
+	for (size_t i = 0; i < scheduler.batches().size(); ++i) {
+		pool->submit([&scheduler, i, package_fd, &retval]() {
+			if (!scheduler.run(i, package_fd)) {
+				retval = false;
+			}
+		});
+	}
+	for (size_t i : compressed) {
+		pool->submit([&files, &dests, i, package_fd, &retval]() {
+			if (!files[i]->extract(dests[i], package_fd)) {
+				retval = false;
+			}
+		});
+	}
+	pool->wait();
+
+	return retval;
+}
+
+static inline void set_name(std::string_view name, vp_direntry& entry)
+{
+	size_t len = std::min(name.size(), sizeof(entry.name) - 1);
+	memcpy(entry.name, name.data(), len);
+	entry.name[len] = '\0';
+}
+
+static inline void set_name(const std::filesystem::path& path, vp_direntry& entry)
+{
+	strncpy(entry.name, (--path.end())->c_str(), sizeof(entry.name) - 1);
+	entry.name[sizeof(entry.name) - 1] = '\0';
+}
+
+static inline std::time_t get_timestamp(const std::filesystem::directory_entry&& file)
+{
+	// It's a little shocking how much of a faff it is to do this correctly.
+	// This requires C++20 features, since apparently before then it was
+	// unpossible to do this portably.
+	// The 32-bit timestamp will break in less than 20 years anyway, so whatevs.
+	using std::chrono::file_clock;
+	using std::chrono::system_clock;
+
+	return system_clock::to_time_t(file_clock::to_sys(file.last_write_time()));
+}
+
+// How much file data build() gathers up before writing it out
+static const size_t build_buffer_size = 1 << 20;
+
+// How many files each reader thread may have read in ahead of the writer
+static const size_t build_prefetch_depth = 8;
+
+// Lay out the index for a directory tree, without touching any file contents.
+// Files get their offsets and sizes once they're written; until then sources
+// and files hold the path and index entry of each one, in package order.
+static void list_dir(const std::filesystem::path& path,
+                     std::list<vp_direntry>& index,
+                     std::vector<std::filesystem::path>& sources,
+                     std::vector<vp_direntry*>& files)
+{
+	// Current dir
+	vp_direntry direntry { 0, 0, {}, 0 };
+	set_name(path, direntry);
+	direntry.timestamp = (int)get_timestamp(std::filesystem::directory_entry(path));
+	index.push_back(direntry);
+
+	// We need to alphabetize the list since the fs API is random
+	std::set<std::filesystem::directory_entry> fset;
+
+	// Enumerate files
+	for (auto const& curr_file : std::filesystem::directory_iterator(path)) {
+		fset.insert(curr_file);
+	}
+
+	for (auto const& curr_file : fset) {
+		if (curr_file.is_directory()) {
+			// Recurse
+			list_dir(curr_file.path(), index, sources, files);
+		} else {
+			// Size and timestamp are filled in once the file has been opened
+			vp_direntry direntry { 0, 0, {}, 0 };
+			set_name(curr_file.path(), direntry);
+			index.push_back(direntry);
+			sources.push_back(curr_file.path());
+			files.push_back(&index.back());
+		}
+	}
+
+	// Updir
+	vp_direntry updir { 0, 0, { '.', '.' }, 0 };
+	index.push_back(updir);
+}
+
+// Whether the prefetched file f has the same contents as the (same size)
+// file at path
+static bool same_contents(const std::filesystem::path& path, const file_prefetcher::file& f)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool same;
+	if (f.data) {
+		std::vector<char> buf(f.size);
+		same = ::pread(fd, buf.data(), f.size, 0) == (ssize_t)f.size && memcmp(buf.data(), f.data, f.size) == 0;
+	} else {
+		same = ranges_equal(f.fd, 0, f.size, fd);
+	}
+	::close(fd);
+	return same;
+}
+
+// How many blocks of a large file each compressing thread gets at a time
+static const size_t compress_batch_blocks = 4;
+
+// Append the size bytes of fd (which is only read positionally) to out
+// LZ41-compressed, or as they are if compressing doesn't pay. The blocks are
+// compressed a batch at a time on pool and written in order. A file whose
+// first batch barely shrinks is taken to be compressed already, and copied
+// without trying the rest. Sets stored to the number of bytes written.
+static bool write_compressed(stream_writer& out, int fd, uint64_t size, thread_pool& pool, uint64_t& stored)
+{
+	uint64_t start = out.position();
+	lz41_writer writer(size);
+	size_t batch = pool.size() * compress_batch_blocks;
+	std::vector<std::vector<char>> blocks(batch);
+	std::vector<size_t> block_sizes(batch);
+	bool packed = out.write(lz41_reader::magic, sizeof(lz41_reader::magic));
+	uint64_t done = 0;
+
+	for (size_t first = 0; packed && first < writer.num_blocks(); first += batch) {
+		size_t count = std::min(batch, writer.num_blocks() - first);
+		std::atomic<bool> read_ok = true;
+		for (size_t j = 0; j < count; ++j) {
+			pool.submit([&, j]() {
+				static thread_local std::vector<char> in;
+				size_t length = writer.block_length(first + j);
+				in.resize(length);
+				blocks[j].resize(lz4_compress_bound(length));
+				if (!pread_all(fd, in.data(), length, writer.block_offset(first + j))) {
+					read_ok = false;
+					return;
+				}
+				block_sizes[j] = lz4_compress(in.data(), length, blocks[j].data(), blocks[j].size());
+			});
+		}
+		pool.wait();
+		if (!read_ok) {
+			return false;
+		}
+
+		for (size_t j = 0; packed && j < count; ++j) {
+			packed = out.write(blocks[j].data(), block_sizes[j]);
+			writer.add_block(block_sizes[j]);
+			done += writer.block_length(first + j);
+		}
+		if (first == 0 && !lz41_pays_off(done, writer.compressed_size())) {
+			break;
+		}
+	}
+	if (!packed) {
+		return false;
+	}
+
+	if (done == size && lz41_pays_off(size, writer.compressed_size())) {
+		std::vector<char> trailer = writer.trailer();
+		stored = writer.compressed_size();
+		return out.write(trailer.data(), trailer.size());
+	}
+	stored = size;
+	return out.truncate(start) && out.write_range(fd, 0, size);
+}
+
+bool vp_index::build(const std::filesystem::path& p, const std::string& vp_filename, unsigned jobs,
+	bool dedup, vp_build_stats* stats, const vp_index* base, bool compress)
+{
+	// Overwrite existing file if necessary
+	reset();
+
+	std::list<vp_direntry> index;
+	std::vector<std::filesystem::path> sources;
+	std::vector<vp_direntry*> files;
+	try {
+		list_dir(p, index, sources, files);
+	} catch (const std::filesystem::filesystem_error& e) {
+		std::cerr << e.what() << std::endl;
+		return false;
+	}
+
+	// Files that haven't changed since the base package was built (same path,
+	// size and timestamp) get copied out of it; only the rest are read in
+	std::vector<const vp_file*> unchanged(sources.size(), nullptr);
+	std::vector<std::filesystem::path> changed;
+	for (size_t i = 0; i < sources.size(); ++i) {
+		struct stat st;
+		if (base && ::stat(sources[i].c_str(), &st) == 0) {
+			const char* root = index.front().name;
+			std::string path = std::string(root, strnlen(root, sizeof(index.front().name))) + "/" + sources[i].lexically_relative(p).generic_string();
+			const vp_file* old = base->find(path);
+			if (old && old->get_timestamp() != 0 && old->get_timestamp() == (uint32_t)st.st_mtime
+				&& old->get_contents_size() == (uint64_t)st.st_size) {
+				unchanged[i] = old;
+				files[i]->size = old->get_size();
+				files[i]->timestamp = st.st_mtime;
+				continue;
+			}
+		}
+		changed.push_back(sources[i]);
+	}
+
+	// With a base package the new one is written alongside and moved into
+	// place at the end, since it may well be replacing the base
+	std::string out_filename = base ? vp_filename + ".tmp" : vp_filename;
+
+	// File data is streamed through a fixed buffer (or not buffered at all),
+	// so memory use doesn't depend on how big the input files are
+	buffer_pool buffers(1, build_buffer_size);
+	stream_writer outfile(buffers);
+
+	if (!outfile.open(out_filename)) {
+		std::cerr << "Could not create file " << out_filename << std::endl;
+		return false;
+	}
+
+	// Build and write the header (with bogus values)
+	vp_header hdr { { 'V', 'P', 'V', 'P' }, 2, sizeof(hdr), 0 };
+	bool ok = outfile.write(&hdr, sizeof(hdr));
+
+	// The readers open and read in the files ahead of us, so all that's left
+	// to do here is append them in order. Small files come in whole, in
+	// buffers of their own (and already compressed, if they're to be);
+	// bigger ones are copied from their descriptor, or compressed block by
+	// block on a pool of their own.
+	jobs = std::max(jobs, 1u);
+	buffer_pool read_buffers(jobs * build_prefetch_depth, stream_writer::large_file);
+	file_prefetcher prefetch(changed, jobs, read_buffers, dedup, compress);
+	std::optional<thread_pool> pool;
+	if (compress) {
+		pool.emplace(jobs);
+	}
+	vp_build_stats totals;
+	// Files stored so far, by content hash, and the size of every file read
+	std::unordered_map<uint64_t, std::vector<size_t>> stored;
+	std::vector<uint64_t> source_sizes(sources.size());
+
+	// Unchanged files that sit back to back in the base package are copied
+	// out of it in one go. Data the base stored once for several entries is
+	// only copied once, too, keyed by its old offset and size.
+	uint64_t run_offset = 0;
+	uint64_t run_size = 0;
+	std::unordered_map<uint64_t, uint32_t> copied;
+	auto copy_run = [&]() {
+		bool copy_ok = run_size == 0 || outfile.write_range(base->m_table->package_fd, run_offset, run_size);
+		run_size = 0;
+		return copy_ok;
+	};
+
+	for (size_t i = 0, next = 0; ok && i < sources.size(); ++i) {
+		++totals.files;
+
+		if (const vp_file* old = unchanged[i]) {
+			++totals.reused;
+			totals.bytes_reused += old->get_size();
+			uint64_t key = (uint64_t)old->get_offset() << 32 | old->get_size();
+			auto it = copied.find(key);
+			if (it != copied.end()) {
+				files[i]->offset = it->second;
+				continue;
+			}
+			if (run_size > 0 && old->get_offset() != run_offset + run_size) {
+				ok = copy_run();
+			}
+			if (run_size == 0) {
+				run_offset = old->get_offset();
+			}
+			files[i]->offset = outfile.position() + run_size;
+			run_size += old->get_size();
+			copied[key] = files[i]->offset;
+			continue;
+		}
+		if (!(ok = copy_run())) {
+			break;
+		}
+
+		size_t k = next++;
+		const file_prefetcher::file& f = prefetch.get(k);
+		if (!f.ok) {
+			std::cerr << "Could not read " << sources[i] << std::endl;
+			// This will leave a partially-written file lying around, unless
+			// it's only the temporary one
+			if (base) {
+				::unlink(out_filename.c_str());
+			}
+			return false;
+		}
+
+		source_sizes[i] = f.size;
+		files[i]->timestamp = f.mtime;
+
+		const vp_direntry* original = nullptr;
+		if (dedup && f.size > 0) {
+			std::vector<size_t>& candidates = stored[f.hash];
+			for (size_t j : candidates) {
+				if (source_sizes[j] == f.size && same_contents(sources[j], f)) {
+					original = files[j];
+					break;
+				}
+			}
+			if (!original) {
+				candidates.push_back(i);
+			}
+		}
+
+		if (original) {
+			files[i]->offset = original->offset;
+			files[i]->size = original->size;
+			++totals.duplicates;
+			totals.bytes_saved += f.size;
+		} else {
+			files[i]->offset = outfile.position();
+			uint64_t size = f.size;
+			if (!f.packed.empty()) {
+				size = f.packed.size();
+				ok = outfile.write(f.packed.data(), size);
+			} else if (compress && !f.data && f.size <= INT32_MAX) {
+				ok = write_compressed(outfile, f.fd, f.size, *pool, size);
+			} else {
+				ok = f.data ? outfile.write(f.data, f.size) : outfile.write_fd(f.fd, f.size);
+			}
+			files[i]->size = size;
+			if (size < f.size) {
+				++totals.compressed;
+				totals.compression_saved += f.size - size;
+			}
+		}
+		prefetch.release(k);
+	}
+	ok = ok && copy_run();
+	if (stats) {
+		*stats = totals;
+	}
+
+	// Write the index
+	hdr.diroffset = outfile.position();
+	for (auto& direntry : index) {
+		ok &= outfile.write(&direntry, sizeof(direntry));
+	}
+
+	// Now rewrite the header with the right values. A package replacing
+	// another is synced before the rename, as in compact().
+	hdr.direntries = index.size();
+	if (!ok || !outfile.write_at(0, &hdr, sizeof(hdr)) || !outfile.close(base != nullptr)) {
+		std::cerr << "Could not write " << out_filename << std::endl;
+		if (base) {
+			::unlink(out_filename.c_str());
+		}
+		return false;
+	}
+	if (base && !rename_durably(out_filename, vp_filename)) {
+		std::cerr << "Could not move " << out_filename << " to " << vp_filename << std::endl;
+		::unlink(out_filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool vp_index::compact(const std::string& vp_filename, vp_compact_stats* stats,
+	std::function<void(uint64_t, uint64_t)> progress)
+{
+	if (!m_table) {
+		return false;
+	}
+	if (m_filestream) {
+		m_filestream->flush();
+	}
+	int package_fd = m_table->package_fd;
+
+	vp_header header;
+	std::vector<vp_direntry> index;
+	struct stat st;
+	if (!read_raw_index(package_fd, header, index) || fstat(package_fd, &st) != 0) {
+		std::cerr << "Could not read the index of " << m_filename << std::endl;
+		return false;
+	}
+
+	// Every file, in the order its data appears in the package
+	std::vector<uint32_t> files;
+	for (uint32_t id = 0; id < m_table->entries.size(); ++id) {
+		const vp_entry& entry = m_table->entries[id];
+		if (!entry.is_directory && entry.ordinal < index.size()) {
+			files.push_back(id);
+		}
+	}
+	std::sort(files.begin(), files.end(), [this](uint32_t a, uint32_t b) {
+		return m_table->entries[a].offset < m_table->entries[b].offset;
+	});
+
+	// Merge the files' data into runs of live bytes, each of which is copied
+	// in one go. Files sharing data (or overlapping, in an odd package) end
+	// up in the same run, so shared data stays shared.
+	struct run {
+		uint64_t offset;
+		uint64_t end;
+		uint64_t new_offset = 0;
+	};
+	std::vector<run> runs;
+	std::vector<size_t> file_runs(files.size());
+	for (size_t i = 0; i < files.size(); ++i) {
+		const vp_entry& entry = m_table->entries[files[i]];
+		if (!runs.empty() && entry.offset <= runs.back().end) {
+			runs.back().end = std::max<uint64_t>(runs.back().end, (uint64_t)entry.offset + entry.size);
+		} else {
+			runs.push_back({ entry.offset, (uint64_t)entry.offset + entry.size });
+		}
+		file_runs[i] = runs.size() - 1;
+	}
+
+	// Pack the runs together straight after the header
+	uint64_t position = sizeof(header);
+	for (run& r : runs) {
+		r.new_offset = position;
+		position += r.end - r.offset;
+	}
+	uint64_t live = position - sizeof(header);
+	for (size_t i = 0; i < files.size(); ++i) {
+		const vp_entry& entry = m_table->entries[files[i]];
+		const run& r = runs[file_runs[i]];
+		index[entry.ordinal].offset = r.new_offset + (entry.offset - r.offset);
+	}
+
+	// Write to a temporary file next to the output, so the package being
+	// compacted can be the output
+	std::string out_filename = vp_filename + ".tmp";
+	buffer_pool buffers(1, build_buffer_size);
+	stream_writer outfile(buffers);
+	if (!outfile.open(out_filename)) {
+		std::cerr << "Could not create file " << out_filename << std::endl;
+		return false;
+	}
+
+	bool ok = outfile.write(&header, sizeof(header));
+	uint64_t copied = 0;
+	for (const run& r : runs) {
+		// Long runs go in slices, so there's some progress to report
+		for (uint64_t offset = r.offset; ok && offset < r.end;) {
+			uint64_t size = std::min<uint64_t>(r.end - offset, 64 << 20);
+			ok = outfile.write_range(package_fd, offset, size);
+			offset += size;
+			copied += size;
+			if (progress) {
+				progress(copied, live);
+			}
+		}
+	}
+
+	header.diroffset = outfile.position();
+	ok = ok && outfile.write(index.data(), index.size() * sizeof(vp_direntry));
+	// Synced before it's renamed, or a crash could leave the package an
+	// empty or partly written file
+	if (!ok || !outfile.write_at(0, &header, sizeof(header)) || !outfile.close(true)) {
+		std::cerr << "Could not write " << out_filename << std::endl;
+		::unlink(out_filename.c_str());
+		return false;
+	}
+
+	if (stats) {
+		stats->old_size = st.st_size;
+		stats->new_size = header.diroffset + index.size() * sizeof(vp_direntry);
+		stats->live_bytes = live;
+	}
+
+	if (!rename_durably(out_filename, vp_filename)) {
+		std::cerr << "Could not move " << out_filename << " to " << vp_filename << std::endl;
+		::unlink(out_filename.c_str());
+		return false;
+	}
+
+	// If that was this package, the parsed index is out of date
+	struct stat out_st;
+	if (::stat(vp_filename.c_str(), &out_st) == 0 && ::stat(m_filename.c_str(), &st) == 0 && out_st.st_ino == st.st_ino
+		&& out_st.st_dev == st.st_dev) {
+		std::string filename = m_filename;
+		vp_access_mode mode = m_mapping ? VP_READ_ONLY : VP_READ_WRITE;
+		reset();
+		return parse(filename, mode);
+	}
+	return true;
+}
+
+// Files bigger than this are checksummed or compared in pieces of this size,
+// and smaller ones are handed to the pool in batches of roughly this much data
+static const uint64_t piece_size = 8 << 20;
+
+// How much of a piece is read at a time
+static const size_t piece_buffer_size = 1 << 20;
+
+// Get size bytes from offset within f's data: straight from the mapping if
+// there is one, otherwise read from package_fd into buf. Returns nullptr if
+// the data isn't all there.
+static const char* read_piece(
+	const vp_file& f, const mapped_file* mapping, int package_fd, uint64_t offset, size_t size, std::vector<char>& buf)
+{
+	if (mapping) {
+		auto contents = f.data();
+		return contents.size() == f.get_size() ? (const char*)contents.data() + offset : nullptr;
+	}
+	buf.resize(std::max(buf.size(), size));
+	return pread_all(package_fd, buf.data(), size, f.get_offset() + offset) ? buf.data() : nullptr;
+}
+
+bool vp_index::checksum(std::vector<vp_checksum>& sums, unsigned jobs) const
+{
+	if (!m_table) {
+		return false;
+	}
+
+	// Split the files into pieces, each of which is checksummed on its own
+	struct piece {
+		uint32_t file;
+		uint64_t offset; // Within the file
+		uint64_t size;
+		uint32_t crc;
+	};
+	std::vector<piece> pieces;
+	const auto& files = m_table->files;
+	for (uint32_t i = 0; i < files.size(); ++i) {
+		uint64_t size = files[i].get_size();
+		uint64_t offset = 0;
+		do {
+			uint64_t len = std::min(size - offset, piece_size);
+			pieces.push_back({ i, offset, len, 0 });
+			offset += len;
+		} while (offset < size);
+	}
+
+	// Positional reads can't see writes still sitting in the stream's buffer
+	int package_fd = m_table->package_fd;
+	if (m_filestream) {
+		m_filestream->flush();
+	}
+
+	std::atomic<bool> retval = true;
+	auto run = [this, &pieces, &files, package_fd, &retval](size_t begin, size_t end) {
+		std::vector<char> buf;
+		for (size_t i = begin; i < end; ++i) {
+			piece& p = pieces[i];
+			const vp_file& f = files[p.file];
+			uint32_t crc = 0;
+			for (uint64_t done = 0; done < p.size;) {
+				size_t len = std::min<uint64_t>(p.size - done, piece_buffer_size);
+				const char* data = read_piece(f, m_mapping, package_fd, p.offset + done, len, buf);
+				if (!data) {
+					std::cerr << "Could not read data for " << f.get_path() << std::endl;
+					retval = false;
+					return;
+				}
+				crc = crc32c(crc, data, len);
+				done += len;
+			}
+			p.crc = crc;
+		}
+	};
+
+	if (jobs <= 1) {
+		run(0, pieces.size());
+	} else {
+		thread_pool pool(jobs);
+		size_t begin = 0;
+		uint64_t batch_bytes = 0;
+		for (size_t i = 0; i < pieces.size(); ++i) {
+			batch_bytes += pieces[i].size;
+			if (batch_bytes >= piece_size || i + 1 == pieces.size()) {
+				pool.submit([&run, begin, end = i + 1]() {
+					run(begin, end);
+				});
+				begin = i + 1;
+				batch_bytes = 0;
+			}
+		}
+		pool.wait();
+	}
+	if (!retval) {
+		return false;
+	}
+
+	// Stitch the pieces of each file back together
+	sums.clear();
+	sums.reserve(files.size());
+	for (const piece& p : pieces) {
+		if (p.offset == 0) {
+			sums.push_back({ files[p.file].get_package_path(), files[p.file].get_size(), p.crc });
+		} else {
+			sums.back().crc = crc32c_combine(sums.back().crc, p.crc, p.size);
+		}
+	}
+	return true;
+}
+
+bool vp_index::verify(const std::vector<vp_checksum>& expected, unsigned jobs, vp_verify_stats* stats) const
+{
+	std::vector<vp_checksum> actual;
+	if (!checksum(actual, jobs)) {
+		return false;
+	}
+
+	// A package can hold more than one file with the same path, so each path
+	// maps to its files in index order, and manifest entries take them in turn
+	std::unordered_map<std::string, std::vector<size_t>> by_path;
+	for (size_t i = actual.size(); i-- > 0;) {
+		by_path[actual[i].path].push_back(i);
+	}
+
+	vp_verify_stats found;
+	std::vector<bool> seen(actual.size());
+	for (const vp_checksum& want : expected) {
+		auto it = by_path.find(want.path);
+		if (it == by_path.end() || it->second.empty()) {
+			std::cerr << want.path << ": missing from package\n";
+			++found.missing;
+			continue;
+		}
+		size_t i = it->second.back();
+		it->second.pop_back();
+		seen[i] = true;
+		if (actual[i].size != want.size || actual[i].crc != want.crc) {
+			std::cerr << want.path << ": checksum mismatch\n";
+			++found.mismatched;
+		} else {
+			++found.ok;
+		}
+	}
+	for (size_t i = 0; i < actual.size(); ++i) {
+		if (!seen[i]) {
+			std::cerr << actual[i].path << ": not in manifest\n";
+			++found.extra;
+		}
+	}
+
+	if (stats) {
+		*stats = found;
 	}
-	return ss.str();
+	return found.mismatched == 0 && found.missing == 0 && found.extra == 0;
 }
 
-bool vp_index::update_index(const vp_node* node) const
+bool vp_index::diff(const vp_index& other, std::vector<vp_diff_entry>& changes, unsigned jobs) const
 {
-	const std::string target_name = node->get_name();
-	// Find the index in the file
-	vp_header header;
-	m_filestream->seekg(0);
-	m_filestream->read((char*)&header, sizeof(header));
-
-	if (!*m_filestream) {
-		std::cerr << "Error while updating index entry for " << target_name << std::endl;
+	if (!m_table || !other.m_table) {
 		return false;
 	}
 
-	m_filestream->seekg(header.diroffset);
+	// Match the files up by path. As in verify(), repeated paths are paired
+	// off in index order.
+	const auto& old_files = m_table->files;
+	const auto& new_files = other.m_table->files;
+	std::unordered_map<std::string, std::vector<uint32_t>> by_path;
+	for (uint32_t i = old_files.size(); i-- > 0;) {
+		by_path[old_files[i].get_package_path()].push_back(i);
+	}
 
-	// Now let's look for our file's entry
-	uint32_t curr = header.diroffset;
-	for (int i = 0; i < header.direntries; ++i, curr += sizeof(vp_direntry)) {
-		vp_direntry entry;
-		m_filestream->read((char*)&entry, sizeof(entry));
+	changes.clear();
+	std::vector<bool> matched(old_files.size());
+	std::vector<std::pair<uint32_t, uint32_t>> same_size;
+	for (uint32_t i = 0; i < new_files.size(); ++i) {
+		std::string path = new_files[i].get_package_path();
+		auto it = by_path.find(path);
+		if (it == by_path.end() || it->second.empty()) {
+			changes.push_back({ vp_diff_entry::ADDED, path });
+			continue;
+		}
+		uint32_t old = it->second.back();
+		it->second.pop_back();
+		matched[old] = true;
+		if (old_files[old].get_size() != new_files[i].get_size()) {
+			changes.push_back({ vp_diff_entry::CHANGED, path });
+		} else {
+			same_size.emplace_back(old, i);
+		}
+	}
+	for (uint32_t i = 0; i < old_files.size(); ++i) {
+		if (!matched[i]) {
+			changes.push_back({ vp_diff_entry::REMOVED, old_files[i].get_package_path() });
+		}
+	}
 
-		if (target_name == entry.name) {
-			// Found our entry. Update it.
-			m_filestream->seekp(curr);
-			node->to_direntry(&entry);
-			m_filestream->write((char*)&entry, sizeof(entry));
-			return true;
+	// Positional reads can't see writes still sitting in the streams' buffers
+	int old_fd = m_table->package_fd;
+	int new_fd = other.m_table->package_fd;
+	for (std::fstream* stream : { m_filestream, other.m_filestream }) {
+		if (stream) {
+			stream->flush();
 		}
 	}
 
-	return false;
-}
+	// Data at the same place in the same file needn't be read at all, as
+	// when a package is compared with itself or with a copy of its index
+	struct stat old_st, new_st;
+	bool same_package = ::fstat(old_fd, &old_st) == 0 && ::fstat(new_fd, &new_st) == 0 && old_st.st_dev == new_st.st_dev
+		&& old_st.st_ino == new_st.st_ino;
+
+	// Split the rest into pieces. Once any piece of a pair is found to
+	// differ, the pair's other pieces are skipped.
+	struct piece {
+		uint32_t pair;
+		uint64_t offset;
+		uint64_t size;
+	};
+	std::vector<piece> pieces;
+	for (uint32_t i = 0; i < same_size.size(); ++i) {
+		const vp_file& a = old_files[same_size[i].first];
+		const vp_file& b = new_files[same_size[i].second];
+		if (same_package && a.get_offset() == b.get_offset()) {
+			continue;
+		}
+		for (uint64_t offset = 0; offset < a.get_size(); offset += piece_size) {
+			pieces.push_back({ i, offset, std::min<uint64_t>(a.get_size() - offset, piece_size) });
+		}
+	}
 
-bool vp_index::dump(const std::string& dest_path) const
-{
-	if (m_root) {
-		bool retval = true;
-		// Now dump all the children using the new path
-		m_root->foreach_child([&dest_path, &retval](const vp_node* child) {
-			retval &= child->dump(dest_path);
-		});
+	std::vector<std::atomic<bool>> differs(same_size.size());
+	std::atomic<bool> retval = true;
+	auto run = [&](size_t begin, size_t end) {
+		std::vector<char> old_buf, new_buf;
+		for (size_t i = begin; i < end && retval; ++i) {
+			const piece& p = pieces[i];
+			const vp_file& a = old_files[same_size[p.pair].first];
+			const vp_file& b = new_files[same_size[p.pair].second];
+			for (uint64_t done = 0; done < p.size && !differs[p.pair]; done += piece_buffer_size) {
+				size_t len = std::min<uint64_t>(p.size - done, piece_buffer_size);
+				const char* x = read_piece(a, m_mapping, old_fd, p.offset + done, len, old_buf);
+				const char* y = read_piece(b, other.m_mapping, new_fd, p.offset + done, len, new_buf);
+				if (!x || !y) {
+					std::cerr << "Could not read data for " << (x ? b : a).get_path() << std::endl;
+					retval = false;
+					return;
+				}
+				if (memcmp(x, y, len) != 0) {
+					differs[p.pair] = true;
+				}
+			}
+		}
+	};
 
-		return retval;
+	if (jobs <= 1) {
+		run(0, pieces.size());
+	} else {
+		thread_pool pool(jobs);
+		size_t begin = 0;
+		uint64_t batch_bytes = 0;
+		for (size_t i = 0; i < pieces.size(); ++i) {
+			batch_bytes += pieces[i].size;
+			if (batch_bytes >= piece_size || i + 1 == pieces.size()) {
+				pool.submit([&run, begin, end = i + 1]() {
+					run(begin, end);
+				});
+				begin = i + 1;
+				batch_bytes = 0;
+			}
+		}
+		pool.wait();
+	}
+	if (!retval) {
+		return false;
 	}
-	return false;
-}
 
-static inline void set_name(const std::string& name, vp_direntry& entry)
-{
-	strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
-	entry.name[sizeof(entry.name) - 1] = '\0';
+	for (uint32_t i = 0; i < same_size.size(); ++i) {
+		if (differs[i]) {
+			changes.push_back({ vp_diff_entry::CHANGED, new_files[same_size[i].second].get_package_path() });
+		}
+	}
+	std::stable_sort(changes.begin(), changes.end(), [](const vp_diff_entry& a, const vp_diff_entry& b) {
+		return a.path < b.path;
+	});
+	return true;
 }
 
-static inline void set_name(const std::filesystem::path& path, vp_direntry& entry)
+// CRC-32C of a package's header and index, which identifies the package
+// well enough to catch a patch being applied to the wrong one
+static uint32_t index_crc(const vp_header& header, const std::vector<vp_direntry>& index)
 {
-	strncpy(entry.name, (--path.end())->c_str(), sizeof(entry.name) - 1);
-	entry.name[sizeof(entry.name) - 1] = '\0';
+	return crc32c(crc32c(0, &header, sizeof(header)), index.data(), index.size() * sizeof(vp_direntry));
 }
 
-static inline std::time_t get_timestamp(const std::filesystem::directory_entry&& file)
-{
-	// It's a little shocking how much of a faff it is to do this correctly.
-	// This requires C++20 features, since apparently before then it was
-	// unpossible to do this portably.
-	// The 32-bit timestamp will break in less than 20 years anyway, so whatevs.
-	using std::chrono::file_clock;
-	using std::chrono::system_clock;
+// Writes the operations of a patch in order, merging neighbouring copies and
+// neighbouring data. Data comes from the new package, which is mapped at
+// new_data and open as new_fd.
+class patch_writer {
+public:
+	patch_writer(stream_writer& out, const char* new_data, int new_fd, vp_patch_stats& stats)
+		: m_out(out)
+		, m_new_data(new_data)
+		, m_new_fd(new_fd)
+		, m_stats(stats)
+	{
+	}
 
-	return system_clock::to_time_t(file_clock::to_sys(file.last_write_time()));
-}
+	void copy(uint64_t offset, uint64_t size) { add(patch_copy, offset, size); }
+	void data(uint64_t offset, uint64_t size) { add(patch_data, offset, size); }
+
+	bool finish()
+	{
+		flush();
+		vp_patch_op end = { patch_end, 0, 0, 0 };
+		return m_ok && m_out.write(&end, sizeof(end));
+	}
+
+private:
+	void add(vp_patch_kind kind, uint64_t offset, uint64_t size)
+	{
+		if (size == 0) {
+			return;
+		}
+		if (m_pending.size && (m_pending.kind != kind || m_pending.offset + m_pending.size != offset)) {
+			flush();
+		}
+		if (!m_pending.size) {
+			m_pending = { kind, 0, offset, 0 };
+		}
+		m_pending.size += size;
+		(kind == patch_copy ? m_stats.copied_bytes : m_stats.literal_bytes) += size;
+	}
+
+	void flush()
+	{
+		if (!m_pending.size || !m_ok) {
+			return;
+		}
+		vp_patch_op op = m_pending;
+		if (op.kind == patch_data) {
+			// The bytes follow the operation; where they came from needn't
+			op.offset = 0;
+		}
+		m_ok = m_out.write(&op, sizeof(op));
+		if (m_pending.kind == patch_data && m_ok) {
+			m_ok = m_pending.size >= stream_writer::large_file
+				? m_out.write_range(m_new_fd, m_pending.offset, m_pending.size)
+				: m_out.write(m_new_data + m_pending.offset, m_pending.size);
+		}
+		m_pending.size = 0;
+	}
+
+	stream_writer& m_out;
+	const char* m_new_data;
+	int m_new_fd;
+	vp_patch_stats& m_stats;
+	vp_patch_op m_pending = {};
+	bool m_ok = true;
+};
 
-static bool write_dir(const std::filesystem::path& path,
-                      std::ofstream& outfile,
-                      vp_header& hdr,
-                      std::list<vp_direntry>& index)
+bool vp_index::make_patch(const vp_index& newer, const std::string& patch_filename, vp_patch_stats* stats) const
 {
-	// Write current dir
-	vp_direntry direntry { 0, 0, {}, 0 };
-	set_name(path, direntry);
-	direntry.timestamp = (int)get_timestamp(std::filesystem::directory_entry(path));
-	index.push_back(direntry);
+	if (!m_table || !newer.m_table) {
+		return false;
+	}
+	if (!m_mapping || !newer.m_mapping) {
+		std::cerr << "Making a patch needs both packages opened read-only\n";
+		return false;
+	}
+	const char* old_data = (const char*)m_mapping->data().data();
+	uint64_t old_size = m_mapping->size();
+	const char* new_data = (const char*)newer.m_mapping->data().data();
+	uint64_t new_size = newer.m_mapping->size();
+
+	vp_header old_header, new_header;
+	std::vector<vp_direntry> old_index, new_index;
+	if (!read_raw_index(m_table->package_fd, old_header, old_index)
+		|| !read_raw_index(newer.m_table->package_fd, new_header, new_index)) {
+		std::cerr << "Could not read the indexes of " << m_filename << " and " << newer.m_filename << std::endl;
+		return false;
+	}
 
-	// We need to alphabetize the list since the fs API is random
-	std::set<std::filesystem::directory_entry> fset;
+	// Old files by path, for deltas, and by size, for finding data that is
+	// there under another name
+	const auto& old_files = m_table->files;
+	std::unordered_map<std::string, uint32_t> by_path;
+	std::unordered_map<uint32_t, std::vector<uint32_t>> by_size;
+	for (uint32_t i = 0; i < old_files.size(); ++i) {
+		if ((uint64_t)old_files[i].get_offset() + old_files[i].get_size() <= old_size) {
+			by_path.try_emplace(old_files[i].get_package_path(), i);
+			by_size[old_files[i].get_size()].push_back(i);
+		}
+	}
 
-	// Enumerate files
-	for (auto const& curr_file : std::filesystem::directory_iterator(path)) {
-		fset.insert(curr_file);
+	// The patch writes the new package front to back
+	const auto& new_files = newer.m_table->files;
+	std::vector<uint32_t> order(new_files.size());
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
 	}
+	std::sort(order.begin(), order.end(), [&new_files](uint32_t a, uint32_t b) {
+		return new_files[a].get_offset() < new_files[b].get_offset();
+	});
 
-	for (auto const& curr_file : fset) {
-		if (curr_file.is_directory()) {
-			// Recurse
-			if (!write_dir(curr_file.path(), outfile, hdr, index)) {
-				// This will leave a partially-written file lying around...
-				return false;
+	buffer_pool buffers(1, build_buffer_size);
+	stream_writer outfile(buffers);
+	if (!outfile.open(patch_filename)) {
+		std::cerr << "Could not create file " << patch_filename << std::endl;
+		return false;
+	}
+
+	vp_patch_header header;
+	memcpy(header.sig, vp_patch_sig, sizeof(header.sig));
+	header.old_size = old_size;
+	header.new_size = new_size;
+	header.old_index_crc = index_crc(old_header, old_index);
+	header.new_index_crc = index_crc(new_header, new_index);
+	header.new_crc = crc32c(0, new_data, new_size);
+	header.reserved = 0;
+	bool ok = outfile.write(&header, sizeof(header));
+
+	vp_patch_stats found;
+	patch_writer patch(outfile, new_data, newer.m_table->package_fd, found);
+	uint64_t position = 0;
+	for (uint32_t i : order) {
+		const vp_file& f = new_files[i];
+		uint64_t start = f.get_offset();
+		uint64_t end = start + f.get_size();
+		if (end > new_size) {
+			std::cerr << "Data for " << f.get_path() << " runs past the end of " << newer.m_filename << std::endl;
+			ok = false;
+			break;
+		}
+		if (end <= position) {
+			// Shares its data with a file already written
+			continue;
+		}
+		if (start < position) {
+			// Overlaps one, which a well-formed package doesn't do
+			patch.data(position, end - position);
+			position = end;
+			continue;
+		}
+		patch.data(position, start - position);
+		position = end;
+
+		auto it = by_path.find(f.get_package_path());
+		const vp_file* prev = it == by_path.end() ? nullptr : &old_files[it->second];
+		auto same_data = [&](const vp_file* o) {
+			return o->get_size() == f.get_size() && memcmp(old_data + o->get_offset(), new_data + start, f.get_size()) == 0;
+		};
+		const vp_file* same = prev && same_data(prev) ? prev : nullptr;
+		if (!same) {
+			for (uint32_t j : by_size[f.get_size()]) {
+				if (same_data(&old_files[j])) {
+					same = &old_files[j];
+					break;
+				}
 			}
+		}
+
+		if (same) {
+			patch.copy(same->get_offset(), f.get_size());
+			++found.unchanged;
+		} else if (prev) {
+			make_delta(old_data + prev->get_offset(), prev->get_size(), new_data + start, f.get_size(),
+				[&patch, prev, start](const delta_op& op) {
+					if (op.copy) {
+						patch.copy(prev->get_offset() + op.offset, op.size);
+					} else {
+						patch.data(start + op.offset, op.size);
+					}
+				});
+			++found.delta;
 		} else {
-			vp_direntry direntry { 0, 0, {}, 0 }; // TODO preserve timestamp
-			set_name(curr_file.path(), direntry);
-			direntry.size = curr_file.file_size();
-			direntry.offset = hdr.diroffset;
-			index.push_back(direntry);
-			hdr.diroffset += direntry.size;
-			{
-				// Read the file and write it to the new package file
-				char* filebuf = new char[direntry.size];
-				std::ifstream infile(curr_file.path(), std::ios::in | std::ios::binary);
-				infile.read(filebuf, direntry.size);
-				infile.close();
-				outfile.write(filebuf, direntry.size);
-				delete[] filebuf;
-			}
+			patch.data(start, f.get_size());
+			++found.added;
 		}
 	}
+	patch.data(position, new_size - position);
 
-	// Write updir
-	vp_direntry updir { 0, 0, { '.', '.' }, 0 };
-	index.push_back(updir);
-
+	ok = ok && patch.finish();
+	found.patch_size = outfile.position();
+	if (!ok || !outfile.close()) {
+		std::cerr << "Could not write " << patch_filename << std::endl;
+		::unlink(patch_filename.c_str());
+		return false;
+	}
+	if (stats) {
+		*stats = found;
+	}
 	return true;
 }
 
-bool vp_index::build(const std::filesystem::path& p, const std::string& vp_filename)
+bool vp_index::apply_patch(const std::string& old_filename, const std::string& patch_filename, const std::string& out_filename)
 {
-	// Overwrite existing file if necessary
-	if (m_root) {
-		delete m_root;
-		m_root = nullptr;
+	int old_fd = ::open(old_filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (old_fd < 0) {
+		std::cerr << "Could not open " << old_filename << std::endl;
+		return false;
 	}
-	if (m_filestream) {
-		m_filestream->close();
-		delete m_filestream;
-		m_filestream = nullptr;
+	int patch_fd = ::open(patch_filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (patch_fd < 0) {
+		std::cerr << "Could not open " << patch_filename << std::endl;
+		::close(old_fd);
+		return false;
 	}
 
-	std::ofstream outfile(vp_filename, std::ios::out | std::ios::binary);
-
-	if (!outfile) {
-		std::cerr << "Could not create file " << vp_filename << std::endl;
+	std::string tmp_filename = out_filename + ".tmp";
+	auto fail = [old_fd, patch_fd, &tmp_filename](const std::string& why) {
+		std::cerr << why << std::endl;
+		::close(old_fd);
+		::close(patch_fd);
+		::unlink(tmp_filename.c_str());
 		return false;
+	};
+
+	// Make sure the patch is for this package before writing anything
+	vp_patch_header header;
+	vp_header old_header;
+	std::vector<vp_direntry> old_index;
+	struct stat st;
+	if (!pread_all(patch_fd, &header, sizeof(header), 0) || memcmp(header.sig, vp_patch_sig, sizeof(header.sig)) != 0) {
+		return fail(patch_filename + " is not a package patch");
+	}
+	if (fstat(old_fd, &st) != 0 || (uint64_t)st.st_size != header.old_size || !read_raw_index(old_fd, old_header, old_index)
+		|| index_crc(old_header, old_index) != header.old_index_crc) {
+		return fail(patch_filename + " was not made from " + old_filename);
 	}
 
-	// Build and write the header (with bogus values)
-	vp_header hdr { { 'V', 'P', 'V', 'P' }, 2, sizeof(hdr), 0 };
-	std::list<vp_direntry> index;
-	outfile.write((char*)&hdr, sizeof(hdr));
+	// Both copies and data go from descriptor to descriptor, so neither
+	// package nor the patch passes through memory
+	buffer_pool buffers(1, build_buffer_size);
+	stream_writer outfile(buffers);
+	if (!outfile.open(tmp_filename)) {
+		return fail("Could not create file " + tmp_filename);
+	}
+	uint64_t position = sizeof(header);
+	for (;;) {
+		vp_patch_op op;
+		if (!pread_all(patch_fd, &op, sizeof(op), position)) {
+			return fail(patch_filename + " is truncated");
+		}
+		position += sizeof(op);
+		if (op.kind == patch_end) {
+			break;
+		}
+		if (op.size > header.new_size - outfile.position()) {
+			return fail(patch_filename + " is corrupt");
+		}
 
-	if (!write_dir(p, outfile, hdr, index)) {
-		return false;
+		bool ok;
+		if (op.kind == patch_copy) {
+			ok = op.offset <= header.old_size && op.size <= header.old_size - op.offset
+				&& outfile.write_range(old_fd, op.offset, op.size);
+		} else if (op.kind == patch_data) {
+			ok = outfile.write_range(patch_fd, position, op.size);
+			position += op.size;
+		} else {
+			return fail(patch_filename + " is corrupt");
+		}
+		if (!ok) {
+			return fail("Could not write " + tmp_filename);
+		}
 	}
-	// Write the index
-	for (auto& direntry : index) {
-		outfile.write((char*)&direntry, sizeof(direntry));
+	// Synced, so what's checked below is what a crash after the rename
+	// would leave behind
+	if (outfile.position() != header.new_size || !outfile.close(true)) {
+		return fail("Could not write " + tmp_filename);
 	}
 
-	// Now rewrite the header with the right values
-	hdr.direntries = index.size();
-	outfile.seekp(0);
-	outfile.write((char*)&hdr, sizeof(hdr));
-	outfile.close();
+	// Check the result is the package the patch was made from, every byte
+	// of it, before it takes the place of anything. A patch damaged on the
+	// way gets this far as long as its operations still add up.
+	int out_fd = ::open(tmp_filename.c_str(), O_RDONLY | O_CLOEXEC);
+	vp_header new_header;
+	std::vector<vp_direntry> new_index;
+	bool matches = out_fd >= 0 && read_raw_index(out_fd, new_header, new_index)
+		&& index_crc(new_header, new_index) == header.new_index_crc;
+	uint32_t crc = 0;
+	std::vector<char> buf(piece_buffer_size);
+	for (uint64_t offset = 0; matches && offset < header.new_size; offset += buf.size()) {
+		size_t n = std::min<uint64_t>(buf.size(), header.new_size - offset);
+		matches = pread_all(out_fd, buf.data(), n, offset);
+		crc = crc32c(crc, buf.data(), n);
+	}
+	if (out_fd >= 0) {
+		::close(out_fd);
+	}
+	if (!matches || crc != header.new_crc) {
+		return fail("Patched package " + tmp_filename + " does not match the patch");
+	}
+
+	if (!rename_durably(tmp_filename, out_filename)) {
+		return fail("Could not move " + tmp_filename + " to " + out_filename);
+	}
+	::close(old_fd);
+	::close(patch_fd);
 	return true;
 }
 
 ////////////////////////////////////////////////////////////////
 /// vp_node methods
+
+std::string_view vp_node::get_name() const
+{
+	return m_table->get_name(m_id);
+}
+
 std::string vp_node::get_path() const
 {
-	std::list<std::string> elements;
-	const vp_node* curr = this;
-	while (curr) {
-		elements.push_front(curr->get_name());
-		curr = curr->get_parent();
+	std::list<std::string_view> elements;
+	for (uint32_t id = m_id; id != vp_entry::none; id = m_table->entries[id].parent) {
+		elements.push_front(m_table->get_name(id));
 	}
 
-	std::stringstream path_str;
+	std::string path_str;
 	for (auto elem : elements) {
-		path_str << elem;
-		if (elem != elements.back()) {
-			path_str << '/';
+		if (!path_str.empty()) {
+			path_str += '/';
 		}
+		path_str += elem;
 	}
-	return path_str.str();
+	return path_str;
 }
 
-////////////////////////////////////////////////////////////////
-/// vp_directory methods
-
-vp_directory::vp_directory(const std::string& name, uint32_t filetime, vp_directory* parent)
-	: vp_node(parent)
-	, m_name(name)
-	, m_filetime(filetime)
+std::string vp_node::get_package_path() const
 {
+	std::string path = get_path();
+	return path.substr(path.find('/') + 1);
 }
 
-vp_directory::~vp_directory()
+vp_directory* vp_node::get_parent() const
 {
-	for (auto* child : m_children) {
-		delete child;
+	uint32_t parent = entry().parent;
+	if (parent == vp_entry::none) {
+		return nullptr;
 	}
+	return &m_table->dirs[m_table->entries[parent].node];
 }
 
-const std::string& vp_directory::get_name() const
-{
-	return m_name;
-}
+////////////////////////////////////////////////////////////////
+/// vp_directory methods
 
 vp_file* vp_directory::find(const std::string& name)
 {
-	for (auto* node : m_children) {
-		vp_file* result = node->find(name);
+	for (uint32_t child = entry().first_child; child != vp_entry::none; child = m_table->entries[child].next_sibling) {
+		vp_file* result = m_table->get_node(child)->find(name);
 		if (result) {
 			return result;
 		}
@@ -401,34 +2646,29 @@ vp_file* vp_directory::find(const std::string& name)
 
 std::string vp_directory::to_string() const
 {
-	return m_name + "/";
+	return std::string(get_name()) + "/";
 }
 
 void vp_directory::to_direntry(vp_direntry* entry) const
 {
 	entry->size = 0;
 	entry->offset = 0;
-	entry->timestamp = m_filetime;
+	entry->timestamp = this->entry().timestamp;
 	memset(entry->name, 0, sizeof(entry->name));
-	set_name(m_name, *entry);
-}
-
-void vp_directory::add_child(vp_node* child)
-{
-	m_children.push_back(child);
+	set_name(get_name(), *entry);
 }
 
 void vp_directory::foreach_child(std::function<void(vp_node*)> f)
 {
-	for (auto* child : m_children) {
-		f(child);
+	for (uint32_t child = entry().first_child; child != vp_entry::none; child = m_table->entries[child].next_sibling) {
+		f(m_table->get_node(child));
 	}
 }
 
 void vp_directory::foreach_child(std::function<void(const vp_node*)> f) const
 {
-	for (auto* child : m_children) {
-		f(child);
+	for (uint32_t child = entry().first_child; child != vp_entry::none; child = m_table->entries[child].next_sibling) {
+		f(m_table->get_node(child));
 	}
 }
 
@@ -436,7 +2676,7 @@ bool vp_directory::dump(const std::string& dest_path) const
 {
 	// First, create a directory for this node
 	std::filesystem::path p(dest_path);
-	p.append(m_name);
+	p.append(get_name());
 
 	std::error_code err;
 	if (!std::filesystem::create_directories(p, err) && err.value() != 0) {
@@ -456,29 +2696,9 @@ bool vp_directory::dump(const std::string& dest_path) const
 ///////////////////////////////////////////////////////////////////
 /// vp_file methods
 
-vp_file::vp_file(const std::string& name,
-	uint32_t offset,
-	uint32_t size,
-	uint32_t filetime,
-	vp_directory* parent,
-	std::fstream* filestream)
-	: vp_node(parent)
-	, m_name(name)
-	, m_offset(offset)
-	, m_size(size)
-	, m_filetime(filetime)
-	, m_filestream(filestream)
-{
-}
-
-const std::string& vp_file::get_name() const
-{
-	return m_name;
-}
-
 vp_file* vp_file::find(const std::string& name)
 {
-	if (m_name == name) {
+	if (get_name() == name) {
 		return this;
 	}
 	return nullptr;
@@ -486,16 +2706,16 @@ vp_file* vp_file::find(const std::string& name)
 
 std::string vp_file::to_string() const
 {
-	return m_name;
+	return std::string(get_name());
 }
 
 void vp_file::to_direntry(vp_direntry* entry) const
 {
-	entry->size = m_size;
-	entry->offset = m_offset;
-	entry->timestamp = m_filetime;
+	entry->size = get_size();
+	entry->offset = get_offset();
+	entry->timestamp = get_timestamp();
 	memset(entry->name, 0, sizeof(entry->name));
-	set_name(m_name, *entry);
+	set_name(get_name(), *entry);
 }
 
 void vp_file::foreach_child(std::function<void(vp_node*)> f)
@@ -510,19 +2730,118 @@ void vp_file::foreach_child(std::function<void(const vp_node*)> f) const
 	return;
 }
 
+std::span<const std::byte> vp_file::data() const
+{
+	if (!m_table->mapping) {
+		return {};
+	}
+	return m_table->mapping->subspan(get_offset(), get_size());
+}
+
+bool vp_file::is_compressed() const
+{
+	if (m_table->raw || get_size() < sizeof(lz41_reader::magic)) {
+		return false;
+	}
+	char magic[sizeof(lz41_reader::magic)];
+	if (m_table->mapping) {
+		auto contents = data();
+		return contents.size() == get_size() && lz41_reader::is_lz41((const char*)contents.data(), contents.size());
+	}
+	if (m_table->filestream) {
+		m_table->filestream->flush();
+	}
+	return pread_all(m_table->package_fd, magic, sizeof(magic), get_offset()) && lz41_reader::is_lz41(magic, sizeof(magic));
+}
+
+bool vp_file::open_compressed(lz41_reader& reader, int package_fd) const
+{
+	auto read = [this, package_fd](uint64_t offset, size_t size, char* buf) {
+		if (offset > get_size() || size > get_size() - offset) {
+			return false;
+		}
+		if (m_table->mapping) {
+			auto contents = data();
+			if (contents.size() != get_size()) {
+				return false;
+			}
+			memcpy(buf, contents.data() + offset, size);
+			return true;
+		}
+		return pread_all(package_fd, buf, size, get_offset() + offset);
+	};
+	if (!reader.open(read, get_size())) {
+		std::cerr << get_path() << " is marked LZ41-compressed but can't be read as such\n";
+		return false;
+	}
+	return true;
+}
+
+uint64_t vp_file::get_contents_size() const
+{
+	lz41_reader reader;
+	if (is_compressed() && open_compressed(reader, m_table->package_fd)) {
+		return reader.size();
+	}
+	return get_size();
+}
+
+bool vp_file::read(uint64_t offset, size_t size, char* buf) const
+{
+	if (m_table->filestream) {
+		m_table->filestream->flush();
+	}
+	if (is_compressed()) {
+		lz41_reader reader;
+		return open_compressed(reader, m_table->package_fd) && reader.read(offset, size, buf);
+	}
+
+	if (offset > get_size() || size > get_size() - offset) {
+		return false;
+	}
+	if (m_table->mapping) {
+		auto contents = data();
+		if (contents.size() != get_size()) {
+			return false;
+		}
+		memcpy(buf, contents.data() + offset, size);
+		return true;
+	}
+	return pread_all(m_table->package_fd, buf, size, get_offset() + offset);
+}
+
 std::string vp_file::dump() const
 {
-	m_filestream->seekg(m_offset);
-	if (!*m_filestream) {
-		std::cerr << "Could not seek to offset " << m_offset << std::endl;
+	if (is_compressed()) {
+		lz41_reader reader;
+		std::string retval;
+		if (!open_compressed(reader, m_table->package_fd)) {
+			return retval;
+		}
+		retval.resize(reader.size());
+		if (!reader.read(0, retval.size(), retval.data())) {
+			std::cerr << "Could not decompress " << get_path() << std::endl;
+			retval.clear();
+		}
+		return retval;
+	}
+
+	if (m_table->mapping) {
+		auto contents = data();
+		return std::string((const char*)contents.data(), contents.size());
+	}
+
+	m_table->filestream->seekg(get_offset());
+	if (!*m_table->filestream) {
+		std::cerr << "Could not seek to offset " << get_offset() << std::endl;
 	}
 
 	// Read from the correct offset
 	std::string retval;
-	retval.resize(m_size);
-	m_filestream->read(&retval[0], m_size);
-	if (!*m_filestream) {
-		std::cerr << "Could not read " << m_size << " bytes from file\n";
+	retval.resize(get_size());
+	m_table->filestream->read(&retval[0], get_size());
+	if (!*m_table->filestream) {
+		std::cerr << "Could not read " << get_size() << " bytes from file\n";
 	}
 
 	return retval;
@@ -534,30 +2853,154 @@ bool vp_file::dump(const std::string& path) const
 
 	// If we're given a directory, just create the file in the directory
 	if (std::filesystem::is_directory(dump_file)) {
-		dump_file.append(m_name);
+		dump_file.append(get_name());
+	}
+
+	// Positional reads don't see writes still sitting in the stream's buffer
+	if (m_table->filestream) {
+		m_table->filestream->flush();
+	}
+	return extract(dump_file, m_table->package_fd);
+}
+
+bool vp_file::write_to(int out_fd) const
+{
+	if (m_table->filestream) {
+		m_table->filestream->flush();
+	}
+
+	if (is_compressed()) {
+		lz41_reader reader;
+		if (!open_compressed(reader, m_table->package_fd)) {
+			return false;
+		}
+		if (!reader.for_each_block([out_fd](const char* data, size_t size) { return write_all(out_fd, data, size); })) {
+			std::cerr << "Could not write the contents of " << get_name() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	if (!copy_range(m_table->package_fd, get_offset(), get_size(), out_fd)) {
+		std::cerr << "Could not write " << get_size() << " bytes of " << get_name() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool vp_file::write_to(int out_fd, uint64_t offset, uint64_t size) const
+{
+	if (m_table->filestream) {
+		m_table->filestream->flush();
+	}
+
+	if (is_compressed()) {
+		lz41_reader reader;
+		if (!open_compressed(reader, m_table->package_fd) || offset > reader.size() || size > reader.size() - offset) {
+			return false;
+		}
+		while (size > 0) {
+			const char* block;
+			size_t block_size;
+			if (!reader.read_block(offset / reader.block_size(), block, block_size)) {
+				std::cerr << "Could not decompress " << get_path() << std::endl;
+				return false;
+			}
+			size_t start = offset % reader.block_size();
+			size_t n = std::min<uint64_t>(size, block_size - start);
+			if (!write_all(out_fd, block + start, n)) {
+				return false;
+			}
+			offset += n;
+			size -= n;
+		}
+		return true;
 	}
 
-	// This is not the most efficient implementation, but it should be fine
-	std::string dump_buf = dump();
-	if (dump_buf.empty()) {
+	if (offset > get_size() || size > get_size() - offset) {
 		return false;
 	}
+	return copy_range(m_table->package_fd, get_offset() + offset, size, out_fd);
+}
 
-	// Write the buffer to the file
-	std::ofstream outfile(dump_file, std::ios::out | std::ios::binary);
-	if (!outfile) {
-		std::cerr << "Could not open " << dump_file << " for writing\n";
+bool vp_file::extract(const std::filesystem::path& dest, int package_fd) const
+{
+	int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		std::cerr << "Could not open " << dest << " for writing\n";
 		return false;
 	}
-	outfile << dump_buf;
-	bool retval = (bool)outfile;
-	outfile.close();
 
-	return retval;
+	// Let the kernel move the bytes straight from the package to the output,
+	// unless they need decompressing on the way
+	bool copied;
+	lz41_reader reader;
+	if (is_compressed()) {
+		copied = open_compressed(reader, package_fd) && reader.for_each_block([out](const char* data, size_t size) {
+			return write_all(out, data, size);
+		});
+	} else {
+		copied = copy_range(package_fd, get_offset(), get_size(), out);
+	}
+	if (!copied) {
+		std::cerr << "Could not read " << get_size() << " bytes from package for " << get_name() << std::endl;
+	} else if (get_timestamp() != 0 && !set_mtime(out, get_timestamp())) {
+		std::cerr << "Warning: could not set the modification time of " << dest << std::endl;
+	}
+
+	if (::close(out) != 0 || !copied) {
+		std::cerr << "Could not write " << dest << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool vp_file::is_extracted(const std::filesystem::path& dest, bool compare_contents, int package_fd) const
+{
+	// A compressed file is compared with what it decompresses to
+	lz41_reader reader;
+	bool compressed = is_compressed();
+	if (compressed && !open_compressed(reader, package_fd)) {
+		return false;
+	}
+	uint64_t size = compressed ? reader.size() : get_size();
+
+	struct stat st;
+	if (stat(dest.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size != size) {
+		return false;
+	}
+	if (!compare_contents && get_timestamp() != 0) {
+		return st.st_mtime == get_timestamp();
+	}
+
+	int fd = ::open(dest.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool same;
+	if (compressed) {
+		uint64_t offset = 0;
+		std::vector<char> buf;
+		same = reader.for_each_block([fd, &offset, &buf](const char* data, size_t size) {
+			buf.resize(size);
+			bool equal = pread_all(fd, buf.data(), size, offset) && memcmp(buf.data(), data, size) == 0;
+			offset += size;
+			return equal;
+		});
+	} else {
+		same = ranges_equal(package_fd, get_offset(), get_size(), fd);
+	}
+	::close(fd);
+	return same;
 }
 
 bool vp_file::write_file_contents(const std::filesystem::path& newfile)
 {
+	if (!m_table->filestream) {
+		std::cerr << "Cannot write " << newfile << ": package is open read-only\n";
+		return false;
+	}
+
 	std::ifstream infile(newfile, std::ios::in | std::ios::binary);
 	if (!infile) {
 		std::cerr << "Could not open file " << newfile << " for reading\n";
@@ -565,15 +3008,17 @@ bool vp_file::write_file_contents(const std::filesystem::path& newfile)
 	}
 
 	// Read the file in chunks and write to the filestream
+	const size_t buf_size = 65536;
 	uint32_t new_size = 0;
-	m_filestream->seekp(m_offset);
-	char* buf = new char[65535];
-	while (infile.read(buf, sizeof(buf)) || infile.gcount() > 0) {
-		m_filestream->write(buf, infile.gcount());
+	m_table->filestream->seekp(get_offset());
+	char* buf = new char[buf_size];
+	while (infile.read(buf, buf_size) || infile.gcount() > 0) {
+		m_table->filestream->write(buf, infile.gcount());
 		new_size += infile.gcount();
 	}
 
-	m_size = new_size;
+	entry().size = new_size;
+	entry().timestamp = ::get_timestamp(std::filesystem::directory_entry(newfile));
 
 	delete[] buf;
 	infile.close();
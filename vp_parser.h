@@ -5,30 +5,153 @@
 #include <functional>
 #include <iostream>
 #include <list>
+#include <span>
 #include <string>
-
+#include <string_view>
+#include <vector>
+
+class lz41_reader;
+class mapped_file;
+class path_filter;
+struct vp_checksum;
+struct vp_edit;
 class vp_file;
 class vp_directory;
 struct vp_direntry;
+struct vp_cache_key;
+
+/**
+ * How vp_index::parse opens a package.
+ */
+enum vp_access_mode {
+	VP_READ_WRITE, // Payloads are read and written through a file stream
+	VP_READ_ONLY, // The package is memory-mapped and payloads are read from the mapping
+};
+
+/**
+ * What extracting a package does about output files that already exist.
+ */
+enum vp_update_mode {
+	VP_OVERWRITE, // Always rewrite them
+	VP_SKIP_UNCHANGED, // Keep them if their size and modification time match the entry
+	VP_SKIP_IDENTICAL, // Keep them if their contents match the entry
+};
+
+/**
+ * Counts of what vp_index::dump did.
+ */
+struct vp_extract_stats {
+	size_t written = 0;
+	size_t skipped = 0; // Already up to date
+};
+
+// What build() did with the input files
+struct vp_build_stats {
+	size_t files = 0;
+	size_t duplicates = 0; // Stored once already, under another name
+	uint64_t bytes_saved = 0; // Total size of the duplicates
+	size_t reused = 0; // Unchanged since the base package, and copied from it
+	uint64_t bytes_reused = 0;
+	size_t compressed = 0; // Stored LZ41-compressed
+	uint64_t compression_saved = 0; // How much smaller compressing made them
+};
+
+// What compact() did
+struct vp_compact_stats {
+	uint64_t old_size = 0;
+	uint64_t new_size = 0;
+	uint64_t live_bytes = 0; // File data still referenced by the index
+};
+
+// What verify() found
+struct vp_verify_stats {
+	size_t ok = 0;
+	size_t mismatched = 0; // Different size or checksum
+	size_t missing = 0; // In the manifest but not the package
+	size_t extra = 0; // In the package but not the manifest
+};
+
+// What make_patch() put in the patch
+struct vp_patch_stats {
+	size_t unchanged = 0; // Files whose data was found whole in the old package
+	size_t delta = 0; // Changed files sent as a delta against their old version
+	size_t added = 0; // Files sent in full
+	uint64_t copied_bytes = 0; // Bytes of the new package copied from the old
+	uint64_t literal_bytes = 0; // Bytes of the new package stored in the patch
+	uint64_t patch_size = 0;
+};
+
+// One difference between two packages, as found by diff()
+struct vp_diff_entry {
+	enum kind_type {
+		ADDED, // Only in the new package
+		REMOVED, // Only in the old package
+		CHANGED, // In both, with different contents
+	};
+
+	kind_type kind;
+	std::string path;
+};
+
+/**
+ * One directory or file from a package index, in flat form. A parsed index is
+ * a single array of these; names live in a shared string arena, and the tree
+ * structure is stored as indices into the array.
+ */
+struct vp_entry {
+	static constexpr uint32_t none = UINT32_MAX;
+
+	uint32_t name = 0; // Offset of the null-terminated name in the name arena
+	uint32_t parent = none; // Enclosing directory, or none for the root
+	uint32_t first_child = none; // Directories only
+	uint32_t next_sibling = none;
+	uint32_t offset = 0; // Files only
+	uint32_t size = 0; // Files only
+	uint32_t timestamp = 0;
+	uint32_t ordinal = none; // Position in the package's on-disk index; none for the root
+	uint32_t node = none; // Index of the handle in vp_entry_table::dirs or ::files
+	bool is_directory = false;
+};
+
+/**
+ * A slot in one of the open-addressed lookup tables of a vp_entry_table.
+ */
+struct vp_lookup_slot {
+	uint32_t hash = 0;
+	uint32_t entry = vp_entry::none; // none marks an empty slot
+};
+
+struct vp_entry_table;
 
 /**
  * Abstract base class for a single direntry in the VP file.
+ *
+ * Nodes are lightweight handles onto a vp_entry; the entry itself lives in the
+ * vp_entry_table that owns both.
  */
 class vp_node {
 public:
-	vp_node(vp_directory* parent)
-		: m_parent(parent)
+	vp_node(vp_entry_table* table, uint32_t id)
+		: m_table(table)
+		, m_id(id)
 	{
 	}
 	virtual ~vp_node() { }
 
 	/// Get a user-friendly printable name for the node
-	virtual const std::string& get_name() const = 0;
+	std::string_view get_name() const;
 
 	/// Get the path for the node
 	/// The path is given using standard UNIX path represenation
 	virtual std::string get_path() const;
 
+	/// Get the path relative to the package root, i.e. get_path() without
+	/// the leading "./", e.g. "data/tables/ai.tbl"
+	std::string get_package_path() const;
+
+	/// Index of the node's entry in the package's entry table
+	uint32_t get_id() const { return m_id; }
+
 	/// Find a file with the given name
 	virtual vp_file* find(const std::string& name) = 0;
 
@@ -40,7 +163,7 @@ public:
 	virtual void to_direntry(struct vp_direntry*) const = 0;
 
 	/// Return the enclosing directory, or nullptr if it's the root node
-	virtual vp_directory* get_parent() const { return m_parent; }
+	virtual vp_directory* get_parent() const;
 
 	/// Call the given callback on every child node
 	virtual void foreach_child(std::function<void(vp_node*)> f) = 0;
@@ -49,7 +172,11 @@ public:
 	virtual bool dump(const std::string& dest_path) const = 0;
 
 protected:
-	vp_directory* m_parent = nullptr;
+	const vp_entry& entry() const;
+	vp_entry& entry();
+
+	vp_entry_table* m_table;
+	uint32_t m_id;
 };
 
 /**
@@ -57,24 +184,15 @@ protected:
  */
 class vp_directory : public vp_node {
 public:
-	vp_directory(const std::string& name, uint32_t filetime, vp_directory* parent);
-	~vp_directory();
+	using vp_node::vp_node;
 
-	virtual const std::string& get_name() const override;
 	virtual vp_file* find(const std::string& name) override;
 	virtual std::string to_string() const override;
 	virtual void to_direntry(struct vp_direntry*) const override;
-	virtual void foreach_child(std::function<void(vp_node*)> f);
+	virtual void foreach_child(std::function<void(vp_node*)> f) override;
 	virtual void foreach_child(std::function<void(const vp_node*)> f) const override;
 
-	void add_child(vp_node* child);
-
 	virtual bool dump(const std::string& dest_path) const override;
-
-private:
-	std::string m_name;
-	uint32_t m_filetime;
-	std::list<vp_node*> m_children;
 };
 
 /**
@@ -82,21 +200,36 @@ private:
  */
 class vp_file : public vp_node {
 public:
-	vp_file(const std::string& name,
-		uint32_t offset,
-		uint32_t size,
-		uint32_t filetime,
-		vp_directory* parent,
-		std::fstream* filestream);
-	virtual const std::string& get_name() const;
-	virtual vp_file* find(const std::string& name);
-	virtual std::string to_string() const;
+	using vp_node::vp_node;
+
+	virtual vp_file* find(const std::string& name) override;
+	virtual std::string to_string() const override;
 	virtual void to_direntry(struct vp_direntry*) const override;
-	virtual void foreach_child(std::function<void(vp_node*)> f);
+	virtual void foreach_child(std::function<void(vp_node*)> f) override;
 	virtual void foreach_child(std::function<void(const vp_node*)> f) const override;
 
-	uint32_t get_offset() const { return m_offset; }
-	uint32_t get_size() const { return m_size; }
+	uint32_t get_offset() const { return entry().offset; }
+	uint32_t get_size() const { return entry().size; }
+	uint32_t get_timestamp() const { return entry().timestamp; }
+
+	/// Returns a view of the file contents pointing straight into the package
+	/// mapping, as stored. The span is empty unless the package was opened
+	/// VP_READ_ONLY.
+	std::span<const std::byte> data() const;
+
+	/// Whether the file is stored LZ41-compressed (see lz41.h). Unless the
+	/// index was told to hand files out raw, the methods below decompress
+	/// such files on the way out, a block at a time.
+	bool is_compressed() const;
+
+	/// Size of the file's contents: get_size() for a file stored as it is,
+	/// the decompressed size of a compressed one
+	uint64_t get_contents_size() const;
+
+	/// Copy size bytes of the file's contents, starting at offset, into buf.
+	/// Only the blocks of a compressed file that cover the range are
+	/// decompressed.
+	bool read(uint64_t offset, size_t size, char* buf) const;
 
 	/// Returns a string with the text contents of the file
 	std::string dump() const;
@@ -104,17 +237,107 @@ public:
 	/// Writes the text contents of the file to the given path
 	virtual bool dump(const std::string& path) const override;
 
+	/// Streams the contents of the file to an open descriptor (a pipe, a
+	/// terminal, a socket...) at its current position. Memory use doesn't
+	/// depend on the size of the file.
+	bool write_to(int out_fd) const;
+
+	/// Like write_to(), for size bytes of the contents starting at offset.
+	/// Stored files go out through copy_range(), so to a socket this is a
+	/// sendfile(); only the blocks of a compressed file that cover the range
+	/// are decompressed.
+	bool write_to(int out_fd, uint64_t offset, uint64_t size) const;
+
+	/// Writes the contents of the file to dest, copying straight from
+	/// package_fd inside the kernel where possible. Only positional reads are
+	/// done on package_fd, so this is safe to call from several threads at once.
+	bool extract(const std::filesystem::path& dest, int package_fd) const;
+
+	/// Whether dest already holds what extract() would write to it: it must be
+	/// the same size and either have the entry's timestamp as its modification
+	/// time or, if compare_contents is set or the entry has no timestamp, the
+	/// same bytes as the package
+	bool is_extracted(const std::filesystem::path& dest, bool compare_contents, int package_fd) const;
+
 	/// Write the text contents of the given file to the package
 	/// NOTE: This method does NOT update the index, nor does it do any validity
 	///       checking of the file data. It assumes you know what you are doing!
 	bool write_file_contents(const std::filesystem::path& newfile);
 
 private:
-	std::string m_name;
-	uint32_t m_offset;
-	uint32_t m_size;
-	uint32_t m_filetime;
-	std::fstream* m_filestream;
+	/// Set reader up to decompress the file, reading it through package_fd
+	/// unless the package is mapped. Says what's wrong on stderr if the file
+	/// is marked compressed but can't be read as such.
+	bool open_compressed(lz41_reader& reader, int package_fd) const;
+};
+
+/**
+ * Flat storage for a parsed package index: one vp_entry per directory or file
+ * (entries[0] is the root), a single arena holding every name, a handle object
+ * per entry, and hash tables for name and path lookups. Everything lives in a
+ * handful of contiguous arrays, so building and tearing down an index costs a
+ * few allocations rather than a few per entry.
+ */
+struct vp_entry_table {
+	vp_entry_table() = default;
+	vp_entry_table(const vp_entry_table&) = delete;
+	vp_entry_table& operator=(const vp_entry_table&) = delete;
+
+	std::vector<vp_entry> entries;
+	std::string names;
+	std::vector<vp_directory> dirs;
+	std::vector<vp_file> files;
+
+	// Lookup tables keyed on lowercased bare file names and lowercased full
+	// paths (relative to the root, '/'-separated). Sizes are powers of two.
+	// Each distinct key gets one slot; further files with the same key are
+	// chained from it through the *_chain arrays, which are indexed like files.
+	std::vector<vp_lookup_slot> name_lookup;
+	std::vector<vp_lookup_slot> path_lookup;
+	std::vector<uint32_t> name_chain;
+	std::vector<uint32_t> path_chain;
+
+	// Where file payloads are read from
+	std::fstream* filestream = nullptr;
+	const mapped_file* mapping = nullptr;
+	int package_fd = -1; // For positional reads; never moved or written through
+	bool raw = false; // Hand out LZ41-compressed files as stored
+
+	/// Reserve room for the given number of entries and name bytes, so that
+	/// handles never move once they have been handed out
+	void reserve(uint32_t num_dirs, uint32_t num_files, size_t name_bytes);
+
+	/// Append an entry (and its handle) as the last child of parent
+	uint32_t add(std::string_view name, uint32_t parent, bool is_directory, uint32_t offset, uint32_t size, uint32_t timestamp,
+		uint32_t ordinal);
+
+	std::string_view get_name(uint32_t id) const;
+	vp_node* get_node(uint32_t id);
+	vp_directory* get_root() { return dirs.empty() ? nullptr : &dirs.front(); }
+
+	/// Recreate the node handles (and the bookkeeping add() needs) from the
+	/// entry array alone, e.g. after loading it from a sidecar cache. Returns
+	/// false if the entries don't describe a well-formed tree.
+	bool rebuild_nodes();
+
+	/// Add a file entry to both lookup tables under the given hashes
+	void add_lookup(uint32_t id, uint32_t name_hash, uint32_t path_hash);
+
+	/// Find every file whose name (or path, if key contains a '/') matches the
+	/// given lowercased key, in index order
+	std::vector<uint32_t> lookup(const std::string& key) const;
+
+private:
+	void rehash(size_t slots);
+	bool name_matches(uint32_t a, uint32_t b) const;
+	bool path_matches(uint32_t id, std::string_view key) const;
+	bool path_matches(uint32_t a, uint32_t b) const;
+	template <typename Equal>
+	void insert(std::vector<vp_lookup_slot>& table, std::vector<uint32_t>& chain, uint32_t hash, uint32_t id, Equal equal);
+
+	// Last child of each directory, indexed like dirs
+	std::vector<uint32_t> m_last_child;
+	size_t m_lookup_count = 0;
 };
 
 /**
@@ -124,32 +347,157 @@ class vp_index {
 public:
 	~vp_index();
 
-	// Given the path to a .vp file, populate this vp_index with its contents
-	bool parse(const std::string& path);
+	// Given the path to a .vp file, populate this vp_index with its contents.
+	// In VP_READ_ONLY mode the package is mapped once and never written to.
+	// If cache_path is given, a sidecar index stored there is used instead of
+	// parsing when it still matches the package, and is rewritten otherwise.
+	bool parse(const std::string& path, vp_access_mode mode = VP_READ_WRITE, const std::string& cache_path = "");
 
-	// Find a file with the given name. Only files, not directories.
+	// Where the sidecar index for a package lives, given the user's cache
+	// setting: inside it if it's a directory, otherwise the setting itself
+	static std::string get_cache_path(const std::string& vp_filename, const std::string& cache);
+
+	// Find a file by bare name ("ai.tbl") or by full internal path
+	// ("data/tables/ai.tbl"). Only files, not directories. Matching is
+	// case-insensitive like the engine's, with an exact-case match preferred.
+	// Returns nullptr (and says why on stderr) if the name is ambiguous.
 	vp_file* find(const std::string& name) const;
 
+	// Find every file matching the given bare name or full internal path
+	std::vector<vp_file*> find_all(const std::string& name) const;
+
 	// Human-friendly name for printing
 	std::string to_string() const;
 
+	// Read LZ41-compressed files out as they are stored, rather than
+	// decompressing them
+	void set_raw(bool raw);
+
 	// Get the filename for the package file
 	std::string get_filename() const { return m_filename; }
 
 	// Prints the directory index for the package
 	std::string print_index_listing() const;
 
-	// Update the on-disk package index for the given node
+	// Replace a file's contents by appending the new data, and then a new
+	// copy of the index, to the end of the package. Only once both are on
+	// disk is the header pointed at the new index, so the package stays
+	// readable if this is interrupted. The old data is left where it was.
+	bool append_file(vp_file* file, const std::filesystem::path& newfile);
+
+	// Apply a batch of edits (see edit_manifest.h) in one go. Edits are
+	// applied in order to a copy of the index, and checked as they go; only
+	// once they all make sense is anything written. New data is then
+	// appended to the package, followed by the new index, and the header is
+	// switched over last, as in append_file(). Space used by replaced and
+	// deleted files is left unused. The index is parsed again afterwards.
+	bool apply_edits(const std::vector<vp_edit>& edits);
+
+	// Whether any other file's data overlaps the given file's, as happens
+	// when a deduplicated build stored identical files once
+	bool shares_data(const vp_file* file) const;
+
+	// Update the on-disk package index for the given node. Each node knows
+	// where its entry is, so this is a single write.
 	bool update_index(const vp_node* node) const;
 
-	// Extracts the entire package to the given path
-	bool dump(const std::string& dest_path) const;
-
-	// Builds a package file from the given path
-	bool build(const std::filesystem::path& p, const std::string& vp_filename);
+	// Update the on-disk index entries for several nodes, writing entries that
+	// sit next to each other in the index together
+	bool update_index(const std::vector<const vp_node*>& nodes) const;
+
+	// Every file the filter selects, in index order
+	std::vector<const vp_file*> select(const path_filter& filter) const;
+
+	// Extracts the entire package, or just the files the filter selects, to
+	// the given path. The directory tree is created up front, then the file
+	// data is read in offset order (see read_scheduler). With more than one
+	// job, a pool of that many threads writes the files. Extracted files get
+	// the entry's timestamp as their modification time, which is what
+	// VP_SKIP_UNCHANGED compares against on the next run.
+	bool dump(const std::string& dest_path, unsigned jobs = 1, const path_filter* filter = nullptr,
+		vp_update_mode update = VP_OVERWRITE, vp_extract_stats* stats = nullptr) const;
+
+	// Builds a package file from the given path. The given number of reader
+	// threads open and read the input files ahead of a single writer, which
+	// appends them to the package in order. With dedup set, files whose
+	// contents have already been stored (going by their hash, then confirmed
+	// byte for byte) aren't stored again; their entries point at the first
+	// copy instead. Given a base package (typically an earlier build of the
+	// same tree), files with the same path, size and timestamp as in the base
+	// are copied from it rather than read again, stored as they are there;
+	// the base may be vp_filename itself. With compress set, files are stored
+	// LZ41-compressed (see lz41.h) where that makes them meaningfully
+	// smaller. The compressing is spread over the reader threads, and for
+	// big files a pool of jobs threads working a batch of blocks at a time,
+	// so the package comes out the same whatever jobs is.
+	bool build(const std::filesystem::path& p, const std::string& vp_filename, unsigned jobs = 1,
+		bool dedup = false, vp_build_stats* stats = nullptr, const vp_index* base = nullptr,
+		bool compress = false);
+
+	// Write a copy of the package without any unused space: data left behind
+	// by replaced or deleted files, gaps, and stale copies of the index. File
+	// data is copied in offset order, in runs as long as the live data allows,
+	// and keeps its order. The output may be this package's own file, in
+	// which case the copy is moved into place at the end and the package
+	// parsed again. progress, if given, is called with the bytes copied so far
+	// and the total.
+	bool compact(const std::string& vp_filename, vp_compact_stats* stats = nullptr,
+		std::function<void(uint64_t, uint64_t)> progress = nullptr);
+
+	// Compute the CRC-32C (see crc32c.h) of every file's data, in index
+	// order. The data is read from the mapping, or with positional reads, by
+	// a pool of jobs threads; big files are split into pieces so that they
+	// are spread over the pool too.
+	bool checksum(std::vector<vp_checksum>& sums, unsigned jobs = 1) const;
+
+	// Check every file against a checksum manifest, matching them up by
+	// path. Each file that doesn't match, and each one that is only in the
+	// package or only in the manifest, is reported on stderr. Returns true if
+	// everything matched.
+	bool verify(const std::vector<vp_checksum>& expected, unsigned jobs = 1, vp_verify_stats* stats = nullptr) const;
+
+	// Compare this package with a newer one, matching files up by path, and
+	// list what was added, removed or changed, sorted by path. Files of the
+	// same size are compared piece by piece on a pool of jobs threads, and a
+	// file stops being read at its first piece that differs. Nothing is
+	// written to disk.
+	bool diff(const vp_index& other, std::vector<vp_diff_entry>& changes, unsigned jobs = 1) const;
+
+	// Write a patch that turns this package into newer, byte for byte. New
+	// files whose data is already in this package, under any name, are
+	// copied from it by reference; changed files are sent as a delta against
+	// the file at the same path (see delta.h), and the rest, along with the
+	// header and index, as they are. Both packages must be opened
+	// VP_READ_ONLY.
+	bool make_patch(const vp_index& newer, const std::string& patch_filename, vp_patch_stats* stats = nullptr) const;
+
+	// Rebuild the newer package from old_filename and a patch written by
+	// make_patch(). The output is streamed to a temporary file and moved into
+	// place once it's complete, so it may be old_filename itself. Fails,
+	// leaving the output alone, if the patch was made from another package.
+	static bool apply_patch(
+		const std::string& old_filename, const std::string& patch_filename, const std::string& out_filename);
 
 private:
+	void reset();
+	bool load_cache(const std::string& cache_path, const vp_cache_key& key);
+	bool save_cache(const std::string& cache_path, const vp_cache_key& key) const;
+
 	std::string m_filename;
-	vp_directory* m_root = nullptr;
+	vp_entry_table* m_table = nullptr;
 	std::fstream* m_filestream = nullptr;
+	mapped_file* m_mapping = nullptr;
+	int m_package_fd = -1;
+	uint32_t m_diroffset = 0; // Where the on-disk index starts
+	bool m_raw = false;
 };
+
+inline const vp_entry& vp_node::entry() const
+{
+	return m_table->entries[m_id];
+}
+
+inline vp_entry& vp_node::entry()
+{
+	return m_table->entries[m_id];
+}
@@ -0,0 +1,140 @@
+#include "xxh64.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// The input is read as little-endian words; memcpy keeps unaligned reads legal
+static inline uint64_t read64(const unsigned char* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t mix_round(uint64_t acc, uint64_t input)
+{
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return acc * prime1;
+}
+
+static inline uint64_t merge_round(uint64_t h, uint64_t acc)
+{
+	h ^= mix_round(0, acc);
+	return h * prime1 + prime4;
+}
+
+xxh64::xxh64(uint64_t seed)
+	: m_acc { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 }
+	, m_seed(seed)
+{
+}
+
+void xxh64::update(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	m_total += size;
+
+	// Top up a partial stripe left over from last time
+	if (m_pending_size > 0) {
+		size_t n = std::min(size, sizeof(m_pending) - m_pending_size);
+		memcpy(m_pending + m_pending_size, p, n);
+		m_pending_size += n;
+		p += n;
+		size -= n;
+		if (m_pending_size < sizeof(m_pending)) {
+			return;
+		}
+		for (int i = 0; i < 4; ++i) {
+			m_acc[i] = mix_round(m_acc[i], read64(m_pending + i * 8));
+		}
+		m_pending_size = 0;
+	}
+
+	// Whole 32-byte stripes, one word into each accumulator
+	uint64_t a0 = m_acc[0], a1 = m_acc[1], a2 = m_acc[2], a3 = m_acc[3];
+	while (size >= 32) {
+		a0 = mix_round(a0, read64(p));
+		a1 = mix_round(a1, read64(p + 8));
+		a2 = mix_round(a2, read64(p + 16));
+		a3 = mix_round(a3, read64(p + 24));
+		p += 32;
+		size -= 32;
+	}
+	m_acc[0] = a0;
+	m_acc[1] = a1;
+	m_acc[2] = a2;
+	m_acc[3] = a3;
+
+	memcpy(m_pending, p, size);
+	m_pending_size = size;
+}
+
+uint64_t xxh64::digest() const
+{
+	uint64_t h;
+	if (m_total >= 32) {
+		h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) + rotl(m_acc[2], 12) + rotl(m_acc[3], 18);
+		for (int i = 0; i < 4; ++i) {
+			h = merge_round(h, m_acc[i]);
+		}
+	} else {
+		h = m_seed + prime5;
+	}
+	h += m_total;
+
+	// Fold in whatever didn't make up a whole stripe
+	const unsigned char* p = m_pending;
+	size_t size = m_pending_size;
+	while (size >= 8) {
+		h ^= mix_round(0, read64(p));
+		h = rotl(h, 27) * prime1 + prime4;
+		p += 8;
+		size -= 8;
+	}
+	if (size >= 4) {
+		h ^= read32(p) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+		size -= 4;
+	}
+	while (size > 0) {
+		h ^= *p * prime5;
+		h = rotl(h, 11) * prime1;
+		++p;
+		--size;
+	}
+
+	// Avalanche
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t xxh64::hash(const void* data, size_t size, uint64_t seed)
+{
+	xxh64 state(seed);
+	state.update(data, size);
+	return state.digest();
+}
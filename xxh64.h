@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * XXH64, a fast non-cryptographic 64-bit hash. Good for spotting files that
+ * are probably the same, not for proving it: anything that matters has to be
+ * confirmed by comparing the bytes.
+ *
+ * Hashes can be computed in one go with hash(), or piece by piece by calling
+ * update() as the data comes in; both give the same result.
+ */
+class xxh64 {
+public:
+	explicit xxh64(uint64_t seed = 0);
+
+	/// Add the next piece of the input
+	void update(const void* data, size_t size);
+
+	/// Hash of everything added so far
+	uint64_t digest() const;
+
+	/// Hash a whole buffer
+	static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+
+private:
+	uint64_t m_acc[4];
+	uint64_t m_seed;
+	uint64_t m_total = 0;
+	unsigned char m_pending[32];
+	size_t m_pending_size = 0;
+};